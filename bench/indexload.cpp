@@ -0,0 +1,184 @@
+// Cold-start cost of the index: index.json parsed into a MetadataTable,
+// versus the same table copied out of the mapped index.bin columns, versus
+// answering lookups straight from the mapping with no table at all. Memory
+// is measured from the allocator (glibc's mallinfo2): heap in use while the
+// parsed QJsonObject is held, and while only the table built from it is.
+//
+//   bench_indexload [entries=20000] [runs=7]
+
+#include "binaryindex.h"
+#include "metadatatable.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTimeZone>
+#include <QDebug>
+#include <algorithm>
+#include <iterator>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+
+QJsonObject syntheticIndex(int entries)
+{
+    QRandomGenerator rng(42);
+    const QStringList subs = { "wallpapers", "EarthPorn", "SpacePorn", "CityPorn", "wallpaper", "MinimalWallpaper" };
+    const QSize sizes[] = { { 1920, 1080 }, { 2560, 1440 }, { 3840, 2160 }, { 1080, 1920 }, { 5120, 2880 } };
+    const QDateTime start = QDateTime::fromSecsSinceEpoch(1700000000, QTimeZone::utc());
+    QJsonObject root;
+    for (int i = 0; i < entries; ++i) {
+        QByteArray hash(32, Qt::Uninitialized);
+        for (char &c : hash) c = char(rng.bounded(256));
+        const QString name = QString::fromLatin1(hash.toHex());
+        QJsonObject e;
+        e.insert("subreddit", subs.at(rng.bounded(subs.size())));
+        const QSize size = sizes[rng.bounded(int(std::size(sizes)))];
+        e.insert("width", size.width());
+        e.insert("height", size.height());
+        e.insert("thumbnail", name + "-thumb.jpg");
+        e.insert("favorite", rng.bounded(20) == 0);
+        e.insert("banned", rng.bounded(50) == 0);
+        e.insert("downloaded_at", start.addSecs(i * 60).toString(Qt::ISODate));
+        root.insert(name + (rng.bounded(4) == 0 ? ".png" : ".jpg"), e);
+    }
+    return root;
+}
+
+// entries looked up from the mapping per run
+constexpr int kLookups = 1000;
+
+// bytes the allocator has handed out and not had back, or -1
+qint64 heapInUse()
+{
+#ifdef __GLIBC__
+    return qint64(mallinfo2().uordblks);
+#else
+    return -1;
+#endif
+}
+
+QString kib(qint64 bytes)
+{
+    return bytes < 0 ? QString("n/a") : QString::number(bytes / 1024);
+}
+
+double median(QVector<double> v)
+{
+    std::sort(v.begin(), v.end());
+    return v.isEmpty() ? 0 : v.at(v.size() / 2);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    const int entries = args.size() > 1 ? args.at(1).toInt() : 20000;
+    const int runs = args.size() > 2 ? args.at(2).toInt() : 7;
+
+    QTemporaryDir dir;
+    const QString jsonPath = dir.filePath("index.json");
+    const QString binPath = dir.filePath("index.bin");
+    {
+        const QJsonObject root = syntheticIndex(entries);
+        QFile f(jsonPath);
+        if (!f.open(QIODevice::WriteOnly)) return 1;
+        f.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+        f.close();
+        const QFileInfo info(jsonPath);
+        if (!BinaryIndex::write(binPath, *MetadataTable::fromJson(root), info.size(), info.lastModified().toMSecsSinceEpoch())) return 1;
+    }
+
+    // keys the mapped lookups ask for, spread over the index
+    QStringList probes;
+    {
+        BinaryIndex bin;
+        if (!bin.open(binPath)) return 1;
+        const int step = qMax(1, bin.count() / kLookups);
+        for (int row = 0; row < bin.count(); row += step) probes << bin.key(row);
+    }
+
+    QVector<double> jsonMs, binMs, lookupMs;
+    for (int run = 0; run < runs; ++run) {
+        QElapsedTimer timer;
+        timer.start();
+        QFile f(jsonPath);
+        f.open(QIODevice::ReadOnly);
+        const QJsonObject root = QJsonDocument::fromJson(f.readAll()).object();
+        auto fromJson = MetadataTable::fromJson(root);
+        jsonMs << timer.nsecsElapsed() / 1e6;
+
+        timer.restart();
+        BinaryIndex bin;
+        if (!bin.open(binPath)) return 1;
+        auto fromBinary = MetadataTable::fromBinary(bin);
+        binMs << timer.nsecsElapsed() / 1e6;
+        if (run == 0 && fromBinary->toJson() != root) {
+            qWarning() << "index.bin does not reproduce index.json";
+            return 1;
+        }
+
+        // a cold reader that only needs a few entries: map and look them up
+        timer.restart();
+        BinaryIndex mapped;
+        if (!mapped.open(binPath)) return 1;
+        int hits = 0;
+        for (const QString &key : std::as_const(probes)) {
+            const int row = mapped.find(key);
+            if (row >= 0 && mapped.entry(row).size.isValid()) hits++;
+        }
+        lookupMs << timer.nsecsElapsed() / 1e6;
+        if (hits != probes.size()) {
+            qWarning() << "mapped lookups found" << hits << "entries";
+            return 1;
+        }
+    }
+
+    // heap held by each representation, measured on its own: the parsed
+    // JSON (file buffer already freed), then the table once the JSON is gone
+    qint64 jsonHeap = -1, tableHeap = -1, binTableHeap = -1;
+    if (heapInUse() >= 0) {
+        const qint64 base = heapInUse();
+        std::shared_ptr<MetadataTable> table;
+        {
+            QJsonObject root;
+            {
+                QFile f(jsonPath);
+                if (!f.open(QIODevice::ReadOnly)) return 1;
+                root = QJsonDocument::fromJson(f.readAll()).object();
+            }
+            jsonHeap = heapInUse() - base;
+            table = MetadataTable::fromJson(root);
+        }
+        tableHeap = heapInUse() - base;
+        table.reset();
+        const qint64 binBase = heapInUse();
+        {
+            BinaryIndex bin;
+            if (!bin.open(binPath)) return 1;
+            table = MetadataTable::fromBinary(bin);
+        }
+        binTableHeap = heapInUse() - binBase;
+    }
+
+    qInfo().noquote() << QString("entries=%1 runs=%2").arg(entries).arg(runs);
+    qInfo().noquote() << QString("index.json: %1 KiB, parse + table %2 ms")
+                             .arg(QFileInfo(jsonPath).size() / 1024).arg(median(jsonMs), 0, 'f', 1);
+    qInfo().noquote() << QString("index.bin:  %1 KiB, map + table %2 ms, map + %3 lookups %4 ms")
+                             .arg(QFileInfo(binPath).size() / 1024).arg(median(binMs), 0, 'f', 1)
+                             .arg(probes.size()).arg(median(lookupMs), 0, 'f', 2);
+    qInfo().noquote() << QString("heap: parsed json %1 KiB, table from json %2 KiB, table from index.bin %3 KiB")
+                             .arg(kib(jsonHeap), kib(tableHeap), kib(binTableHeap));
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Scan throughput: UpdateWorker against the local fixture server, with a
+// throwaway HOME so the cache, config and listing cache start empty. One
+// scan per invocation; reports images/s, bytes/s and per-image latency
+// (first request for the image -> imageCached, so retries count).
+//
+//   bench_scan [--concurrency n] [--per-host n] [--latency ms] [--bandwidth kib]
+//              [--throttle-every n] [--drop-every n] [--fixture dir] ...  (see --help)
+//
+// With --fixture, --per-sub is still the number of posts taken per subreddit.
+// --sweep 1,2,4,8 runs one child scan per value, each with that many
+// downloads in flight in total and per host (the fixture is a single host),
+// and prints one throughput line per value. Level 1 downloads one image at
+// a time, like scans did before the download queue.
+
+#include "cachemanager.h"
+#include "fixtureserver.h"
+#include "redditfetcher.h"
+#include "updateworker.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QThreadPool>
+#include <QDebug>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// Re-run this benchmark once per concurrency level, each in a fresh process
+// (and so a fresh cache), and pick the summary lines out of its output
+int sweep(const QStringList &args, const QStringList &levels)
+{
+    QStringList base;
+    for (int i = 1; i < args.size(); ++i) {
+        if (args.at(i) == "--sweep") {
+            i++;
+            continue;
+        }
+        if (!args.at(i).startsWith("--sweep=")) base << args.at(i);
+    }
+    for (const QString &level : levels) {
+        QProcess child;
+        child.setProcessChannelMode(QProcess::MergedChannels);
+        child.start(args.first(), base + QStringList{ "--concurrency", level, "--per-host", level });
+        if (!child.waitForFinished(-1) || child.exitCode() != 0) {
+            qWarning().noquote() << "concurrency" << level << "failed:" << child.readAll();
+            return 1;
+        }
+        QStringList summary;
+        for (const QByteArray &line : child.readAll().split('\n')) {
+            if (line.startsWith("throughput:") || line.startsWith("latency ms:")) summary << QString::fromUtf8(line);
+        }
+        qInfo().noquote() << QString("concurrency %1:").arg(level, 2) << summary.join("; ");
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    // before anything resolves ~/.cache/wallaroo or ~/.config/wallaroo
+    QTemporaryDir home;
+    if (!home.isValid()) return 1;
+    qputenv("HOME", home.path().toLocal8Bit());
+    qunsetenv("XDG_CONFIG_HOME");
+    qunsetenv("XDG_CACHE_HOME");
+
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times one UpdateWorker scan against a local fixture server.");
+    parser.addHelpOption();
+    parser.addOptions({
+        { "concurrency", "Downloads in flight in total.", "n", QString::number(UpdateWorker::kDefaultConcurrency) },
+        { "per-host", "Downloads in flight per host.", "n", QString::number(UpdateWorker::kDefaultPerHost) },
+        { "no-batch", "One listing request per subreddit." },
+        { "sweep", "Run one scan per concurrency level, comma separated.", "levels" },
+    });
+    FixtureServer::addOptions(parser);
+    parser.process(app);
+    if (parser.isSet("sweep")) return sweep(app.arguments(), parser.value("sweep").split(',', Qt::SkipEmptyParts));
+
+    FixtureServer server;
+    if (!server.configure(parser) || !server.listen()) return 1;
+    RedditFetcher::setBaseUrl(server.baseUrl());
+    const QStringList subreddits = server.subreddits();
+
+    CacheManager cache;
+    UpdateWorker *worker = new UpdateWorker(&cache, subreddits, parser.value("per-sub").toInt());
+    worker->setConcurrency(parser.value("concurrency").toInt(), parser.value("per-host").toInt());
+    worker->setListingMode(UpdateWorker::Newest);
+    worker->setBatchListings(!parser.isSet("no-batch"));
+
+    QMutex mutex;
+    std::vector<std::pair<QString, qint64>> stored;  // image path on the server, stored at
+    qint64 bytes = 0;
+    QObject::connect(worker, &UpdateWorker::imageCached, worker,
+                     [&](const QString &localPath, const QString &, const QString &sourceUrl) {
+        const qint64 now = FixtureServer::nowMs();
+        const qint64 size = QFileInfo(localPath).size();
+        QMutexLocker lock(&mutex);
+        stored.emplace_back(QUrl(sourceUrl).path(), now);
+        bytes += size;
+    }, Qt::DirectConnection);
+    QObject::connect(worker, &UpdateWorker::finished, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+
+    // the worker runs on its own thread, as in the app; the server keeps the main one
+    QThread thread;
+    QObject::connect(&thread, &QThread::finished, worker, &QObject::deleteLater);
+    worker->moveToThread(&thread);
+    thread.start();
+    const qint64 startMs = FixtureServer::nowMs();
+    QMetaObject::invokeMethod(worker, &UpdateWorker::start, Qt::QueuedConnection);
+    app.exec();
+    const qint64 scanMs = qMax<qint64>(1, FixtureServer::nowMs() - startMs);
+    // thumbnails and index updates queued by the scan
+    QThreadPool::globalInstance()->waitForDone();
+    const qint64 drainMs = FixtureServer::nowMs() - startMs - scanMs;
+    thread.quit();
+    thread.wait();
+
+    std::vector<qint64> latencies;
+    for (const auto &s : stored) {
+        const qint64 first = server.firstRequestMs(s.first);
+        if (first >= 0) latencies.push_back(s.second - first);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) -> qint64 {
+        if (latencies.empty()) return 0;
+        return latencies[qMin(latencies.size() - 1, size_t(p * latencies.size()))];
+    };
+    const double secs = scanMs / 1000.0;
+    const FixtureServer::Stats net = server.stats();
+    const FixtureServer::Faults faults = server.faults();
+
+    qInfo().noquote() << QString("fixture: %1 subreddits, latency %2 ms, bandwidth %3 KiB/s, 429 every %4, drop every %5")
+                             .arg(subreddits.size()).arg(faults.latencyMs).arg(faults.bytesPerSec / 1024)
+                             .arg(faults.throttleEvery).arg(faults.dropEvery);
+    qInfo().noquote() << QString("scan: %1 images, %2 MiB in %3 s (indexing drained %4 ms later)")
+                             .arg(stored.size()).arg(bytes / 1048576.0, 0, 'f', 1).arg(secs, 0, 'f', 2).arg(drainMs);
+    qInfo().noquote() << QString("throughput: %1 images/s, %2 MiB/s")
+                             .arg(stored.size() / secs, 0, 'f', 1).arg(bytes / 1048576.0 / secs, 0, 'f', 2);
+    qInfo().noquote() << QString("latency ms: p50 %1, p99 %2, max %3")
+                             .arg(percentile(0.50)).arg(percentile(0.99)).arg(latencies.empty() ? 0 : latencies.back());
+    qInfo().noquote() << QString("server: %1 requests, %2 throttled, %3 dropped, %4 ranged")
+                             .arg(net.requests).arg(net.throttled).arg(net.dropped).arg(net.partial);
+    return 0;
+}
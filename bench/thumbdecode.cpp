@@ -0,0 +1,89 @@
+// Thumbnail decode cost: a full decode followed by a smooth resample (the old
+// path) against ThumbnailGenerator::load, which hands the box to the reader
+// so JPEG decodes at a reduced DCT scale. Also times one full pyramid write.
+//
+//   bench_thumbdecode [image=synthetic 7680x4320 JPEG] [runs=5]
+
+#include "thumbnailgenerator.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QPainter>
+#include <QTemporaryDir>
+#include <QDebug>
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+// Busy enough that the encoder can't shrink it to nothing
+QImage syntheticWallpaper(int w, int h)
+{
+    QImage img(w, h, QImage::Format_RGB32);
+    QPainter p(&img);
+    QLinearGradient g(0, 0, w, h);
+    g.setColorAt(0, QColor(20, 40, 90));
+    g.setColorAt(1, QColor(230, 150, 60));
+    p.fillRect(img.rect(), g);
+    for (int i = 0; i < 400; ++i) {
+        p.setPen(QColor::fromHsv((i * 37) % 360, 200, 220));
+        p.drawEllipse(QPoint((i * 7919) % w, (i * 104729) % h), 40 + i % 200, 30 + i % 150);
+    }
+    return img;
+}
+
+double median(QVector<double> v)
+{
+    std::sort(v.begin(), v.end());
+    return v.isEmpty() ? 0 : v.at(v.size() / 2);
+}
+
+template <typename F>
+double timeMs(int runs, F f)
+{
+    QVector<double> ms;
+    for (int i = 0; i < runs; ++i) {
+        QElapsedTimer t;
+        t.start();
+        f();
+        ms << t.nsecsElapsed() / 1e6;
+    }
+    return median(ms);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    const int runs = args.size() > 2 ? args.at(2).toInt() : 5;
+    QTemporaryDir dir;
+    QString path = args.size() > 1 ? args.at(1) : QString();
+    if (path.isEmpty()) {
+        path = dir.filePath("wallpaper.jpg");
+        if (!syntheticWallpaper(7680, 4320).save(path, "JPEG", 90)) return 1;
+    }
+    const QSize full = QImageReader(path).size();
+    qInfo().noquote() << QString("%1: %2x%3, %4 KiB, runs=%5").arg(QFileInfo(path).fileName())
+                             .arg(full.width()).arg(full.height()).arg(QFileInfo(path).size() / 1024).arg(runs);
+
+    for (int box : ThumbnailGenerator::kLevels) {
+        const double fullMs = timeMs(runs, [&] {
+            QImage img = QImageReader(path).read();
+            img = img.scaled(box, box, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        });
+        const double scaledMs = timeMs(runs, [&] { ThumbnailGenerator::load(path, box); });
+        const double mappedMs = timeMs(runs, [&] { ThumbnailGenerator::loadMapped(path, box); });
+        qInfo().noquote() << QString("box %1: full decode + scale %2 ms, scaled decode %3 ms, mapped %4 ms")
+                                 .arg(box, 3).arg(fullMs, 0, 'f', 1).arg(scaledMs, 0, 'f', 1).arg(mappedMs, 0, 'f', 1);
+    }
+    const QString thumbPath = dir.filePath("bench-thumb.jpg");
+    const double pyramidMs = timeMs(runs, [&] { ThumbnailGenerator::generate(path, thumbPath); });
+    qInfo().noquote() << QString("pyramid (%1 levels): %2 ms").arg(std::size(ThumbnailGenerator::kLevels))
+                             .arg(pyramidMs, 0, 'f', 1);
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Time to a full grid: the per-file layout (QFile::exists and a JPEG decode
+// per tile, on the thread pool like ThumbnailViewer's LoadRunnable) against
+// QImages over thumbs.pack. The pack is filled once, then a copy is opened
+// (the header walk is timed separately) and read for every run. Both paths
+// copy each tile once, as the grid does converting to a pixmap; the page
+// cache is warm for both. Then a quarter of the images are removed and the
+// pack compacted while some tiles are still held, to show the old mapping
+// going with the last of them.
+//
+//   bench_thumbpack [thumbnails=5000] [level=256] [runs=5]
+
+#include "thumbnailgenerator.h"
+#include "thumbnailpack.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QPainter>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QDebug>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+QImage syntheticThumbnail(int level)
+{
+    QImage img(level, level * 9 / 16, QImage::Format_RGB32);
+    QPainter p(&img);
+    QLinearGradient g(0, 0, img.width(), img.height());
+    g.setColorAt(0, QColor(20, 40, 90));
+    g.setColorAt(1, QColor(230, 150, 60));
+    p.fillRect(img.rect(), g);
+    for (int i = 0; i < 40; ++i) {
+        p.setPen(QColor::fromHsv((i * 37) % 360, 200, 220));
+        p.drawEllipse(QPoint((i * 7919) % img.width(), (i * 104729) % img.height()), 4 + i % 30, 3 + i % 20);
+    }
+    return img;
+}
+
+// stands in for QPixmap::fromImage, which copies the pixels
+qint64 upload(const QImage &img)
+{
+    return img.copy().sizeInBytes();
+}
+
+double median(QVector<double> v)
+{
+    std::sort(v.begin(), v.end());
+    return v.isEmpty() ? 0 : v.at(v.size() / 2);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    const int count = args.size() > 1 ? args.at(1).toInt() : 5000;
+    const int level = args.size() > 2 ? args.at(2).toInt() : ThumbnailGenerator::kBaseLevel;
+    const int runs = args.size() > 3 ? args.at(3).toInt() : 5;
+
+    QTemporaryDir dir;
+    QStringList keys;
+    QStringList paths;
+    {
+        QByteArray jpeg;
+        const QString first = dir.filePath("first.jpg");
+        if (!syntheticThumbnail(level).save(first, "JPEG", ThumbnailGenerator::kJpegQuality)) return 1;
+        QFile f(first);
+        f.open(QIODevice::ReadOnly);
+        jpeg = f.readAll();
+        for (int i = 0; i < count; ++i) {
+            const QString key = QString::fromLatin1(QCryptographicHash::hash(QByteArray::number(i), QCryptographicHash::Sha1).toHex());
+            const QString path = ThumbnailGenerator::levelPath(dir.filePath(key + "-thumb.jpg"), level);
+            QFile out(path);
+            if (!out.open(QIODevice::WriteOnly) || out.write(jpeg) != jpeg.size()) return 1;
+            keys << key;
+            paths << path;
+        }
+    }
+
+    // per-file layout
+    QVector<double> fileMs;
+    std::vector<QImage> decoded(count);
+    qint64 uploaded = 0;
+    for (int run = 0; run < runs; ++run) {
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < count; ++i) {
+            QThreadPool::globalInstance()->start([&decoded, &paths, i, level] {
+                if (QFile::exists(paths.at(i))) decoded[i] = ThumbnailGenerator::load(paths.at(i), level);
+            });
+        }
+        QThreadPool::globalInstance()->waitForDone();
+        for (const QImage &img : decoded) uploaded += upload(img);
+        fileMs << timer.nsecsElapsed() / 1e6;
+    }
+
+    // fill a pack, then open a copy of it as a fresh instance
+    QElapsedTimer appendTimer;
+    appendTimer.start();
+    ThumbnailPack *source = ThumbnailPack::forCacheDir(dir.path());
+    for (int i = 0; i < count; ++i) {
+        if (!source->append(keys.at(i), level, decoded[i])) {
+            qWarning() << "append failed at tile" << i << "- the pack holds at most" << ThumbnailPack::kMaxFileBytes << "bytes";
+            return 1;
+        }
+    }
+    const double appendMs = appendTimer.nsecsElapsed() / 1e6;
+    const qint64 packBytes = source->fileSize();
+
+    const QString openDir = dir.filePath("open");
+    QDir().mkpath(openDir);
+    if (!QFile::copy(dir.filePath("thumbs.pack"), QDir(openDir).filePath("thumbs.pack"))) return 1;
+    QElapsedTimer openTimer;
+    openTimer.start();
+    ThumbnailPack *pack = ThumbnailPack::forCacheDir(openDir);
+    const double openMs = openTimer.nsecsElapsed() / 1e6;
+
+    QVector<double> packMs;
+    for (int run = 0; run < runs; ++run) {
+        QElapsedTimer timer;
+        timer.start();
+        int hits = 0;
+        for (const QString &key : std::as_const(keys)) {
+            const QImage img = pack->image(key, level);
+            if (!img.isNull()) hits++;
+            uploaded += upload(img);
+        }
+        packMs << timer.nsecsElapsed() / 1e6;
+        if (hits != count) {
+            qWarning() << "pack returned" << hits << "of" << count << "tiles";
+            return 1;
+        }
+    }
+
+    qInfo().noquote() << QString("%1 thumbnails at level %2, runs=%3").arg(count).arg(level).arg(runs);
+    qInfo().noquote() << QString("per-file JPEG: %1 ms to full grid").arg(median(fileMs), 0, 'f', 1);
+    qInfo().noquote() << QString("pack:          %1 ms to full grid, after a %2 ms open")
+                             .arg(median(packMs), 0, 'f', 1).arg(openMs, 0, 'f', 1);
+    qInfo().noquote() << QString("pack file: %1 MiB, filled in %2 ms (%3 MiB of tiles copied overall)")
+                             .arg(packBytes / 1048576.0, 0, 'f', 1).arg(appendMs, 0, 'f', 1).arg(uploaded / 1048576.0, 0, 'f', 1);
+
+    // compaction with tiles still held: the old file stays mapped until they
+    // go. A quarter stays below the automatic compaction threshold.
+    std::vector<QImage> held;
+    for (int i = 0; i < count && held.size() < 100; i += 4) held.push_back(pack->image(keys.at(i), level));
+    for (int i = 0; i < count; i += 4) pack->remove(keys.at(i));
+    const qint64 dead = pack->deadBytes();
+    QElapsedTimer compactTimer;
+    compactTimer.start();
+    const qint64 reclaimed = pack->compact();
+    const double compactMs = compactTimer.nsecsElapsed() / 1e6;
+    const int mappingsHeld = pack->mappingCount();
+    held.clear();
+    qInfo().noquote() << QString("compact: %1 MiB dead, %2 MiB reclaimed in %3 ms, %4 tiles left; mappings %5 while tiles held, %6 after")
+                             .arg(dead / 1048576.0, 0, 'f', 1).arg(reclaimed / 1048576.0, 0, 'f', 1)
+                             .arg(compactMs, 0, 'f', 1).arg(pack->tileCount()).arg(mappingsHeld).arg(pack->mappingCount());
+    return 0;
+}
@@ -0,0 +1,456 @@
+#include "fixtureserver.h"
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLinearGradient>
+#include <QPainter>
+#include <QRegularExpression>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrlQuery>
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+
+// bodies are paced in this many slices per second under a bandwidth cap
+constexpr int kTicksPerSec = 20;
+const QByteArray kLastModified = "Tue, 14 Nov 2023 22:13:20 GMT";
+const QByteArray kBasePlaceholder = "{{base}}";
+
+const char *reasonPhrase(int status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 416: return "Range Not Satisfiable";
+    case 429: return "Too Many Requests";
+    default: return "Unknown";
+    }
+}
+
+QByteArray contentTypeFor(const QString &path)
+{
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == "jpg" || suffix == "jpeg") return "image/jpeg";
+    if (suffix == "png") return "image/png";
+    if (suffix == "webp") return "image/webp";
+    if (suffix == "json") return "application/json";
+    return "application/octet-stream";
+}
+
+QByteArray syntheticJpeg(const QSize &size)
+{
+    QImage img(size, QImage::Format_RGB32);
+    QPainter p(&img);
+    QLinearGradient g(0, 0, size.width(), size.height());
+    g.setColorAt(0, QColor(30, 60, 110));
+    g.setColorAt(1, QColor(220, 140, 70));
+    p.fillRect(img.rect(), g);
+    for (int i = 0; i < 200; ++i) {
+        p.setPen(QColor::fromHsv((i * 37) % 360, 200, 220));
+        p.drawEllipse(QPoint((i * 7919) % size.width(), (i * 104729) % size.height()), 20 + i % 120, 15 + i % 90);
+    }
+    p.end();
+    QByteArray out;
+    QBuffer buf(&out);
+    buf.open(QIODevice::WriteOnly);
+    img.save(&buf, "JPEG", 90);
+    return out;
+}
+
+} // namespace
+
+struct FixtureServer::Connection {
+    QByteArray buffer;
+    bool busy = false;        // a response is being sent
+    bool closeAfter = false;  // the request asked for Connection: close
+};
+
+FixtureServer::FixtureServer(QObject *parent)
+    : QObject(parent)
+    , m_server(new QTcpServer(this))
+{
+    connect(m_server, &QTcpServer::newConnection, this, &FixtureServer::onNewConnection);
+}
+
+FixtureServer::~FixtureServer()
+{
+    qDeleteAll(m_connections);
+}
+
+bool FixtureServer::listen(quint16 port)
+{
+    if (!m_server->listen(QHostAddress::LocalHost, port)) {
+        qWarning() << "FixtureServer: cannot listen on port" << port << "-" << m_server->errorString();
+        return false;
+    }
+    return true;
+}
+
+QUrl FixtureServer::baseUrl() const
+{
+    return QUrl(QString("http://127.0.0.1:%1").arg(m_server->serverPort()));
+}
+
+void FixtureServer::setFaults(const Faults &faults)
+{
+    m_faults = faults;
+}
+
+qint64 FixtureServer::nowMs()
+{
+    static const QElapsedTimer clock = [] { QElapsedTimer t; t.start(); return t; }();
+    return clock.elapsed();
+}
+
+void FixtureServer::addFile(const QString &path, const QByteArray &body, const QByteArray &contentType)
+{
+    File f;
+    f.body = body;
+    f.contentType = contentType;
+    f.etag = '"' + QCryptographicHash::hash(body, QCryptographicHash::Sha1).toHex().left(16) + '"';
+    m_files.insert(path, f);
+}
+
+void FixtureServer::addPost(const QString &subreddit, const QJsonObject &post)
+{
+    QVector<QJsonObject> &posts = m_posts[subreddit.toLower()];
+    const double created = post.value("created_utc").toDouble();
+    // after any post at least as new, so equal timestamps keep insertion order
+    auto pos = std::partition_point(posts.begin(), posts.end(), [created](const QJsonObject &p) {
+        return p.value("created_utc").toDouble() >= created;
+    });
+    posts.insert(pos, post);
+}
+
+QStringList FixtureServer::subreddits() const
+{
+    QStringList out;
+    for (auto it = m_posts.constBegin(); it != m_posts.constEnd(); ++it) {
+        if (!it->isEmpty()) out << it->first().value("subreddit").toString(it.key());
+    }
+    out.sort(Qt::CaseInsensitive);
+    return out;
+}
+
+void FixtureServer::addSyntheticSubreddits(const QStringList &subreddits, int perSub, const QSize &size)
+{
+    const QByteArray jpeg = syntheticJpeg(size);
+    const double newest = 1700000000;
+    for (int s = 0; s < subreddits.size(); ++s) {
+        const QString &sub = subreddits.at(s);
+        for (int n = 0; n < perSub; ++n) {
+            const QString path = QString("/img/%1/%2.jpg").arg(sub).arg(n);
+            // bytes after the EOI marker are ignored by decoders
+            addFile(path, jpeg + "wallaroo-fixture " + path.toUtf8(), "image/jpeg");
+            const QString url = QString::fromLatin1(kBasePlaceholder) + path;
+            QJsonObject source;
+            source.insert("url", url);
+            source.insert("width", size.width());
+            source.insert("height", size.height());
+            QJsonObject image;
+            image.insert("source", source);
+            QJsonObject preview;
+            preview.insert("images", QJsonArray{ image });
+            QJsonObject post;
+            post.insert("name", QString("t3_%1x%2").arg(s).arg(n));
+            post.insert("subreddit", sub);
+            // interleaved across subreddits, like a combined listing would be
+            post.insert("created_utc", newest - n * 60 - s);
+            post.insert("url", url);
+            post.insert("post_hint", "image");
+            post.insert("over_18", false);
+            post.insert("preview", preview);
+            addPost(sub, post);
+        }
+    }
+}
+
+int FixtureServer::loadDirectory(const QString &dirPath)
+{
+    const QDir dir(dirPath);
+    static const QRegularExpression listingPath("^r/([^/]+)/new\\.json$");
+    int loaded = 0;
+    QDirIterator it(dirPath, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString path = it.next();
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) {
+            qWarning() << "FixtureServer: cannot read" << path;
+            continue;
+        }
+        const QString rel = dir.relativeFilePath(path);
+        const QRegularExpressionMatch m = listingPath.match(rel);
+        if (m.hasMatch()) {
+            const QJsonArray children = QJsonDocument::fromJson(f.readAll()).object()
+                                            .value("data").toObject().value("children").toArray();
+            for (const QJsonValue &child : children) addPost(m.captured(1), child.toObject().value("data").toObject());
+        } else {
+            addFile('/' + rel, f.readAll(), contentTypeFor(rel));
+        }
+        loaded++;
+    }
+    qDebug() << "FixtureServer: loaded" << loaded << "files from" << dirPath;
+    return loaded;
+}
+
+void FixtureServer::addOptions(QCommandLineParser &parser)
+{
+    parser.addOptions({
+        { "fixture", "Replay the recorded fixture in <dir> instead of synthetic subreddits.", "dir" },
+        { "subreddits", "Synthetic subreddits, comma separated.", "names",
+          "wallpapers,EarthPorn,SpacePorn,CityPorn,MinimalWallpaper" },
+        { "per-sub", "Synthetic image posts per subreddit.", "n", "50" },
+        { "image-size", "Synthetic image size.", "WxH", "1920x1080" },
+        { "latency", "Delay before each response, in ms.", "ms", "0" },
+        { "bandwidth", "Per-connection bandwidth cap in KiB/s (0 = none).", "kib", "0" },
+        { "throttle-every", "Answer every Nth request with 429 (0 = never).", "n", "0" },
+        { "retry-after", "Retry-After sent with a 429, in seconds.", "secs", "1" },
+        { "drop-every", "Drop every Nth file response mid-body (0 = never).", "n", "0" },
+        { "drop-after", "Body bytes sent before a drop (0 = half the body).", "bytes", "0" },
+        { "no-ranges", "Ignore Range headers." },
+    });
+}
+
+bool FixtureServer::configure(const QCommandLineParser &parser)
+{
+    Faults f;
+    f.latencyMs = parser.value("latency").toInt();
+    f.bytesPerSec = parser.value("bandwidth").toLongLong() * 1024;
+    f.throttleEvery = parser.value("throttle-every").toInt();
+    f.retryAfterSecs = parser.value("retry-after").toInt();
+    f.dropEvery = parser.value("drop-every").toInt();
+    f.dropAfterBytes = parser.value("drop-after").toLongLong();
+    f.ranges = !parser.isSet("no-ranges");
+    setFaults(f);
+
+    if (parser.isSet("fixture")) return loadDirectory(parser.value("fixture")) > 0;
+    const QStringList dims = parser.value("image-size").split('x');
+    const QSize size(dims.value(0).toInt(), dims.value(1).toInt());
+    if (size.isEmpty()) {
+        qWarning() << "FixtureServer: bad --image-size" << parser.value("image-size");
+        return false;
+    }
+    addSyntheticSubreddits(parser.value("subreddits").split(',', Qt::SkipEmptyParts),
+                           parser.value("per-sub").toInt(), size);
+    return true;
+}
+
+void FixtureServer::onNewConnection()
+{
+    while (QTcpSocket *socket = m_server->nextPendingConnection()) {
+        m_connections.insert(socket, new Connection);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket] { onReadyRead(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket] {
+            delete m_connections.take(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void FixtureServer::onReadyRead(QTcpSocket *socket)
+{
+    Connection *conn = m_connections.value(socket);
+    if (!conn) return;
+    conn->buffer.append(socket->readAll());
+    processNext(socket);
+}
+
+void FixtureServer::processNext(QTcpSocket *socket)
+{
+    Connection *conn = m_connections.value(socket);
+    if (!conn || conn->busy) return;
+    const int end = conn->buffer.indexOf("\r\n\r\n");
+    if (end < 0) return;
+    const QList<QByteArray> lines = conn->buffer.left(end).split('\n');
+    conn->buffer.remove(0, end + 4);
+
+    Request req;
+    const QList<QByteArray> requestLine = lines.value(0).trimmed().split(' ');
+    req.method = requestLine.value(0);
+    const QByteArray target = requestLine.value(1);
+    const int q = target.indexOf('?');
+    req.path = QUrl::fromPercentEncoding(q < 0 ? target : target.left(q));
+    if (q >= 0) req.query = target.mid(q + 1);
+    for (int i = 1; i < lines.size(); ++i) {
+        const int colon = lines.at(i).indexOf(':');
+        if (colon > 0) req.headers.insert(lines.at(i).left(colon).trimmed().toLower(), lines.at(i).mid(colon + 1).trimmed());
+    }
+    conn->busy = true;
+    conn->closeAfter = req.headers.value("connection").toLower() == "close";
+    handle(socket, req);
+}
+
+void FixtureServer::handle(QTcpSocket *socket, const Request &req)
+{
+    m_stats.requests++;
+    if (!m_firstRequestMs.contains(req.path)) m_firstRequestMs.insert(req.path, nowMs());
+
+    if (req.method != "GET") {
+        respond(socket, 400, {}, QByteArray(), 0);
+        return;
+    }
+    if (m_faults.throttleEvery > 0 && m_stats.requests % m_faults.throttleEvery == 0) {
+        m_stats.throttled++;
+        respond(socket, 429, { { "Retry-After", QByteArray::number(m_faults.retryAfterSecs) } }, QByteArray(), 0);
+        return;
+    }
+
+    static const QRegularExpression listingPath("^/r/([^/]+)/new\\.json$");
+    const QRegularExpressionMatch m = listingPath.match(req.path);
+    if (m.hasMatch()) {
+        const QByteArray body = listingBody(m.captured(1), req.query);
+        respond(socket, 200, { { "Content-Type", "application/json" } }, body, body.size());
+        return;
+    }
+
+    auto it = m_files.constFind(req.path);
+    if (it == m_files.constEnd()) {
+        respond(socket, 404, {}, QByteArray(), 0);
+        return;
+    }
+    const qint64 size = it->body.size();
+    QList<QPair<QByteArray, QByteArray>> headers = {
+        { "Content-Type", it->contentType },
+        { "ETag", it->etag },
+        { "Last-Modified", kLastModified },
+    };
+    if (m_faults.ranges) headers.append({ "Accept-Ranges", "bytes" });
+
+    // "bytes=N-" or "bytes=N-M"; the range only applies while If-Range matches
+    int status = 200;
+    qint64 first = 0, last = size - 1;
+    const QByteArray range = req.headers.value("range");
+    const QByteArray ifRange = req.headers.value("if-range");
+    if (m_faults.ranges && range.startsWith("bytes=") && (ifRange.isEmpty() || ifRange == it->etag || ifRange == kLastModified)) {
+        const QList<QByteArray> bounds = range.mid(6).split('-');
+        bool ok = false;
+        const qint64 from = bounds.value(0).toLongLong(&ok);
+        if (ok) {
+            if (from >= size) {
+                respond(socket, 416, { { "Content-Range", "bytes */" + QByteArray::number(size) } }, QByteArray(), 0);
+                return;
+            }
+            status = 206;
+            first = from;
+            const qint64 to = bounds.value(1).toLongLong(&ok);
+            if (ok) last = qMin(to, size - 1);
+            headers.append({ "Content-Range", QString("bytes %1-%2/%3").arg(first).arg(last).arg(size).toLatin1() });
+            m_stats.partial++;
+        }
+    }
+    const QByteArray body = it->body.mid(first, last - first + 1);
+    qint64 limit = body.size();
+    m_fileResponses++;
+    if (m_faults.dropEvery > 0 && m_fileResponses % m_faults.dropEvery == 0 && body.size() > 1) {
+        limit = m_faults.dropAfterBytes > 0 ? qMin(m_faults.dropAfterBytes, limit - 1) : limit / 2;
+    }
+    respond(socket, status, headers, body, limit);
+}
+
+QByteArray FixtureServer::listingBody(const QString &group, const QByteArray &query) const
+{
+    const QUrlQuery q(QString::fromLatin1(query));
+    int limit = q.queryItemValue("limit").toInt();
+    if (limit <= 0) limit = 25;
+    limit = qMin(limit, 100);
+    const QString after = q.queryItemValue("after");
+
+    // a combined listing interleaves its members by age, like reddit's
+    QVector<QJsonObject> merged;
+    for (const QString &sub : group.split('+', Qt::SkipEmptyParts)) merged += m_posts.value(sub.toLower());
+    std::stable_sort(merged.begin(), merged.end(), [](const QJsonObject &a, const QJsonObject &b) {
+        return a.value("created_utc").toDouble() > b.value("created_utc").toDouble();
+    });
+    int start = 0;
+    if (!after.isEmpty()) {
+        start = merged.size();
+        for (int i = 0; i < merged.size(); ++i) {
+            if (merged.at(i).value("name").toString() == after) {
+                start = i + 1;
+                break;
+            }
+        }
+    }
+    QJsonArray children;
+    const int end = qMin(merged.size(), start + limit);
+    for (int i = start; i < end; ++i) {
+        QJsonObject child;
+        child.insert("kind", "t3");
+        child.insert("data", merged.at(i));
+        children.append(child);
+    }
+    QJsonObject data;
+    data.insert("children", children);
+    data.insert("after", end < merged.size() ? QJsonValue(merged.at(end - 1).value("name")) : QJsonValue());
+    QJsonObject listing;
+    listing.insert("kind", "Listing");
+    listing.insert("data", data);
+    QByteArray body = QJsonDocument(listing).toJson(QJsonDocument::Compact);
+    return body.replace(kBasePlaceholder, baseUrl().toString().toUtf8());
+}
+
+void FixtureServer::respond(QTcpSocket *socket, int status, const QList<QPair<QByteArray, QByteArray>> &headers,
+                            const QByteArray &body, qint64 bodyLimit)
+{
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(status) + ' ' + reasonPhrase(status) + "\r\n";
+    for (const auto &h : headers) head += h.first + ": " + h.second + "\r\n";
+    head += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    const Connection *conn = m_connections.value(socket);
+    if (conn && conn->closeAfter) head += "Connection: close\r\n";
+    head += "\r\n";
+    // the socket as context: nothing fires once the client has gone
+    QTimer::singleShot(m_faults.latencyMs, socket, [this, socket, head, body, bodyLimit] {
+        socket->write(head);
+        sendBody(socket, body, 0, bodyLimit);
+    });
+}
+
+void FixtureServer::sendBody(QTcpSocket *socket, const QByteArray &body, qint64 pos, qint64 limit)
+{
+    const qint64 slice = m_faults.bytesPerSec > 0 ? qMax<qint64>(1, m_faults.bytesPerSec / kTicksPerSec) : limit - pos;
+    const qint64 n = qMin(slice, limit - pos);
+    if (n > 0) {
+        socket->write(body.constData() + pos, n);
+        m_stats.bodyBytes += n;
+        pos += n;
+    }
+    if (pos >= limit) {
+        finishResponse(socket, limit < body.size());
+        return;
+    }
+    QTimer::singleShot(1000 / kTicksPerSec, socket, [this, socket, body, pos, limit] {
+        sendBody(socket, body, pos, limit);
+    });
+}
+
+void FixtureServer::finishResponse(QTcpSocket *socket, bool drop)
+{
+    Connection *conn = m_connections.value(socket);
+    if (!conn) return;
+    if (drop) {
+        // flushes what was written, then closes: the client sees a short body
+        m_stats.dropped++;
+        socket->disconnectFromHost();
+        return;
+    }
+    conn->busy = false;
+    if (conn->closeAfter) {
+        socket->disconnectFromHost();
+        return;
+    }
+    processNext(socket);
+}
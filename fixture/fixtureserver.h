@@ -0,0 +1,121 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QSize>
+#include <QStringList>
+#include <QUrl>
+#include <QVector>
+
+class QCommandLineParser;
+class QTcpServer;
+class QTcpSocket;
+
+// Minimal HTTP/1.1 server standing in for reddit and the image hosts, so
+// scans can be benchmarked and tested offline. Point RedditFetcher (or the
+// app, through WALLAROO_REDDIT_BASE) at baseUrl().
+//
+// Listings are answered from per-subreddit post lists, including combined
+// /r/a+b/new.json listings and `after` paging. Every other path is a static
+// file served with an ETag and Range/If-Range support. Faults are injected
+// per response: latency, a per-connection bandwidth cap, 429s and
+// connections dropped mid-body.
+class FixtureServer : public QObject {
+    Q_OBJECT
+public:
+    struct Faults {
+        int latencyMs = 0;          // before each response's headers
+        qint64 bytesPerSec = 0;     // per connection; 0 = unlimited
+        int throttleEvery = 0;      // every Nth request gets a 429; 0 = never
+        int retryAfterSecs = 1;
+        int dropEvery = 0;          // every Nth file body is cut short; 0 = never
+        qint64 dropAfterBytes = 0;  // body bytes sent before the cut; 0 = half
+        bool ranges = true;         // honour Range; off answers 200 with the whole body
+    };
+
+    explicit FixtureServer(QObject *parent = nullptr);
+    ~FixtureServer() override;
+
+    // Listen on 127.0.0.1; port 0 picks a free one
+    bool listen(quint16 port = 0);
+    QUrl baseUrl() const;
+
+    void setFaults(const Faults &faults);
+    Faults faults() const { return m_faults; }
+
+    // Serve body at path (no query), e.g. "/img/wallpapers/1.jpg"
+    void addFile(const QString &path, const QByteArray &body, const QByteArray &contentType);
+    // Body served at path, empty if none
+    QByteArray file(const QString &path) const { return m_files.value(path).body; }
+    // Append a post (a listing child's "data" object) to a subreddit's
+    // listing; posts are listed newest first by created_utc
+    void addPost(const QString &subreddit, const QJsonObject &post);
+    // `perSub` image posts per subreddit, each linking a JPEG of `size`
+    // served from /img/<subreddit>/<n>.jpg. The JPEG bodies share their
+    // pixels but differ in a trailer, so each one hashes to its own file.
+    void addSyntheticSubreddits(const QStringList &subreddits, int perSub, const QSize &size);
+    // Replay a recorded fixture: <dir>/r/<sub>/new.json listings feed the
+    // post lists, every other file is served at its relative path. The
+    // placeholder {{base}} in listings is replaced by baseUrl(), so recorded
+    // image URLs can point back at the server. Returns the files loaded.
+    int loadDirectory(const QString &dir);
+
+    // Command-line knobs shared by the fixture tool and the benchmarks
+    static void addOptions(QCommandLineParser &parser);
+    // Apply the parsed fault options and content (--fixture or synthetic)
+    bool configure(const QCommandLineParser &parser);
+
+    struct Stats {
+        qint64 requests = 0;
+        qint64 throttled = 0;   // answered 429
+        qint64 dropped = 0;     // bodies cut short
+        qint64 partial = 0;     // answered 206
+        qint64 bodyBytes = 0;   // body bytes written
+    };
+    Stats stats() const { return m_stats; }
+    // When the first request for path arrived, on nowMs()'s clock; -1 if
+    // it was never requested
+    qint64 firstRequestMs(const QString &path) const { return m_firstRequestMs.value(path, -1); }
+    // Monotonic process clock, safe to read from any thread
+    static qint64 nowMs();
+    // Subreddits with at least one post, as the posts spell them
+    QStringList subreddits() const;
+
+private:
+    struct Request {
+        QByteArray method;
+        QString path;
+        QHash<QByteArray, QByteArray> headers;  // lower-case names
+        QByteArray query;
+    };
+    struct Connection;
+    struct File {
+        QByteArray body;
+        QByteArray contentType;
+        QByteArray etag;
+    };
+
+    void onNewConnection();
+    void onReadyRead(QTcpSocket *socket);
+    // parse and answer the next buffered request, one at a time per connection
+    void processNext(QTcpSocket *socket);
+    void handle(QTcpSocket *socket, const Request &req);
+    QByteArray listingBody(const QString &group, const QByteArray &query) const;
+    // headers after the configured latency, then body[0, bodyLimit) paced
+    // to the bandwidth cap; the connection drops if bodyLimit < body.size()
+    void respond(QTcpSocket *socket, int status, const QList<QPair<QByteArray, QByteArray>> &headers,
+                 const QByteArray &body, qint64 bodyLimit);
+    void sendBody(QTcpSocket *socket, const QByteArray &body, qint64 pos, qint64 limit);
+    void finishResponse(QTcpSocket *socket, bool drop);
+
+    QTcpServer *m_server = nullptr;
+    Faults m_faults;
+    QHash<QTcpSocket*, Connection*> m_connections;
+    QHash<QString, File> m_files;
+    QHash<QString, QVector<QJsonObject>> m_posts;  // lower-cased subreddit -> posts, newest first
+    QHash<QString, qint64> m_firstRequestMs;
+    qint64 m_fileResponses = 0;
+    Stats m_stats;
+};
@@ -0,0 +1,26 @@
+// Serve a fixture until interrupted, e.g. for a manual run of the app:
+//
+//   wallaroo-fixture --port 8321 --latency 80 --bandwidth 2048 &
+//   WALLAROO_REDDIT_BASE=http://127.0.0.1:8321 wallaroo
+
+#include "fixtureserver.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Local stand-in for reddit listings and image hosts.");
+    parser.addHelpOption();
+    parser.addOption({ "port", "Port to listen on (0 = any free port).", "port", "0" });
+    FixtureServer::addOptions(parser);
+    parser.process(app);
+
+    FixtureServer server;
+    if (!server.configure(parser) || !server.listen(quint16(parser.value("port").toUInt()))) return 1;
+    qInfo().noquote() << "Serving" << server.subreddits().join(", ") << "at" << server.baseUrl().toString();
+    return app.exec();
+}
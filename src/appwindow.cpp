@@ -21,6 +21,16 @@
 #include "thumbnailviewer.h"
 #include "sourcespanel.h"
 #include "updateworker.h"
+#include "indexstore.h"
+#include "sqlitebackend.h"
+#include "bitmapindex.h"
+#include "metadatatable.h"
+#include "cachewatcher.h"
+#include "urlindex.h"
+#include "scanscheduler.h"
+#include "thumbnailgenerator.h"
+#include "thumbnailpack.h"
+#include "perflog.h"
 #include <QFrame>
 #include <QLabel>
 #include <QPushButton>
@@ -43,11 +53,28 @@
 #include <QRunnable>
 #include <QThreadPool>
 #include <QSet>
+#include <QImageReader>
 #include <QMetaObject>
+#include <algorithm>
 
-// forward declarations for helper functions defined later in this file
-static QJsonObject readIndex(const QString &indexPath);
-static bool writeIndex(const QString &indexPath, const QJsonObject &rootObj);
+// Merge values into config.json, written atomically
+static void saveConfigValues(const QString &configPath, const QJsonObject &values) {
+    QJsonObject cfg;
+    QFile rcf(configPath);
+    if (rcf.open(QIODevice::ReadOnly)) {
+        QJsonDocument doc = QJsonDocument::fromJson(rcf.readAll());
+        if (doc.isObject()) cfg = doc.object();
+        rcf.close();
+    }
+    for (auto it = values.begin(); it != values.end(); ++it) cfg.insert(it.key(), it.value());
+    QSaveFile sf(configPath);
+    if (sf.open(QIODevice::WriteOnly)) {
+        sf.write(QJsonDocument(cfg).toJson(QJsonDocument::Indented));
+        sf.commit();
+    } else {
+        qWarning() << "Failed to write config file:" << configPath;
+    }
+}
 
 // CleanupTask: deletes cached images whose subreddit is not in the allowed set
 class CleanupTask : public QRunnable {
@@ -55,26 +82,33 @@ public:
     CleanupTask(const QString &cacheDir, const QSet<QString> &allowed, QObject *main)
         : m_cacheDir(cacheDir), m_allowed(allowed), m_main(main) {}
     void run() override {
-        QString indexPath = QDir(m_cacheDir).filePath("index.json");
-        QJsonObject root = readIndex(indexPath);
-        QStringList toRemove;
-        for (auto it = root.constBegin(); it != root.constEnd(); ++it) {
-            QString key = it.key();
-            QJsonObject entry = it.value().toObject();
-            QString sub = entry.value("subreddit").toString();
+        IndexStore *store = IndexStore::forCacheDir(m_cacheDir);
+        const auto table = store->table();
+        QVector<int> toRemove;
+        QSet<QString> live;
+        for (int r = 0; r < table->rowCount(); ++r) {
+            QString sub = table->subreddit(r);
             if (!sub.isEmpty() && !m_allowed.contains(sub)) {
-                toRemove << key;
+                toRemove << r;
+            } else {
+                live.insert(QFileInfo(table->key(r)).baseName());
             }
         }
-        for (const QString &k : toRemove) {
-            QJsonObject entry = root.value(k).toObject();
+        for (int r : toRemove) {
+            const QString k = table->key(r);
             QString filepath = QDir(m_cacheDir).filePath(k);
             QFile::remove(filepath);
-            QString thumb = entry.value("thumbnail").toString();
-            if (!thumb.isEmpty()) QFile::remove(QDir(m_cacheDir).filePath(thumb));
-            root.remove(k);
+            QString thumb = table->thumbnail(r);
+            if (!thumb.isEmpty()) {
+                for (const QString &level : ThumbnailGenerator::levelPaths(QDir(m_cacheDir).filePath(thumb)))
+                    QFile::remove(level);
+            }
+            store->remove(k);
         }
-        writeIndex(indexPath, root);
+
+        // compact the thumbnail pack to the remaining images, including any
+        // deleted while the app wasn't running
+        ThumbnailPack::forCacheDir(m_cacheDir)->compact(live);
 
         // refresh UI on main thread
         if (m_main) {
@@ -102,9 +136,7 @@ void AppWindow::startCleanup()
 
 void AppWindow::cleanupFinished()
 {
-    // reload thumbnails and counts, re-enable cleanup button
-    thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
-    if (sourcesPanel_) sourcesPanel_->updateCounts(m_cache.cacheDirPath());
+    // removed files reach the views through the cache watcher; re-enable cleanup button
     if (btnCleanup_) btnCleanup_->setEnabled(true);
 }
 
@@ -142,11 +174,9 @@ AppWindow::AppWindow(QWidget *parent)
     leftLayout->addWidget(sourcesPanel_);
     connect(sourcesPanel_, &SourcesPanel::enabledSourcesChanged, this, [this](const QStringList &enabled){
         if (!thumbnailViewer_) return;
-        // update allowed subreddits and reload thumbnails so the filter takes effect immediately
+        // update allowed subreddits and refilter thumbnails so the filter takes effect immediately
         thumbnailViewer_->setAllowedSubreddits(enabled);
-        thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
-        // update counts displayed in the sources panel
-        if (sourcesPanel_) sourcesPanel_->updateCounts(m_cache.cacheDirPath());
+        thumbnailViewer_->refresh();
     });
 
     // persist any changes to the sources list
@@ -158,6 +188,23 @@ AppWindow::AppWindow(QWidget *parent)
 
     // handle per-subreddit update requests from the sources panel context menu
     connect(sourcesPanel_, &SourcesPanel::updateRequested, this, &AppWindow::onUpdateSubredditRequested);
+    connect(sourcesPanel_, &SourcesPanel::backfillRequested, this, &AppWindow::onBackfillRequested);
+    // scan controls on the per-subreddit progress bars
+    connect(sourcesPanel_, &SourcesPanel::pauseUpdatesRequested, this, [this](bool paused) {
+        if (activeWorker_) QMetaObject::invokeMethod(activeWorker_, "setPaused", Qt::QueuedConnection, Q_ARG(bool, paused));
+    });
+    connect(sourcesPanel_, &SourcesPanel::cancelUpdateRequested, this, [this](const QString &subreddit) {
+        if (activeWorker_) QMetaObject::invokeMethod(activeWorker_, "cancelSubreddit", Qt::QueuedConnection, Q_ARG(QString, subreddit));
+    });
+
+    // background polling; the schedule is stored with the sources
+    scanScheduler_ = new ScanScheduler(sourcesPanel_, this);
+    connect(scanScheduler_, &ScanScheduler::scanDue, this, &AppWindow::onScheduledScan);
+    connect(scanScheduler_, &ScanScheduler::scheduleChanged, this, [this, sourcesPath]() {
+        if (!sourcesPanel_->saveToFile(sourcesPath)) {
+            qWarning() << "Failed to save sources file:" << sourcesPath;
+        }
+    });
 
     // small helper to render an emoji into a tray icon (fallback)
     auto createEmojiIcon = [](const QString &emoji)->QIcon{
@@ -199,6 +246,35 @@ AppWindow::AppWindow(QWidget *parent)
     filtersPanel_->setMode(static_cast<ThumbnailViewer::AspectFilterMode>(savedMode));
     bool savedFavOnly = cfg.value("favorites_only").toBool(false);
     filtersPanel_->setFavoritesOnly(savedFavOnly);
+    // metadata backend answering filters/random picks: in-memory bitmaps by
+    // default, or SQLite with "metadata_backend": "sqlite"
+    if (cfg.value("metadata_backend").toString() == "sqlite") {
+        QString dbPath = QDir(m_cache.cacheDirPath()).filePath("index.sqlite");
+        m_cache.indexStore()->setBackend(std::make_unique<SqliteBackend>(dbPath));
+    } else {
+        m_cache.indexStore()->setBackend(std::make_unique<BitmapIndex>());
+    }
+    // scan download limits ("download_concurrency" total, "download_per_host")
+    downloadConcurrency_ = cfg.value("download_concurrency").toInt(UpdateWorker::kDefaultConcurrency);
+    downloadPerHost_ = cfg.value("download_per_host").toInt(UpdateWorker::kDefaultPerHost);
+    // "skip_nsfw": don't download posts marked over_18
+    skipNsfw_ = cfg.value("skip_nsfw").toBool(false);
+    // "batch_listings": combined multireddit listing requests (default on)
+    batchListings_ = cfg.value("batch_listings").toBool(true);
+    // "auto_scan": poll enabled sources in the background (default on)
+    scanScheduler_->setEnabled(cfg.value("auto_scan").toBool(true));
+    // listing host: WALLAROO_REDDIT_BASE, else "reddit_base_url" (e.g. a local
+    // fixture server replaying recorded listings)
+    QString baseUrl = QString::fromLocal8Bit(qgetenv("WALLAROO_REDDIT_BASE"));
+    if (baseUrl.isEmpty()) baseUrl = cfg.value("reddit_base_url").toString();
+    if (!baseUrl.isEmpty()) {
+        RedditFetcher::setBaseUrl(QUrl(baseUrl));
+        qDebug() << "Fetching listings from" << RedditFetcher::baseUrl();
+    }
+    // download guards: "max_download_bytes", "max_image_pixels" (0 = no limit)
+    CacheManager::setDownloadLimits(
+        qint64(cfg.value("max_download_bytes").toDouble(double(CacheManager::kDefaultMaxBytes))),
+        qint64(cfg.value("max_image_pixels").toDouble(double(CacheManager::kDefaultMaxPixels))));
 
     qDebug() << "AppWindow ctor: before ThumbnailViewer";
     // thumbnail viewer
@@ -209,6 +285,14 @@ AppWindow::AppWindow(QWidget *parent)
     thumbnailViewer_->setAllowedSubreddits(sourcesPanel_->enabledSources());
     rightLayout->addWidget(thumbnailViewer_, 1);
     qDebug() << "AppWindow ctor: added ThumbnailViewer to right panel";
+    // apply downloads, deletions and metadata edits to the views in place
+    cacheWatcher_ = new CacheWatcher(m_cache.cacheDirPath(), this);
+    connect(cacheWatcher_, &CacheWatcher::changed, this, [this](const CacheDelta &delta){
+        if (!m_initialLoadDone) return;
+        thumbnailViewer_->applyDelta(delta);
+        if (filtersPanel_) filtersPanel_->setAvailableResolutions(thumbnailViewer_->availableResolutions());
+        if (sourcesPanel_) sourcesPanel_->updateCounts(m_cache.cacheDirPath());
+    });
     // compute primary screen aspect ratio and set it on the thumbnail viewer
     QScreen *screen = QGuiApplication::primaryScreen();
     QSize scrSize = screen ? screen->size() : QSize(1920,1080);
@@ -219,48 +303,19 @@ AppWindow::AppWindow(QWidget *parent)
     // listen for mode changes and persist the selection
     connect(filtersPanel_, &FiltersPanel::modeChanged, this, [this, configPath](ThumbnailViewer::AspectFilterMode mode){
         thumbnailViewer_->setAspectFilterMode(mode);
-        // persist selection atomically
-        QJsonObject newCfg;
-        QFile rcf(configPath);
-        if (rcf.open(QIODevice::ReadOnly)) {
-            QJsonDocument doc = QJsonDocument::fromJson(rcf.readAll());
-            if (doc.isObject()) newCfg = doc.object();
-            rcf.close();
-        }
-        newCfg["filter_mode"] = (int)mode;
-        QSaveFile sf(configPath);
-        if (sf.open(QIODevice::WriteOnly)) {
-            sf.write(QJsonDocument(newCfg).toJson(QJsonDocument::Indented));
-            sf.commit();
-        } else {
-            qWarning() << "Failed to write config file:" << configPath;
-        }
-        // reload thumbnails from cache so the filter takes effect immediately
-        thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
-        if (filtersPanel_) filtersPanel_->setAvailableResolutions(thumbnailViewer_->availableResolutions());
-        if (sourcesPanel_) sourcesPanel_->updateCounts(m_cache.cacheDirPath());
+        saveConfigValues(configPath, {{ "filter_mode", (int)mode }});
+        // refilter thumbnails so the filter takes effect immediately
+        thumbnailViewer_->refresh();
     });
     connect(filtersPanel_, &FiltersPanel::favoritesOnlyChanged, this, [this, configPath](bool favOnly){
         thumbnailViewer_->setFavoritesOnly(favOnly);
-        // persist selection atomically
-        QJsonObject newCfg;
-        QFile rcf(configPath);
-        if (rcf.open(QIODevice::ReadOnly)) {
-            QJsonDocument doc = QJsonDocument::fromJson(rcf.readAll());
-            if (doc.isObject()) newCfg = doc.object();
-            rcf.close();
-        }
-        newCfg["favorites_only"] = favOnly;
-        QSaveFile sf(configPath);
-        if (sf.open(QIODevice::WriteOnly)) {
-            sf.write(QJsonDocument(newCfg).toJson(QJsonDocument::Indented));
-            sf.commit();
-        } else {
-            qWarning() << "Failed to write config file:" << configPath;
-        }
-        thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
-        if (filtersPanel_) filtersPanel_->setAvailableResolutions(thumbnailViewer_->availableResolutions());
-        if (sourcesPanel_) sourcesPanel_->updateCounts(m_cache.cacheDirPath());
+        saveConfigValues(configPath, {{ "favorites_only", favOnly }});
+        thumbnailViewer_->refresh();
+    });
+    // thumbnail zoom ("thumb_size", logical pixels)
+    thumbnailViewer_->setThumbSize(cfg.value("thumb_size").toInt(thumbnailViewer_->thumbSize()));
+    connect(thumbnailViewer_, &ThumbnailViewer::thumbSizeChanged, this, [configPath](int size){
+        saveConfigValues(configPath, {{ "thumb_size", size }});
     });
     
     // Manual scan and cleanup controls (restore deleted control):
@@ -270,9 +325,14 @@ AppWindow::AppWindow(QWidget *parent)
     btnCleanup_->setToolTip("Remove images leftover from deleted subreddits");
     // place buttons on one row (will be added to right panel)
     QHBoxLayout *updateRow = new QHBoxLayout();
+    // pause/resume for the running scan, shown only while one runs
+    btnPause_ = new QPushButton("Pause", this);
+    btnPause_->setVisible(false);
     updateRow->addWidget(btnUpdate_);
+    updateRow->addWidget(btnPause_);
     updateRow->addWidget(btnCleanup_);
     connect(btnUpdate_, &QPushButton::clicked, this, &AppWindow::onUpdateCache);
+    connect(btnPause_, &QPushButton::clicked, this, &AppWindow::onPauseScan);
     connect(btnCleanup_, &QPushButton::clicked, this, &AppWindow::startCleanup);
     // add the update/cleanup row into the left sidebar so controls are together
     // first create the auto-random control: "Select a new random wallpaper every [spin] [unit]"
@@ -311,22 +371,7 @@ AppWindow::AppWindow(QWidget *parent)
 
     // helper to create/remove autostart desktop file
     auto applyAutoStart = [this, configPath](bool enabled) {
-        // persist selection atomically
-        QJsonObject newCfg;
-        QFile rcf(configPath);
-        if (rcf.open(QIODevice::ReadOnly)) {
-            QJsonDocument doc = QJsonDocument::fromJson(rcf.readAll());
-            if (doc.isObject()) newCfg = doc.object();
-            rcf.close();
-        }
-        newCfg["auto_start"] = enabled;
-        QSaveFile sf(configPath);
-        if (sf.open(QIODevice::WriteOnly)) {
-            sf.write(QJsonDocument(newCfg).toJson(QJsonDocument::Indented));
-            sf.commit();
-        } else {
-            qWarning() << "Failed to write config file:" << configPath;
-        }
+        saveConfigValues(configPath, {{ "auto_start", enabled }});
 
         // create or remove autostart desktop entry
         QString autostartDir = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/autostart";
@@ -391,23 +436,8 @@ AppWindow::AppWindow(QWidget *parent)
                 autoTimer_->start(imsec);
             }
         }
-        // persist selection atomically
-        QJsonObject newCfg;
-        QFile rcf(configPath);
-        if (rcf.open(QIODevice::ReadOnly)) {
-            QJsonDocument doc = QJsonDocument::fromJson(rcf.readAll());
-            if (doc.isObject()) newCfg = doc.object();
-            rcf.close();
-        }
-        newCfg["auto_interval"] = autoIntervalSpin_->value();
-        newCfg["auto_unit"] = autoIntervalUnit_->currentText();
-        QSaveFile sf(configPath);
-        if (sf.open(QIODevice::WriteOnly)) {
-            sf.write(QJsonDocument(newCfg).toJson(QJsonDocument::Indented));
-            sf.commit();
-        } else {
-            qWarning() << "Failed to write config file:" << configPath;
-        }
+        saveConfigValues(configPath, {{ "auto_interval", autoIntervalSpin_->value() },
+                                      { "auto_unit", autoIntervalUnit_->currentText() }});
     };
     connect(autoIntervalSpin_, QOverload<int>::of(&QSpinBox::valueChanged), this, applyAutoSettings);
     connect(autoIntervalUnit_, QOverload<int>::of(&QComboBox::currentIndexChanged), this, applyAutoSettings);
@@ -528,6 +558,15 @@ AppWindow::AppWindow(QWidget *parent)
 }
 
 AppWindow::~AppWindow() {
+    // stop a running scan first: in-flight transfers are aborted (part files
+    // kept), so the thread can quit right away
+    // (after aboutToQuit the thread is gone and a blocking call would never return)
+    if (activeWorker_ && scanThread_ && scanThread_->isRunning())
+        QMetaObject::invokeMethod(activeWorker_, &UpdateWorker::cancel, Qt::BlockingQueuedConnection);
+    if (scanThread_) {
+        scanThread_->quit();
+        scanThread_->wait();
+    }
 }
 
 void AppWindow::showEvent(QShowEvent *event)
@@ -539,8 +578,6 @@ void AppWindow::showEvent(QShowEvent *event)
         QTimer::singleShot(0, this, [this]() {
             thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
             if (filtersPanel_) filtersPanel_->setAvailableResolutions(thumbnailViewer_->availableResolutions());
-            if (filtersPanel_) filtersPanel_->setAvailableResolutions(thumbnailViewer_->availableResolutions());
-            if (filtersPanel_) filtersPanel_->setAvailableResolutions(thumbnailViewer_->availableResolutions());
             if (sourcesPanel_) sourcesPanel_->updateCounts(m_cache.cacheDirPath());
             // schedule a follow-up relayout after layouts settle to avoid a 1-column flash
             QTimer::singleShot(80, thumbnailViewer_, [this]() {
@@ -585,9 +622,8 @@ void AppWindow::onNewRandom() {
         return;
     }
 
-    // Load index.json metadata
-    QString indexPath = cacheDir + "/index.json";
-    QJsonObject index = readIndex(indexPath);
+    // in-memory index metadata
+    const auto table = m_cache.indexStore()->table();
 
     // Gather candidate images by scanning all files and accepting common
     // image extensions — allow filenames that include query-strings (e.g.
@@ -601,10 +637,22 @@ void AppWindow::onNewRandom() {
     double primaryAspect = double(scrSize.width()) / double(scrSize.height());
     thumbnailViewer_->setTargetAspectRatio(primaryAspect);
 
+    QElapsedTimer timer; timer.start();
+
+    // with a metadata backend the whole filter + pick is one indexed query
+    IndexStore *store = m_cache.indexStore();
+    if (store->hasBackend()) {
+        QString key = store->randomKey(thumbnailViewer_->currentFilter());
+        if (!key.isEmpty() && QFile::exists(dir.filePath(key))) {
+            qCDebug(lcPerf) << "onNewRandom: backend pick" << key << "ms=" << timer.elapsed();
+            applyRandomWallpaper(dir.filePath(key));
+            return;
+        }
+    }
+
     struct Candidate { QString path; };
     QVector<Candidate> candidates;
 
-    QElapsedTimer timer; timer.start();
     int scanned = 0;
     int considered = 0;
 
@@ -614,10 +662,8 @@ void AppWindow::onNewRandom() {
         if (!extRegex.match(fi.fileName()).hasMatch()) continue;
         QString path = fi.absoluteFilePath();
         scanned++;
-        QString key = fi.fileName();
-        QJsonObject entry = index.value(key).toObject();
-        bool banned = entry.value("banned").toBool(false);
-        if (banned) continue;
+        const int row = table->find(fi.fileName());
+        if (row >= 0 && table->banned(row)) continue;
 
         // apply current filters via thumbnail viewer (centralized)
         if (!thumbnailViewer_->acceptsImage(path)) continue;
@@ -636,8 +682,13 @@ void AppWindow::onNewRandom() {
     int idx = QRandomGenerator::global()->bounded(candidates.size());
     QString chosen = candidates[idx].path;
 
-    qDebug() << "Chosen wallpaper from cache:" << chosen;
     qDebug() << "onNewRandom: scanned=" << scanned << "considered=" << considered << "candidates=" << candidates.size() << "ms=" << timer.elapsed();
+    applyRandomWallpaper(chosen);
+}
+
+void AppWindow::applyRandomWallpaper(const QString &chosen)
+{
+    qDebug() << "Chosen wallpaper from cache:" << chosen;
     if (wallpaperSetter_.setWallpaper(chosen)) {
         qDebug() << "Wallpaper set successfully from cache";
         // update UI/details for the chosen image
@@ -661,47 +712,23 @@ void AppWindow::onRandomFavorite() {
         qWarning() << "Cache directory does not exist:" << cacheDir;
         return;
     }
-    QString indexPath = cacheDir + "/index.json";
-    QJsonObject index = readIndex(indexPath);
-
-    struct Candidate { QString path; };
-    QVector<Candidate> candidates;
-
-    QFileInfoList filesFav = dir.entryInfoList(QDir::Files | QDir::NoSymLinks);
-    QRegularExpression extRegexFav(R"(\.(?:png|jpe?g|bmp|webp|gif)(?:$|\?))", QRegularExpression::CaseInsensitiveOption);
-
-    for (const QFileInfo &fi : filesFav) {
-        if (!extRegexFav.match(fi.fileName()).hasMatch()) continue;
-        QString path = fi.absoluteFilePath();
-        QString key = fi.fileName();
-        QJsonObject entry = index.value(key).toObject();
-        bool banned = entry.value("banned").toBool(false);
-        bool fav = entry.value("favorite").toBool(false);
-        if (banned || !fav) continue;
-        // respect filters
-        if (!thumbnailViewer_->acceptsImage(path)) continue;
-        candidates.append({ path });
+    IndexStore *store = m_cache.indexStore();
+    ImageFilter filter = thumbnailViewer_->currentFilter();
+    filter.favoritesOnly = true;
+    QString key = store->randomKey(filter);
+    if (!key.isEmpty() && !QFile::exists(dir.filePath(key))) {
+        // the pick's file is gone: choose among the favorites still on disk
+        QStringList keys = store->query(filter);
+        keys.erase(std::remove_if(keys.begin(), keys.end(), [&dir](const QString &k) { return !QFile::exists(dir.filePath(k)); }),
+                   keys.end());
+        key = keys.isEmpty() ? QString() : keys.at(QRandomGenerator::global()->bounded(keys.size()));
     }
-
-    if (candidates.empty()) {
+    if (key.isEmpty()) {
         qWarning() << "No favorited wallpapers found (after filters). Falling back to random.";
-        // fall back to plain random wallpaper
         onNewRandom();
         return;
     }
-
-    int idx = QRandomGenerator::global()->bounded(candidates.size());
-    QString chosen = candidates[idx].path;
-    qDebug() << "Chosen favorite wallpaper:" << chosen;
-    if (wallpaperSetter_.setWallpaper(chosen)) {
-        qDebug() << "Wallpaper set successfully from favorite";
-        onThumbnailSelected(chosen);
-        currentWallpaperPath_ = chosen;
-        if (trayActFavorite_) trayActFavorite_->setEnabled(true);
-        if (trayActPermaban_) trayActPermaban_->setEnabled(true);
-    } else {
-        qWarning() << "Failed to set favorite wallpaper:" << chosen;
-    }
+    applyRandomWallpaper(dir.filePath(key));
 }
 
 void AppWindow::onThumbnailSelected(const QString &imagePath) {
@@ -717,35 +744,28 @@ void AppWindow::onThumbnailSelected(const QString &imagePath) {
     detailPath_->setText(QString("Path: %1").arg(elided));
     detailPath_->setToolTip(imagePath);
 
-    // resolution
-    QImage img(imagePath);
-    if (!img.isNull()) {
-        detailResolution_->setText(QString("Resolution: %1x%2").arg(img.width()).arg(img.height()));
+    // read from the published snapshot (no lock, no JSON)
+    const auto table = m_cache.indexStore()->table();
+    const int row = table->find(QFileInfo(imagePath).fileName());
+
+    // resolution: indexed size, else the image header (no full decode)
+    QSize imgSize = row >= 0 ? table->imageSize(row) : QSize();
+    if (imgSize.isEmpty()) imgSize = QImageReader(imagePath).size();
+    if (!imgSize.isEmpty()) {
+        detailResolution_->setText(QString("Resolution: %1x%2").arg(imgSize.width()).arg(imgSize.height()));
     } else {
         detailResolution_->setText("Resolution: unknown");
     }
-
-    // Load metadata index.json if present
-    QString indexPath = m_cache.cacheDirPath() + "/index.json";
-    QJsonObject rootObj;
-    QFile f(indexPath);
-    if (f.open(QIODevice::ReadOnly)) {
-        QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
-        if (doc.isObject()) rootObj = doc.object();
-        f.close();
-    }
-
-    QString key = QFileInfo(imagePath).fileName();
-    QJsonObject entry = rootObj.value(key).toObject();
-    QString subreddit = entry.value("subreddit").toString("unknown");
-    bool banned = entry.value("banned").toBool(false);
+    QString subreddit = row >= 0 ? table->subreddit(row) : QString();
+    if (subreddit.isEmpty()) subreddit = "unknown";
+    bool banned = row >= 0 && table->banned(row);
 
     detailSubreddit_->setText(QString("Subreddit: %1").arg(subreddit));
     
     // Optionally set wallpaper on click? We'll not auto-set; keep manual behavior.
 
     // Favorite state for this thumbnail (displayed via filters; no inline button)
-    bool fav = entry.value("favorite").toBool(false);
+    bool fav = row >= 0 && table->favorite(row);
     Q_UNUSED(fav);
 
     // Enable/disable tray favorite/permaban based on whether we have a current wallpaper
@@ -754,24 +774,6 @@ void AppWindow::onThumbnailSelected(const QString &imagePath) {
     if (trayActPermaban_) trayActPermaban_->setEnabled(hasCurrent);
 }
 
-static QJsonObject readIndex(const QString &indexPath) {
-    QJsonObject rootObj;
-    QFile f(indexPath);
-    if (f.open(QIODevice::ReadOnly)) {
-        QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
-        if (doc.isObject()) rootObj = doc.object();
-        f.close();
-    }
-    return rootObj;
-}
-
-static bool writeIndex(const QString &indexPath, const QJsonObject &rootObj) {
-    QSaveFile sf(indexPath);
-    if (!sf.open(QIODevice::WriteOnly)) return false;
-    sf.write(QJsonDocument(rootObj).toJson(QJsonDocument::Indented));
-    return sf.commit();
-}
-
 // removed old thumb-up/thumb-down handlers; favorites replace scoring
 
 void AppWindow::onToggleFavorite() {
@@ -779,59 +781,28 @@ void AppWindow::onToggleFavorite() {
     QString targetPath = currentSelectedPath_.isEmpty() ? currentWallpaperPath_ : currentSelectedPath_;
     if (targetPath.isEmpty()) return;
     QString key = QFileInfo(targetPath).fileName();
-    QString indexPath = m_cache.cacheDirPath() + "/index.json";
-    QJsonObject root = readIndex(indexPath);
-    QJsonObject entry = root.value(key).toObject();
-    bool fav = entry.value("favorite").toBool(false);
-    fav = !fav;
-    entry["favorite"] = fav;
-    root[key] = entry;
-    if (writeIndex(indexPath, root)) {
-        // refresh thumbnails to reflect favorite state
-        if (thumbnailViewer_) thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
-        qDebug() << "Set favorite=" << fav << "for" << key;
-    } else {
-        qWarning() << "Failed to write index.json";
-    }
+    bool fav = m_cache.indexStore()->toggleFavorite(key);
+    // the cache watcher refilters the thumbnail for the new favorite state
+    qDebug() << "Set favorite=" << fav << "for" << key;
 }
 
 void AppWindow::onThumbnailFavoriteRequested(const QString &imagePath)
 {
     if (imagePath.isEmpty()) return;
     QString key = QFileInfo(imagePath).fileName();
-    QString indexPath = m_cache.cacheDirPath() + "/index.json";
-    QJsonObject root = readIndex(indexPath);
-    QJsonObject entry = root.value(key).toObject();
-    bool fav = entry.value("favorite").toBool(false);
-    fav = !fav;
-    entry["favorite"] = fav;
-    root[key] = entry;
-    if (writeIndex(indexPath, root)) {
-        qDebug() << "Context-favorite set=" << fav << "for" << key;
-        if (thumbnailViewer_) thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
-    } else {
-        qWarning() << "Failed to write index.json";
-    }
+    bool fav = m_cache.indexStore()->toggleFavorite(key);
+    qDebug() << "Context-favorite set=" << fav << "for" << key;
 }
 
 void AppWindow::onThumbnailPermabanRequested(const QString &imagePath)
 {
     if (imagePath.isEmpty()) return;
     QString key = QFileInfo(imagePath).fileName();
-    QString indexPath = m_cache.cacheDirPath() + "/index.json";
-    QJsonObject root = readIndex(indexPath);
-    QJsonObject entry = root.value(key).toObject();
-    entry["banned"] = true;
-    root[key] = entry;
-    if (writeIndex(indexPath, root)) {
-        qDebug() << "Context-permaban set for" << key;
-        if (thumbnailViewer_) thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
-        // After permabanning, pick a new favorite wallpaper if the permabanned one is current
-        if (!currentWallpaperPath_.isEmpty() && QFileInfo(currentWallpaperPath_).fileName() == key) {
-            QTimer::singleShot(0, this, [this]() { this->onRandomFavorite(); });
-        }
-    } else {
-        qWarning() << "Failed to write index.json";
+    m_cache.indexStore()->setBanned(key, true);
+    qDebug() << "Context-permaban set for" << key;
+    // After permabanning, pick a new favorite wallpaper if the permabanned one is current
+    if (!currentWallpaperPath_.isEmpty() && QFileInfo(currentWallpaperPath_).fileName() == key) {
+        QTimer::singleShot(0, this, [this]() { this->onRandomFavorite(); });
     }
 }
 
@@ -839,165 +810,146 @@ void AppWindow::onPermaban() {
     // operate on the currently-set wallpaper
     if (currentWallpaperPath_.isEmpty()) return;
     QString key = QFileInfo(currentWallpaperPath_).fileName();
-    QString indexPath = m_cache.cacheDirPath() + "/index.json";
-    QJsonObject root = readIndex(indexPath);
-    QJsonObject entry = root.value(key).toObject();
-    entry["banned"] = true;
-    root[key] = entry;
-    if (writeIndex(indexPath, root)) {
-        qDebug() << "Set perma-ban for" << key;
-        // After permabanning the current wallpaper, immediately load a random favorited wallpaper
-        QTimer::singleShot(0, this, [this]() { this->onRandomFavorite(); });
-    } else {
-        qWarning() << "Failed to write index.json";
-    }
+    m_cache.indexStore()->setBanned(key, true);
+    qDebug() << "Set perma-ban for" << key;
+    // After permabanning the current wallpaper, immediately load a random favorited wallpaper
+    QTimer::singleShot(0, this, [this]() { this->onRandomFavorite(); });
 }
 
 void AppWindow::onUpdateCache() {
-    // Start a background UpdateWorker that fetches recent posts and downloads images.
-    if (!btnUpdate_) return;
-    btnUpdate_->setEnabled(false);
-    btnUpdate_->setText("Updating...");
+    // The Scan button doubles as Cancel while a scan is running
+    if (activeWorker_) {
+        if (btnUpdate_) { btnUpdate_->setEnabled(false); btnUpdate_->setText("Cancelling..."); }
+        QMetaObject::invokeMethod(activeWorker_, &UpdateWorker::cancel, Qt::QueuedConnection);
+        return;
+    }
 
     // determine enabled subreddits
     QStringList subs;
     if (sourcesPanel_) subs = sourcesPanel_->enabledSources();
     if (subs.isEmpty()) subs = subscribedSubreddits_; // fallback
 
-    // create worker + thread
-    UpdateWorker *worker = new UpdateWorker(&m_fetcher, &m_cache, subs);
-    QThread *t = new QThread(this);
-    worker->moveToThread(t);
+    UpdateWorker *worker = new UpdateWorker(&m_cache, subs);
+    launchWorker(worker, "Cancel Scan");
+}
+
+void AppWindow::onUpdateSubredditRequested(const QString &subreddit, int perSubLimit)
+{
+    // "scan last N posts" means exactly those, wherever the cursor is
+    startSubredditScan(subreddit, perSubLimit, UpdateWorker::Newest);
+}
+
+void AppWindow::onBackfillRequested(const QString &subreddit)
+{
+    // full pages older than anything scanned so far
+    startSubredditScan(subreddit, RedditFetcher::kMaxPageSize, UpdateWorker::Backfill);
+}
+
+void AppWindow::startSubredditScan(const QString &subreddit, int perSubLimit, UpdateWorker::ListingMode mode)
+{
+    if (subreddit.isEmpty()) return;
+    if (activeWorker_) {
+        // one scan at a time; overlapping scans would compete for the same hosts and index
+        qDebug() << "Scan already running; ignoring request for" << subreddit;
+        return;
+    }
+    UpdateWorker *worker = new UpdateWorker(&m_cache, QStringList() << subreddit, perSubLimit);
+    worker->setListingMode(mode);
+    launchWorker(worker, QString("Cancel Scan of %1").arg(subreddit));
+}
+
+void AppWindow::onScheduledScan(const QStringList &subreddits)
+{
+    if (activeWorker_ || subreddits.isEmpty()) return;
+    // incremental: just what arrived since each subreddit's cursor
+    UpdateWorker *worker = new UpdateWorker(&m_cache, subreddits);
+    launchWorker(worker, "Cancel Scan");
+}
+
+void AppWindow::launchWorker(UpdateWorker *worker, const QString &cancelText)
+{
+    worker->setConcurrency(downloadConcurrency_, downloadPerHost_);
+    if (thumbnailViewer_) worker->setPrefilter(thumbnailViewer_->downloadFilter(), skipNsfw_);
+    worker->setBatchListings(batchListings_);
+    worker->moveToThread(scanThread());
+    activeWorker_ = worker;
+    if (scanScheduler_) scanScheduler_->setBusy(true);
+    if (btnUpdate_) { btnUpdate_->setEnabled(true); btnUpdate_->setText(cancelText); }
+    scanPaused_ = false;
+    if (btnPause_) { btnPause_->setText("Pause"); btnPause_->setVisible(true); }
 
     // propagate imageCached -> update url_map.json and index.json
     connect(worker, &UpdateWorker::imageCached, this, [this](const QString &localPath, const QString &subreddit, const QString &sourceUrl){
-        // update url_map.json in config dir
-    QString configDir = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/wallaroo";
-        QDir().mkpath(configDir);
-        QString urlMapPath = configDir + "/url_map.json";
-        QJsonObject urlmap;
-        QFile f(urlMapPath);
-        if (f.open(QIODevice::ReadOnly)) {
-            QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
-            if (doc.isObject()) urlmap = doc.object();
-            f.close();
-        }
-        QUrl u(sourceUrl);
-        u.setQuery(QString());
-        u.setFragment(QString());
-        QString norm = u.toString();
-        QJsonArray arr = urlmap.value(norm).toArray();
-        bool found = false;
-        for (const QJsonValue &v : arr) if (v.toString() == subreddit) { found = true; break; }
-        if (!found) arr.append(subreddit);
-        urlmap.insert(norm, arr);
-        QSaveFile sf(urlMapPath);
-        if (sf.open(QIODevice::WriteOnly)) {
-            sf.write(QJsonDocument(urlmap).toJson(QJsonDocument::Indented));
-            sf.commit();
-        }
-
-        // update index.json to set subreddit if missing
-        QString indexPath = m_cache.cacheDirPath() + "/index.json";
-        QJsonObject root = readIndex(indexPath);
-        QString key = QFileInfo(localPath).fileName();
-        QJsonObject entry = root.value(key).toObject();
-        if (entry.value("subreddit").toString().isEmpty()) {
-            entry["subreddit"] = subreddit;
-            root[key] = entry;
-            writeIndex(indexPath, root);
-        }
+        UrlIndex::instance()->addSubreddit(sourceUrl, subreddit);
+        // record the subreddit in the index if missing
+        m_cache.indexStore()->setSubredditIfMissing(QFileInfo(localPath).fileName(), subreddit);
     });
 
     // update per-subreddit progress UI
     if (sourcesPanel_) {
         connect(worker, &UpdateWorker::started, sourcesPanel_, &SourcesPanel::startUpdateProgress);
+        connect(worker, &UpdateWorker::progress, sourcesPanel_, [this](const QString &sub, int completed, int total) {
+            sourcesPanel_->setUpdateProgress(sub, total > 0 ? completed * 100 / total : -1);
+        });
         connect(worker, &UpdateWorker::finishedSubreddit, sourcesPanel_, &SourcesPanel::finishUpdateProgress);
+        connect(worker, &UpdateWorker::pausedChanged, sourcesPanel_, &SourcesPanel::setUpdatesPaused);
+    }
+    // every incremental scan, scheduled or not, refines the arrival rates
+    if (scanScheduler_) {
+        connect(worker, &UpdateWorker::scanned, scanScheduler_, &ScanScheduler::recordScan);
+        connect(worker, &UpdateWorker::finishedSubreddit, scanScheduler_, &ScanScheduler::scanFinished);
     }
+    connect(worker, &UpdateWorker::pausedChanged, this, [this](bool paused) {
+        scanPaused_ = paused;
+        if (btnPause_) btnPause_->setText(paused ? "Resume" : "Pause");
+    });
 
     connect(worker, &UpdateWorker::error, this, [this](const QString &msg){
         qWarning() << "UpdateWorker error:" << msg;
     });
 
-    connect(worker, &UpdateWorker::finished, this, [this, t, worker](){
+    connect(worker, &UpdateWorker::finished, this, [this, worker](){
+        activeWorker_ = nullptr;
+        if (scanScheduler_) scanScheduler_->setBusy(false);
         if (btnUpdate_) {
             btnUpdate_->setEnabled(true);
             btnUpdate_->setText("Scan Now");
         }
-        // refresh thumbnails and counts
-        if (thumbnailViewer_) thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
-        if (filtersPanel_) filtersPanel_->setAvailableResolutions(thumbnailViewer_->availableResolutions());
-        if (sourcesPanel_) sourcesPanel_->updateCounts(m_cache.cacheDirPath());
-        // cleanup
-        t->quit();
+        if (btnPause_) btnPause_->setVisible(false);
+        if (sourcesPanel_) sourcesPanel_->setUpdatesPaused(false);
+        // new thumbnails and counts arrive incrementally through the cache watcher
+        UrlIndex::instance()->save();
+        // cleanup (the scan thread stays up for the next run)
         worker->deleteLater();
-        t->deleteLater();
     });
 
-    connect(t, &QThread::started, worker, &UpdateWorker::start);
-    // ensure thread stops if app exits
-    connect(qApp, &QCoreApplication::aboutToQuit, t, &QThread::quit);
-    t->start();
+    QMetaObject::invokeMethod(worker, &UpdateWorker::start, Qt::QueuedConnection);
 }
 
-void AppWindow::onUpdateSubredditRequested(const QString &subreddit, int perSubLimit)
+void AppWindow::onPauseScan()
 {
-    if (subreddit.isEmpty()) return;
-    if (!btnUpdate_) return;
-    btnUpdate_->setEnabled(false);
-    btnUpdate_->setText(QString("Scanning %1...").arg(subreddit));
-
-    QStringList subs; subs << subreddit;
-    UpdateWorker *worker = new UpdateWorker(&m_fetcher, &m_cache, subs, perSubLimit);
-    QThread *t = new QThread(this);
-    worker->moveToThread(t);
-
-    connect(worker, &UpdateWorker::imageCached, this, [this](const QString &localPath, const QString &sub, const QString &sourceUrl){
-        // same handling as in onUpdateCache
-    QString configDir = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/wallaroo";
-        QDir().mkpath(configDir);
-        QString urlMapPath = configDir + "/url_map.json";
-        QJsonObject urlmap;
-        QFile f(urlMapPath);
-        if (f.open(QIODevice::ReadOnly)) {
-            QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
-            if (doc.isObject()) urlmap = doc.object();
-            f.close();
-        }
-        QUrl u(sourceUrl);
-        u.setQuery(QString()); u.setFragment(QString());
-        QString norm = u.toString();
-        QJsonArray arr = urlmap.value(norm).toArray();
-        bool found = false; for (const QJsonValue &v : arr) if (v.toString() == sub) { found = true; break; }
-        if (!found) arr.append(sub);
-        urlmap.insert(norm, arr);
-        QSaveFile sf(urlMapPath);
-        if (sf.open(QIODevice::WriteOnly)) { sf.write(QJsonDocument(urlmap).toJson(QJsonDocument::Indented)); sf.commit(); }
-
-        QString indexPath = m_cache.cacheDirPath() + "/index.json";
-        QJsonObject root = readIndex(indexPath);
-        QString key = QFileInfo(localPath).fileName();
-        QJsonObject entry = root.value(key).toObject();
-        if (entry.value("subreddit").toString().isEmpty()) { entry["subreddit"] = sub; root[key] = entry; writeIndex(indexPath, root); }
-    });
+    if (!activeWorker_) return;
+    QMetaObject::invokeMethod(activeWorker_, "setPaused", Qt::QueuedConnection, Q_ARG(bool, !scanPaused_));
+}
 
-    // per-subreddit progress connections
-    if (sourcesPanel_) {
-        connect(worker, &UpdateWorker::started, sourcesPanel_, &SourcesPanel::startUpdateProgress);
-        connect(worker, &UpdateWorker::finishedSubreddit, sourcesPanel_, &SourcesPanel::finishUpdateProgress);
+QThread *AppWindow::scanThread()
+{
+    // one long-lived thread for scans so its network manager keeps its
+    // connection pool (keep-alive/HTTP/2) from one scan to the next
+    if (!scanThread_) {
+        scanThread_ = new QThread(this);
+        scanThread_->setObjectName("wallaroo-scan");
+        // ensure thread stops if app exits
+        connect(qApp, &QCoreApplication::aboutToQuit, scanThread_, [this]() {
+            // cancel while the thread's event loop can still run the call
+            if (activeWorker_) QMetaObject::invokeMethod(activeWorker_, &UpdateWorker::cancel, Qt::BlockingQueuedConnection);
+            activeWorker_ = nullptr;
+            scanThread_->quit();
+            scanThread_->wait();
+        });
+        scanThread_->start();
     }
-
-    connect(worker, &UpdateWorker::finished, this, [this, t, worker]() {
-        if (btnUpdate_) { btnUpdate_->setEnabled(true); btnUpdate_->setText("Scan Now"); }
-        if (thumbnailViewer_) thumbnailViewer_->loadFromCache(m_cache.cacheDirPath());
-        if (filtersPanel_) filtersPanel_->setAvailableResolutions(thumbnailViewer_->availableResolutions());
-        if (sourcesPanel_) sourcesPanel_->updateCounts(m_cache.cacheDirPath());
-        t->quit(); worker->deleteLater(); t->deleteLater();
-    });
-
-    connect(t, &QThread::started, worker, &UpdateWorker::start);
-    connect(qApp, &QCoreApplication::aboutToQuit, t, &QThread::quit);
-    t->start();
+    return scanThread_;
 }
 
 #include "appwindow.moc"
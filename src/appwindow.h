@@ -2,18 +2,22 @@
 
 #include <QWidget>
 #include <QSystemTrayIcon>
+#include <QPointer>
 #include "wallpapersetter.h"
-#include "redditfetcher.h"
 #include "cachemanager.h"
 #include "thumbnailviewer.h"
 #include "sourcespanel.h"
 #include "filterspanel.h"
+#include "updateworker.h"
 
 class QLabel;
 class QPushButton;
 class QCheckBox;
 class QAction;
 class QSpinBox;
+class CacheWatcher;
+class ScanScheduler;
+class QThread;
 
 
 class AppWindow : public QWidget {
@@ -33,24 +37,51 @@ private slots:
     void onThumbnailPermabanRequested(const QString &imagePath);
     void onUpdateCache();
     void onUpdateSubredditRequested(const QString &subreddit, int perSubLimit);
+    void onBackfillRequested(const QString &subreddit);
+    void onPauseScan();
+    void onScheduledScan(const QStringList &subreddits);
     void startCleanup();
     void cleanupFinished();
 
+private:
+    // Set a randomly chosen image as wallpaper and update the details/tray state
+    void applyRandomWallpaper(const QString &chosen);
+    // Scan one subreddit from the sources panel context menu
+    void startSubredditScan(const QString &subreddit, int perSubLimit, UpdateWorker::ListingMode mode);
+    // Configure, connect and start a worker as the active scan
+    void launchWorker(UpdateWorker *worker, const QString &cancelText);
+    // Thread running UpdateWorkers, started on first use
+    QThread *scanThread();
+
 private:
     QSystemTrayIcon *trayIcon_ = nullptr;
     QAction *trayActFavorite_ = nullptr;
     QAction *trayActRandomFavorite_ = nullptr;
     QAction *trayActPermaban_ = nullptr;
     WallpaperSetter wallpaperSetter_;
-    RedditFetcher m_fetcher;
     CacheManager m_cache;
     ThumbnailViewer *thumbnailViewer_ = nullptr;
+    // turns cache dir / index changes into in-place view updates
+    CacheWatcher *cacheWatcher_ = nullptr;
+    QThread *scanThread_ = nullptr;
+    // the one scan allowed to run at a time (lives on scanThread_)
+    QPointer<UpdateWorker> activeWorker_;
+    // background polling of the enabled sources ("auto_scan" in config.json)
+    ScanScheduler *scanScheduler_ = nullptr;
     QString currentSelectedPath_;
     QString currentWallpaperPath_;
     QStringList subscribedSubreddits_ = { "WidescreenWallpaper" };
     QPushButton *btnUpdate_ = nullptr;
     QPushButton *btnCleanup_ = nullptr;
+    QPushButton *btnPause_ = nullptr;
+    // the active scan's paused state, as last reported by the worker
+    bool scanPaused_ = false;
     QSpinBox *updateCountSpin_ = nullptr;
+    // UpdateWorker download limits (config.json)
+    int downloadConcurrency_ = 6;
+    int downloadPerHost_ = 2;
+    bool skipNsfw_ = false;
+    bool batchListings_ = true;
     // Auto-random wallpaper controls
     QSpinBox *autoIntervalSpin_ = nullptr;
     QComboBox *autoIntervalUnit_ = nullptr;
@@ -0,0 +1,396 @@
+#include "binaryindex.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QVector>
+#include <QDebug>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace {
+constexpr char kMagic[4] = { 'W', 'L', 'I', 'X' };
+// 3: the table's own columns and hash order, so the mapping is searchable
+constexpr quint32 kVersion = 3;
+
+enum SideKind : quint32 {
+    CustomThumbnail = 0,  // a: string offset
+    BigSize = 1,          // a: width, b: height
+    Extra = 2             // a: string offset of a compact JSON object
+};
+
+void padTo8(QByteArray &buf)
+{
+    while (buf.size() % 8) buf.append('\0');
+}
+
+// Append a column and return its offset; columns start 8-byte aligned
+template <typename T>
+quint64 appendSection(QByteArray &out, const T *data, qsizetype count)
+{
+    padTo8(out);
+    const quint64 offset = quint64(out.size());
+    if (count > 0) out.append(reinterpret_cast<const char*>(data), count * qsizetype(sizeof(T)));
+    return offset;
+}
+
+template <typename T>
+void copyColumn(QVector<T> &out, const uchar *data, quint32 count)
+{
+    out.resize(count);
+    if (count > 0) std::memcpy(out.data(), data, size_t(count) * sizeof(T));
+}
+}
+
+struct BinaryIndex::Header {
+    char magic[4];
+    quint32 version;
+    quint32 rowCount;
+    quint32 hashedRows;
+    quint32 unsortableRows;
+    quint32 extensionCount;
+    quint32 subredditCount;
+    quint32 sideCount;
+    qint64 sourceSize;
+    qint64 sourceMtimeMs;
+    quint64 extensionsOffset;
+    quint64 subredditsOffset;
+    quint64 hashesOffset;
+    quint64 extensionIdsOffset;
+    quint64 subredditIdsOffset;
+    quint64 packedSizesOffset;
+    quint64 flagsOffset;
+    quint64 downloadedAtOffset;
+    quint64 otherKeysOffset;
+    quint64 sidesOffset;
+    quint64 stringsOffset;
+    quint64 stringsSize;
+};
+
+struct BinaryIndex::Side {
+    quint32 row;
+    quint32 kind;
+    quint32 a;
+    quint32 b;
+};
+
+template <typename T>
+const T *BinaryIndex::section(quint64 offset) const
+{
+    return reinterpret_cast<const T*>(m_data + offset);
+}
+
+BinaryIndex::~BinaryIndex()
+{
+    close();
+}
+
+bool BinaryIndex::open(const QString &path)
+{
+    close();
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) return false;
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(Header))) {
+        close();
+        return false;
+    }
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        close();
+        return false;
+    }
+    const Header *h = header();
+    const quint64 size = quint64(m_size);
+    const quint64 rows = h->rowCount;
+    auto fits = [size](quint64 offset, quint64 bytes) { return offset % 8 == 0 && offset <= size && bytes <= size - offset; };
+    bool ok = std::memcmp(h->magic, kMagic, 4) == 0
+        && h->version == kVersion
+        && h->hashedRows <= h->rowCount
+        && fits(h->extensionsOffset, quint64(h->extensionCount) * 4)
+        && fits(h->subredditsOffset, quint64(h->subredditCount) * 4)
+        && fits(h->hashesOffset, quint64(h->hashedRows) * sizeof(MetadataTable::Hash))
+        && fits(h->extensionIdsOffset, h->hashedRows)
+        && fits(h->subredditIdsOffset, rows * 2)
+        && fits(h->packedSizesOffset, rows * 4)
+        && fits(h->flagsOffset, rows)
+        && fits(h->downloadedAtOffset, rows * 8)
+        && fits(h->otherKeysOffset, (rows - h->hashedRows) * 4)
+        && fits(h->sidesOffset, quint64(h->sideCount) * sizeof(Side))
+        && fits(h->stringsOffset, h->stringsSize);
+    if (ok) {
+        // IDs index the name tables they came with
+        const quint8 *ext = section<quint8>(h->extensionIdsOffset);
+        for (quint32 i = 0; ok && i < h->hashedRows; ++i) ok = ext[i] < h->extensionCount;
+        const quint16 *sub = section<quint16>(h->subredditIdsOffset);
+        for (quint32 i = 0; ok && i < h->rowCount; ++i) ok = sub[i] == MetadataTable::kNoSubreddit || sub[i] < h->subredditCount;
+    }
+    if (!ok) {
+        qWarning() << "BinaryIndex: ignoring invalid file" << path;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void BinaryIndex::close()
+{
+    if (m_data) m_file.unmap(const_cast<uchar*>(m_data));
+    m_data = nullptr;
+    m_size = 0;
+    if (m_file.isOpen()) m_file.close();
+}
+
+const BinaryIndex::Header *BinaryIndex::header() const
+{
+    return reinterpret_cast<const Header*>(m_data);
+}
+
+const BinaryIndex::Side *BinaryIndex::side(int row, quint32 kind) const
+{
+    const Header *h = header();
+    const Side *begin = section<Side>(h->sidesOffset);
+    const Side *end = begin + h->sideCount;
+    const Side *it = std::lower_bound(begin, end, std::make_pair(quint32(row), kind), [](const Side &s, const std::pair<quint32, quint32> &k) {
+        return s.row != k.first ? s.row < k.first : s.kind < k.second;
+    });
+    return it != end && it->row == quint32(row) && it->kind == kind ? it : nullptr;
+}
+
+QByteArray BinaryIndex::bytesAt(quint32 offset) const
+{
+    const Header *h = header();
+    if (quint64(offset) + 4 > h->stringsSize) return QByteArray();
+    const uchar *p = m_data + h->stringsOffset + offset;
+    quint32 len;
+    std::memcpy(&len, p, 4);
+    if (quint64(offset) + 4 + len > h->stringsSize) return QByteArray();
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(p + 4), qsizetype(len));
+}
+
+QString BinaryIndex::stringAt(quint32 offset) const
+{
+    return QString::fromUtf8(bytesAt(offset));
+}
+
+qint64 BinaryIndex::sourceSize() const
+{
+    return isOpen() ? header()->sourceSize : -1;
+}
+
+qint64 BinaryIndex::sourceMtimeMs() const
+{
+    return isOpen() ? header()->sourceMtimeMs : -1;
+}
+
+int BinaryIndex::count() const
+{
+    return isOpen() ? int(header()->rowCount) : 0;
+}
+
+int BinaryIndex::find(const QString &key) const
+{
+    if (!isOpen()) return -1;
+    const Header *h = header();
+    MetadataTable::Hash hash;
+    QString ext;
+    if (MetadataTable::splitHashedKey(key, hash, ext)) {
+        const QByteArray extUtf8 = ext.toUtf8();
+        const quint32 *extensions = section<quint32>(h->extensionsOffset);
+        for (quint32 extId = 0; extId < h->extensionCount; ++extId) {
+            if (bytesAt(extensions[extId]) != extUtf8) continue;
+            const MetadataTable::Hash *begin = section<MetadataTable::Hash>(h->hashesOffset);
+            const MetadataTable::Hash *end = begin + h->hashedRows;
+            const quint8 *extIds = section<quint8>(h->extensionIdsOffset);
+            for (auto it = std::lower_bound(begin, end, hash); it != end && *it == hash; ++it) {
+                if (extIds[it - begin] == extId) return int(it - begin);
+            }
+            break;
+        }
+    }
+    // keys of another form, and keys added since the table's last sort: few,
+    // so a linear pass
+    const QByteArray utf8 = key.toUtf8();
+    const quint32 *others = section<quint32>(h->otherKeysOffset);
+    for (quint32 i = 0; i < h->rowCount - h->hashedRows; ++i) {
+        if (bytesAt(others[i]) == utf8) return int(h->hashedRows + i);
+    }
+    return -1;
+}
+
+QString BinaryIndex::key(int row) const
+{
+    const Header *h = header();
+    if (quint32(row) < h->hashedRows) {
+        const quint8 extId = section<quint8>(h->extensionIdsOffset)[row];
+        return MetadataTable::hashHex(section<MetadataTable::Hash>(h->hashesOffset)[row]) + QLatin1Char('.')
+            + stringAt(section<quint32>(h->extensionsOffset)[extId]);
+    }
+    return stringAt(section<quint32>(h->otherKeysOffset)[row - int(h->hashedRows)]);
+}
+
+MetadataTable::Entry BinaryIndex::entry(int row) const
+{
+    const Header *h = header();
+    const quint8 flags = section<quint8>(h->flagsOffset)[row];
+    MetadataTable::Entry e;
+    const quint16 sub = section<quint16>(h->subredditIdsOffset)[row];
+    if (sub != MetadataTable::kNoSubreddit) e.subreddit = stringAt(section<quint32>(h->subredditsOffset)[sub]);
+    if (flags & MetadataTable::HasSize) {
+        if (flags & MetadataTable::SizeOverflow) {
+            if (const Side *s = side(row, BigSize)) e.size = QSize(int(s->a), int(s->b));
+        } else {
+            const quint32 packed = section<quint32>(h->packedSizesOffset)[row];
+            e.size = QSize(int(packed >> 16), int(packed & 0xFFFF));
+        }
+    }
+    if (flags & MetadataTable::HasFavorite) e.favorite = (flags & MetadataTable::Favorite) ? 1 : 0;
+    if (flags & MetadataTable::HasBanned) e.banned = (flags & MetadataTable::Banned) ? 1 : 0;
+    if (flags & MetadataTable::HashThumbnail) {
+        e.thumbnail = MetadataTable::hashHex(section<MetadataTable::Hash>(h->hashesOffset)[row]) + QStringLiteral("-thumb.jpg");
+    } else if (const Side *s = side(row, CustomThumbnail)) {
+        e.thumbnail = stringAt(s->a);
+    }
+    e.downloadedAtMs = section<qint64>(h->downloadedAtOffset)[row];
+    if (const Side *s = side(row, Extra)) {
+        const QJsonDocument doc = QJsonDocument::fromJson(bytesAt(s->a));
+        if (doc.isObject()) e.extra = doc.object();
+    }
+    return e;
+}
+
+std::shared_ptr<MetadataTable> BinaryIndex::table(quint64 version) const
+{
+    auto table = std::make_shared<MetadataTable>();
+    MetadataTable &t = *table;
+    t.m_version = version;
+    if (!isOpen()) return table;
+    const Header *h = header();
+
+    // the columns, byte for byte
+    t.m_hashedRows = int(h->hashedRows);
+    copyColumn(t.m_hashes, m_data + h->hashesOffset, h->hashedRows);
+    copyColumn(t.m_extension, m_data + h->extensionIdsOffset, h->hashedRows);
+    copyColumn(t.m_subreddit, m_data + h->subredditIdsOffset, h->rowCount);
+    copyColumn(t.m_packedSize, m_data + h->packedSizesOffset, h->rowCount);
+    copyColumn(t.m_flags, m_data + h->flagsOffset, h->rowCount);
+    copyColumn(t.m_downloadedAt, m_data + h->downloadedAtOffset, h->rowCount);
+
+    // names and the rows outside the hash order
+    const quint32 *extensions = section<quint32>(h->extensionsOffset);
+    for (quint32 i = 0; i < h->extensionCount; ++i) t.m_extensionNames.append(stringAt(extensions[i]));
+    const quint32 *subreddits = section<quint32>(h->subredditsOffset);
+    for (quint32 i = 0; i < h->subredditCount; ++i) {
+        const QString name = stringAt(subreddits[i]);
+        t.m_subredditIds.insert(name, quint16(i));
+        t.m_subredditNames.append(name);
+    }
+    const quint32 *others = section<quint32>(h->otherKeysOffset);
+    for (quint32 i = 0; i < h->rowCount - h->hashedRows; ++i) {
+        const QString key = stringAt(others[i]);
+        t.m_otherRows.insert(key, int(h->hashedRows + i));
+        t.m_otherKeys.append(key);
+    }
+    t.m_unsortableRows = int(qMin(h->unsortableRows, h->rowCount - h->hashedRows));
+
+    const Side *sides = section<Side>(h->sidesOffset);
+    for (quint32 i = 0; i < h->sideCount; ++i) {
+        const Side &s = sides[i];
+        if (s.row >= h->rowCount) continue;
+        switch (s.kind) {
+        case CustomThumbnail:
+            t.m_customThumbnails.insert(int(s.row), stringAt(s.a));
+            break;
+        case BigSize:
+            t.m_bigSizes.insert(int(s.row), QSize(int(s.a), int(s.b)));
+            break;
+        case Extra: {
+            const QJsonDocument doc = QJsonDocument::fromJson(bytesAt(s.a));
+            if (doc.isObject()) t.m_extra.insert(int(s.row), doc.object());
+            break;
+        }
+        }
+    }
+    return table;
+}
+
+bool BinaryIndex::write(const QString &path, const MetadataTable &t, qint64 sourceSize, qint64 sourceMtimeMs)
+{
+    static_assert(sizeof(Header) == 144, "BinaryIndex header layout changed");
+    static_assert(sizeof(Side) == 16, "BinaryIndex side record layout changed");
+    static_assert(sizeof(MetadataTable::Hash) == 32, "hash column layout changed");
+
+    QByteArray strings;
+    QHash<QString, quint32> pool;
+    auto addString = [&](const QString &s) -> quint32 {
+        auto it = pool.constFind(s);
+        if (it != pool.constEnd()) return it.value();
+        quint32 off = quint32(strings.size());
+        QByteArray utf8 = s.toUtf8();
+        quint32 len = quint32(utf8.size());
+        strings.append(reinterpret_cast<const char*>(&len), 4);
+        strings.append(utf8);
+        pool.insert(s, off);
+        return off;
+    };
+
+    QVector<quint32> extensions;
+    for (const QString &ext : t.m_extensionNames) extensions.append(addString(ext));
+    QVector<quint32> subreddits;
+    for (const QString &sub : t.m_subredditNames) subreddits.append(addString(sub));
+    QVector<quint32> others;
+    for (const QString &key : t.m_otherKeys) others.append(addString(key));
+
+    QVector<Side> sides;
+    for (auto it = t.m_customThumbnails.constBegin(); it != t.m_customThumbnails.constEnd(); ++it) {
+        sides.append({ quint32(it.key()), CustomThumbnail, addString(it.value()), 0 });
+    }
+    for (auto it = t.m_bigSizes.constBegin(); it != t.m_bigSizes.constEnd(); ++it) {
+        sides.append({ quint32(it.key()), BigSize, quint32(it.value().width()), quint32(it.value().height()) });
+    }
+    for (auto it = t.m_extra.constBegin(); it != t.m_extra.constEnd(); ++it) {
+        const QString json = QString::fromUtf8(QJsonDocument(it.value()).toJson(QJsonDocument::Compact));
+        sides.append({ quint32(it.key()), Extra, addString(json), 0 });
+    }
+    std::sort(sides.begin(), sides.end(), [](const Side &a, const Side &b) {
+        return a.row != b.row ? a.row < b.row : a.kind < b.kind;
+    });
+
+    Header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, 4);
+    h.version = kVersion;
+    h.rowCount = quint32(t.rowCount());
+    h.hashedRows = quint32(t.m_hashedRows);
+    h.unsortableRows = quint32(t.m_unsortableRows);
+    h.extensionCount = quint32(extensions.size());
+    h.subredditCount = quint32(subreddits.size());
+    h.sideCount = quint32(sides.size());
+    h.sourceSize = sourceSize;
+    h.sourceMtimeMs = sourceMtimeMs;
+
+    QByteArray out;
+    out.append(reinterpret_cast<const char*>(&h), sizeof(h));
+    h.extensionsOffset = appendSection(out, extensions.constData(), extensions.size());
+    h.subredditsOffset = appendSection(out, subreddits.constData(), subreddits.size());
+    h.hashesOffset = appendSection(out, t.m_hashes.constData(), t.m_hashedRows);
+    h.extensionIdsOffset = appendSection(out, t.m_extension.constData(), t.m_hashedRows);
+    h.subredditIdsOffset = appendSection(out, t.m_subreddit.constData(), t.rowCount());
+    h.packedSizesOffset = appendSection(out, t.m_packedSize.constData(), t.rowCount());
+    h.flagsOffset = appendSection(out, t.m_flags.constData(), t.rowCount());
+    h.downloadedAtOffset = appendSection(out, t.m_downloadedAt.constData(), t.rowCount());
+    h.otherKeysOffset = appendSection(out, others.constData(), others.size());
+    h.sidesOffset = appendSection(out, sides.constData(), sides.size());
+    h.stringsOffset = appendSection(out, strings.constData(), strings.size());
+    h.stringsSize = quint64(strings.size());
+    // header offsets are only known now
+    std::memcpy(out.data(), &h, sizeof(h));
+
+    QSaveFile sf(path);
+    if (!sf.open(QIODevice::WriteOnly)) return false;
+    sf.write(out);
+    return sf.commit();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "metadatatable.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+// BinaryIndex is an optional, memory-mapped mirror of index.json.
+//
+// It stores a MetadataTable as the table holds it in memory (native endian,
+// every section 8-byte aligned):
+//   Header
+//   quint32 extensions[extensionCount]       (string pool offsets)
+//   quint32 subreddits[subredditCount]       (string pool offsets, interned)
+//   Hash    hashes[hashedRows]               (sorted: the lookup table)
+//   quint8  extensionIds[hashedRows]
+//   quint16 subredditIds[rowCount]
+//   quint32 packedSizes[rowCount]
+//   quint8  flags[rowCount]                  (MetadataTable's flag bits)
+//   qint64  downloadedAt[rowCount]
+//   quint32 otherKeys[rowCount - hashedRows] (string pool offsets)
+//   Side    sides[sideCount]                 (sorted by row: the side tables)
+//   string pool                              (quint32 length + UTF-8 bytes)
+//
+// find() and entry() answer straight from the mapping: a binary search of
+// the hash column, then the row's columns. On a cold start IndexStore gets
+// its MetadataTable from table(), which copies the columns as they are; only
+// the interned names and the few side-table rows are decoded.
+class BinaryIndex {
+public:
+    BinaryIndex() = default;
+    ~BinaryIndex();
+    BinaryIndex(const BinaryIndex &) = delete;
+    BinaryIndex &operator=(const BinaryIndex &) = delete;
+
+    // Map the file; fails on bad magic/version or a truncated file
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const { return m_data != nullptr; }
+
+    // Size and mtime of the index.json this file was generated from
+    qint64 sourceSize() const;
+    qint64 sourceMtimeMs() const;
+
+    int count() const;
+    // Row for a key (file name), or -1
+    int find(const QString &key) const;
+    QString key(int row) const;
+    // One row, decoded
+    MetadataTable::Entry entry(int row) const;
+    // The whole table, columns copied from the mapping
+    std::shared_ptr<MetadataTable> table(quint64 version = 0) const;
+
+    // Generate a binary index from the store's table
+    static bool write(const QString &path, const MetadataTable &table, qint64 sourceSize, qint64 sourceMtimeMs);
+
+private:
+    struct Header;
+    struct Side;
+    const Header *header() const;
+    template <typename T> const T *section(quint64 offset) const;
+    // side-table record of `kind` for row, or nullptr
+    const Side *side(int row, quint32 kind) const;
+    // raw bytes of a pool string, without copying
+    QByteArray bytesAt(quint32 offset) const;
+    QString stringAt(quint32 offset) const;
+
+    QFile m_file;
+    const uchar *m_data = nullptr;
+    qint64 m_size = 0;
+};
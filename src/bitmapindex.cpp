@@ -0,0 +1,160 @@
+#include "bitmapindex.h"
+#include "imagefilter.h"
+#include "metadatatable.h"
+#include "perflog.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QDebug>
+#include <algorithm>
+
+void BitmapIndex::importIfNeeded(const MetadataTable &table)
+{
+    // nothing persisted: build from scratch, straight from the columns
+    QElapsedTimer timer; timer.start();
+    *this = BitmapIndex();
+    for (int row = 0; row < table.rowCount(); ++row) {
+        setRow(table.key(row), table.subreddit(row), table.imageSize(row),
+               table.favorite(row), table.banned(row), table.downloadedAtMs(row));
+    }
+    qCDebug(lcPerf) << "BitmapIndex: indexed" << table.rowCount() << "entries subreddits=" << m_bySubreddit.size()
+                    << "resolutions=" << m_resolutions.size() << "ms=" << timer.elapsed();
+}
+
+quint32 BitmapIndex::idFor(const QString &key)
+{
+    auto it = m_ids.constFind(key);
+    if (it != m_ids.constEnd()) return it.value();
+    quint32 id;
+    if (!m_freeIds.isEmpty()) {
+        id = m_freeIds.takeLast();
+    } else {
+        id = quint32(m_rows.size());
+        m_rows.append(Row());
+    }
+    m_rows[int(id)] = Row();
+    m_rows[int(id)].key = key;
+    m_ids.insert(key, id);
+    return id;
+}
+
+void BitmapIndex::clearFacets(quint32 id)
+{
+    Row &row = m_rows[int(id)];
+    if (row.subreddit >= 0) m_bySubreddit[row.subreddit].remove(id);
+    if (row.resolution >= 0) m_byResolution[row.resolution].remove(id);
+    m_favorite.remove(id);
+    m_banned.remove(id);
+    m_live.remove(id);
+}
+
+void BitmapIndex::entryChanged(const QString &key, const QJsonObject &entry)
+{
+    const QDateTime when = QDateTime::fromString(entry.value("downloaded_at").toString(), Qt::ISODate);
+    setRow(key, entry.value("subreddit").toString(),
+           QSize(entry.value("width").toInt(0), entry.value("height").toInt(0)),
+           entry.value("favorite").toBool(false), entry.value("banned").toBool(false),
+           when.isValid() ? when.toMSecsSinceEpoch() : -1);
+}
+
+void BitmapIndex::setRow(const QString &key, const QString &subreddit, const QSize &size,
+                         bool favorite, bool banned, qint64 downloadedAtMs)
+{
+    const quint32 id = idFor(key);
+    clearFacets(id);
+    Row &row = m_rows[int(id)];
+    row.live = true;
+    row.downloadedAt = downloadedAtMs;
+    row.favorite = favorite;
+    row.banned = banned;
+
+    // normalize once here instead of on every filter evaluation
+    const QString sub = ImageFilter::normalizeSubreddit(subreddit);
+    row.subreddit = -1;
+    if (!sub.isEmpty()) {
+        auto sit = m_subredditIds.constFind(sub);
+        if (sit == m_subredditIds.constEnd()) {
+            sit = m_subredditIds.insert(sub, m_bySubreddit.size());
+            m_bySubreddit.append(CompressedBitmap());
+        }
+        row.subreddit = sit.value();
+        m_bySubreddit[row.subreddit].add(id);
+    }
+
+    row.resolution = -1;
+    if (!size.isEmpty()) {
+        auto rit = m_resolutionIds.constFind(size);
+        if (rit == m_resolutionIds.constEnd()) {
+            rit = m_resolutionIds.insert(size, m_resolutions.size());
+            m_resolutions.append(size);
+            m_byResolution.append(CompressedBitmap());
+        }
+        row.resolution = rit.value();
+        m_byResolution[row.resolution].add(id);
+    }
+
+    if (row.favorite) m_favorite.add(id);
+    if (row.banned) m_banned.add(id);
+    m_live.add(id);
+}
+
+void BitmapIndex::entryRemoved(const QString &key)
+{
+    auto it = m_ids.find(key);
+    if (it == m_ids.end()) return;
+    const quint32 id = it.value();
+    clearFacets(id);
+    m_rows[int(id)] = Row();
+    m_ids.erase(it);
+    m_freeIds.append(id);
+}
+
+CompressedBitmap BitmapIndex::evaluate(const ImageFilter &filter) const
+{
+    CompressedBitmap result = m_live.andNot(m_banned);
+    if (filter.favoritesOnly) result = result & m_favorite;
+    if (!filter.allowedSubreddits.isEmpty()) {
+        CompressedBitmap subs;
+        for (const QString &s : filter.allowedSubreddits) {
+            int idx = m_subredditIds.value(s, -1);
+            if (idx >= 0) subs |= m_bySubreddit[idx];
+        }
+        result = result & subs;
+    }
+    if (filter.mode != ImageFilter::All) {
+        // the size rules only depend on the resolution, so test each distinct one once
+        CompressedBitmap sizes;
+        for (int i = 0; i < m_resolutions.size(); ++i) {
+            if (filter.acceptsSize(m_resolutions[i])) sizes |= m_byResolution[i];
+        }
+        result = result & sizes;
+    }
+    return result;
+}
+
+QString BitmapIndex::keyForId(quint32 id) const
+{
+    if (id >= quint32(m_rows.size())) return QString();
+    return m_rows[int(id)].key;
+}
+
+QStringList BitmapIndex::query(const ImageFilter &filter)
+{
+    QVector<quint32> ids = evaluate(filter).toVector();
+    std::stable_sort(ids.begin(), ids.end(), [this](quint32 a, quint32 b) {
+        return m_rows[int(a)].downloadedAt > m_rows[int(b)].downloadedAt;
+    });
+    QStringList out;
+    out.reserve(ids.size());
+    for (quint32 id : ids) out << m_rows[int(id)].key;
+    return out;
+}
+
+QString BitmapIndex::randomKey(const ImageFilter &filter)
+{
+    CompressedBitmap ids = evaluate(filter);
+    quint64 n = ids.cardinality();
+    if (n == 0) return QString();
+    return keyForId(ids.select(QRandomGenerator::global()->bounded(quint64(n))));
+}
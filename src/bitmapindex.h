@@ -0,0 +1,56 @@
+#pragma once
+
+#include "metadatabackend.h"
+#include "compressedbitmap.h"
+
+#include <QHash>
+#include <QSize>
+#include <QVector>
+
+// In-memory MetadataBackend: every entry gets a dense integer ID and each
+// facet (subreddit, resolution, favorite, banned) keeps a compressed bitmap
+// of IDs, so a filter resolves to a few bitmap ANDs/ORs. Calls are
+// serialized by the owning IndexStore.
+class BitmapIndex : public MetadataBackend {
+public:
+    QString name() const override { return "bitmap"; }
+    void importIfNeeded(const MetadataTable &table) override;
+    void entryChanged(const QString &key, const QJsonObject &entry) override;
+    void entryRemoved(const QString &key) override;
+    void sync() override {}
+    QStringList query(const ImageFilter &filter) override;
+    QString randomKey(const ImageFilter &filter) override;
+
+    // IDs accepted by the filter
+    CompressedBitmap evaluate(const ImageFilter &filter) const;
+    QString keyForId(quint32 id) const;
+
+private:
+    struct Row {
+        QString key;              // shares its data with the m_ids key
+        qint64 downloadedAt = -1; // ms since epoch
+        int subreddit = -1;
+        int resolution = -1;
+        bool favorite = false;
+        bool banned = false;
+        bool live = false;
+    };
+    quint32 idFor(const QString &key);
+    void setRow(const QString &key, const QString &subreddit, const QSize &size,
+                bool favorite, bool banned, qint64 downloadedAtMs);
+    // remove a row's bits from every facet bitmap
+    void clearFacets(quint32 id);
+
+    QVector<Row> m_rows;
+    QHash<QString, quint32> m_ids;
+    QVector<quint32> m_freeIds;
+
+    QHash<QString, int> m_subredditIds;
+    QVector<CompressedBitmap> m_bySubreddit;
+    QHash<QSize, int> m_resolutionIds;
+    QVector<QSize> m_resolutions;
+    QVector<CompressedBitmap> m_byResolution;
+    CompressedBitmap m_live;
+    CompressedBitmap m_favorite;
+    CompressedBitmap m_banned;
+};
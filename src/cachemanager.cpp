@@ -1,16 +1,19 @@
 #include "cachemanager.h"
+#include "indexstore.h"
+#include "urlindex.h"
+#include "networkservice.h"
+#include "imageingest.h"
+#include "thumbnailgenerator.h"
+#include "perflog.h"
 
 #include <QDir>
 #include <QStandardPaths>
 #include <QFile>
-#include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
-#include <QEventLoop>
 #include <QCryptographicHash>
 #include <QDebug>
 #include <QRandomGenerator>
-#include <QImage>
 #include <QImageReader>
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -20,8 +23,9 @@
 #include <QThreadPool>
 #include <QMutex>
 #include <QFileInfo>
+#include <atomic>
 
-QString CacheManager::downloadAndCache(const QString &url) {
+QDir CacheManager::ensureCacheDir() const {
     // Use the same cache directory as the Python app (~/.cache/wallaroo)
     QString cacheBase = QDir::homePath() + "/.cache/wallaroo";
     // ensure the directory exists (mkpath creates parent dirs as needed)
@@ -31,44 +35,154 @@ QString CacheManager::downloadAndCache(const QString &url) {
         cacheBase = QDir::homePath() + "/.cache";
         QDir().mkpath(cacheBase);
     }
-    QDir dir(cacheBase);
+    return QDir(cacheBase);
+}
+
+QString CacheManager::cachedPath(const QString &url) const {
+    // cached files are named by content hash, so look the URL up instead of the name
+    const QString known = UrlIndex::instance()->fileFor(url);
+    if (known.isEmpty()) return QString();
+    const QString path = ensureCacheDir().filePath(known);
+    return QFile::exists(path) ? path : QString();
+}
 
-    // store cacheBase for callers
-    // Note: we don't keep state in this simple manager, so cacheDirPath() will compute the same value
+namespace {
+
+// see CacheManager::pendingIndexTasks
+std::atomic<int> g_pendingIndexTasks{0};
+// see CacheManager::setDownloadLimits
+std::atomic<qint64> g_maxBytes{CacheManager::kDefaultMaxBytes};
+std::atomic<qint64> g_maxPixels{CacheManager::kDefaultMaxPixels};
+
+// Record why a download was refused and drop its part file
+void reject(ImageIngest &ingest, const QString &reason) {
+    qWarning() << "Rejecting" << ingest.url() << "-" << reason;
+    UrlIndex::instance()->setRejected(ingest.url(), reason);
+    ingest.abort();
+}
 
-    // base filename from URL
+// extension part of the URL's last path segment (kept verbatim in the cached name)
+QString extensionFor(const QString &url) {
     QString name = url.section('/', -1);
     if (name.isEmpty()) name = "wallaroo.jpg";
-    QString finalPath = dir.filePath(name);
-    // if exists, return
-    if (QFile::exists(finalPath)) return finalPath;
-
-    // download
-    qDebug() << "Downloading:" << url;
-    QNetworkAccessManager mgr;
-    QNetworkRequest req(url);
-    req.setRawHeader("User-Agent", "wallaroo/0.1");
-    QNetworkReply *reply = mgr.get(req);
-    QEventLoop loop;
-    QObject::connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
-    loop.exec();
-    if (reply->error() != QNetworkReply::NoError) {
-        qWarning() << "Network error:" << reply->error() << reply->errorString();
-        qWarning() << "URL was:" << url;
-        reply->deleteLater();
-        return QString();
+    return name.section('.', -1);
+}
+
+} // namespace
+
+std::unique_ptr<ImageIngest> CacheManager::beginIngest(const QString &url) {
+    auto ingest = std::make_unique<ImageIngest>(ensureCacheDir().absolutePath(), extensionFor(url), url);
+    if (!ingest->open()) return nullptr;
+    return ingest;
+}
+
+QNetworkRequest CacheManager::downloadRequest(const QString &url, const ImageIngest &ingest) {
+    QNetworkRequest req = NetworkService::request(QUrl(url));
+    if (ingest.resumeOffset() > 0) {
+        req.setRawHeader("Range", "bytes=" + QByteArray::number(ingest.resumeOffset()) + "-");
+        // only continue if the resource is unchanged; otherwise the server sends it whole
+        req.setRawHeader("If-Range", ingest.validator());
+    }
+    return req;
+}
+
+bool CacheManager::acceptResponse(QNetworkReply *reply, ImageIngest &ingest) {
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 0 || (status >= 300 && status < 400)) return true; // not final yet
+    if (ingest.resumeOffset() > 0) {
+        if (status == 206) {
+            // "Content-Range: bytes <start>-<end>/<total>" must continue where we stopped
+            const QByteArray range = reply->rawHeader("Content-Range");
+            const qint64 start = range.startsWith("bytes ") ? range.mid(6).split('-').value(0).trimmed().toLongLong() : -1;
+            if (start != ingest.resumeOffset()) {
+                qWarning() << "Resume mismatch for" << reply->url() << "Content-Range:" << range;
+                ingest.abort();
+                return false;
+            }
+            qCDebug(lcPerf) << "Resuming" << reply->url() << "from" << start;
+            return true;
+        }
+        if (status == 416) {
+            // our part no longer fits the resource
+            ingest.abort();
+            return false;
+        }
+        if (status == 200) {
+            qCDebug(lcPerf) << "Server ignored the range for" << reply->url() << "- restarting";
+            if (!ingest.restart()) return false;
+        }
+    }
+    if (status >= 400) {
+        // an error page is never image data; keepPartial() decides about the part
+        qWarning() << "HTTP" << status << "for" << reply->url();
+        return false;
+    }
+    // the full size is the Content-Length of a 200, or the total in Content-Range
+    qint64 total = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    if (status == 206) total = reply->rawHeader("Content-Range").split('/').value(1).toLongLong();
+    const qint64 maxBytes = g_maxBytes.load();
+    if (maxBytes > 0 && total > maxBytes) {
+        reject(ingest, QString("%1 bytes exceeds the %2 byte limit").arg(total).arg(maxBytes));
+        return false;
+    }
+    if (status == 200) {
+        // If-Range needs a strong ETag; weak ones fall back to Last-Modified
+        QByteArray etag = reply->rawHeader("ETag");
+        if (etag.startsWith("W/")) etag.clear();
+        ingest.setValidators(etag, reply->rawHeader("Last-Modified"));
+    }
+    return true;
+}
+
+bool CacheManager::acceptChunk(QNetworkReply *reply, ImageIngest &ingest) {
+    if (!ingest.append(reply->readAll())) return false;
+    // servers without Content-Length are caught as the bytes arrive
+    const qint64 maxBytes = g_maxBytes.load();
+    if (maxBytes > 0 && ingest.bytesWritten() > maxBytes) {
+        reject(ingest, QString("more than %1 bytes").arg(maxBytes));
+        return false;
     }
-    QByteArray data = reply->readAll();
-    qDebug() << "Downloaded" << data.size() << "bytes";
-    reply->deleteLater();
-
-    // compute sha256 and avoid duplicates
-    QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
-    // simplistic: filename as hash + ext
-    QString ext = name.section('.', -1);
-    QString outName = QString::fromUtf8(hash) + "." + ext;
-    QString outPath = dir.filePath(outName);
-    if (QFile::exists(outPath)) {
+    // the header is sniffed from the first few KB, long before the body is in
+    const QSize size = ingest.sniffedSize();
+    const qint64 maxPixels = g_maxPixels.load();
+    if (maxPixels > 0 && !size.isEmpty() && qint64(size.width()) * size.height() > maxPixels) {
+        reject(ingest, QString("%1x%2 exceeds the %3 pixel limit").arg(size.width()).arg(size.height()).arg(maxPixels));
+        return false;
+    }
+    return true;
+}
+
+void CacheManager::setDownloadLimits(qint64 maxBytes, qint64 maxPixels) {
+    g_maxBytes = qMax<qint64>(0, maxBytes);
+    g_maxPixels = qMax<qint64>(0, maxPixels);
+}
+
+void CacheManager::keepPartial(QNetworkReply *reply, ImageIngest &ingest) {
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    // throttled before anything new arrived: the earlier part is still good
+    if ((status == 429 || status == 503) && ingest.resumeOffset() > 0) {
+        ingest.suspend();
+        return;
+    }
+    const bool ranges = status == 206 || reply->rawHeader("Accept-Ranges").trimmed().toLower() == "bytes";
+    if ((status == 200 || status == 206) && ranges) ingest.suspend();
+    else ingest.abort();
+}
+
+void CacheManager::purgeStalePartials() const {
+    const int removed = ImageIngest::purgeStale(ensureCacheDir().absolutePath(), kPartialMaxAgeDays);
+    if (removed > 0) qCDebug(lcPerf) << "Removed" << removed << "stale partial downloads";
+}
+
+QString CacheManager::finishIngest(const QString &url, ImageIngest &ingest) {
+    const ImageIngest::Result res = ingest.finish();
+    if (!res.ok) return QString();
+    const QString dirPath = ensureCacheDir().absolutePath();
+    const QString outName = res.fileName;
+    const QString outPath = res.path;
+    const QByteArray hash = res.hash;
+    UrlIndex::instance()->setFile(url, outName);
+    if (res.existed) {
         qDebug() << "File already exists (by hash):" << outPath;
         // schedule an async task to ensure index.json contains size/thumbnail for this file
         class EnsureIndexTask : public QRunnable {
@@ -76,45 +190,23 @@ QString CacheManager::downloadAndCache(const QString &url) {
             EnsureIndexTask(const QString &outPath_, const QString &outName_, const QByteArray &hash_, const QString &dirPath_)
                 : outPath(outPath_), outName(outName_), hash(hash_), dirPath(dirPath_) {}
             void run() override {
-                QImageReader rExist(outPath);
-                QSize sz = rExist.size();
-                if (sz.isEmpty()) {
-                    QImage imgExist(outPath);
-                    if (!imgExist.isNull()) sz = imgExist.size();
-                }
-                QString indexPath = QDir(dirPath).filePath("index.json");
-                QJsonObject rootObj;
-                QFile idxf(indexPath);
-                if (idxf.open(QIODevice::ReadOnly)) {
-                    QJsonDocument doc = QJsonDocument::fromJson(idxf.readAll());
-                    if (doc.isObject()) rootObj = doc.object();
-                    idxf.close();
-                }
-                QJsonObject entry = rootObj.value(outName).toObject();
-                bool changed = false;
-                if (!sz.isEmpty() && (!entry.contains("width") || !entry.contains("height"))) {
-                    entry["width"] = sz.width();
-                    entry["height"] = sz.height();
-                    changed = true;
+                runTask();
+                g_pendingIndexTasks--;
+            }
+            void runTask() {
+                IndexStore *store = IndexStore::forCacheDir(dirPath);
+                QJsonObject entry = store->entry(outName);
+                if (!entry.contains("width") || !entry.contains("height")) {
+                    // header only; the thumbnail decode below fills it in if this fails
+                    store->setSize(outName, QImageReader(outPath).size());
                 }
-                QString thumbName = QString::fromUtf8(hash) + "-thumb.jpg";
+                QString thumbName = ThumbnailGenerator::thumbnailName(hash);
                 QString thumbPath = QDir(dirPath).filePath(thumbName);
                 if (!entry.contains("thumbnail") || !QFile::exists(thumbPath)) {
-                    QImage img2(outPath);
-                    if (!img2.isNull()) {
-                        QImage thumb = img2.scaled(300,300, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-                        thumb.save(thumbPath, "JPEG", 85);
-                    }
-                    entry["thumbnail"] = thumbName;
-                    changed = true;
-                }
-                if (changed) {
-                    rootObj[outName] = entry;
-                    QSaveFile sf(indexPath);
-                    if (sf.open(QIODevice::WriteOnly)) {
-                        sf.write(QJsonDocument(rootObj).toJson(QJsonDocument::Indented));
-                        sf.commit();
-                    }
+                    QSize decoded;
+                    const bool ok = ThumbnailGenerator::generate(outPath, thumbPath, &decoded, true);
+                    if (ok) store->setThumbnail(outName, thumbName);
+                    if (!entry.contains("width") && !decoded.isEmpty()) store->setSize(outName, decoded);
                 }
             }
         private:
@@ -123,79 +215,53 @@ QString CacheManager::downloadAndCache(const QString &url) {
             QByteArray hash;
             QString dirPath;
         };
-    QThreadPool::globalInstance()->start(new EnsureIndexTask(outPath, outName, hash, dir.absolutePath()));
+        g_pendingIndexTasks++;
+        QThreadPool::globalInstance()->start(new EnsureIndexTask(outPath, outName, hash, dirPath));
         return outPath;
     }
-    QFile f(outPath);
-    if (!f.open(QIODevice::WriteOnly)) {
-        qWarning() << "Failed to open file for writing:" << outPath;
-        return QString();
-    }
-    f.write(data);
-    f.close();
-    qDebug() << "Saved to:" << outPath;
+    qCDebug(lcPerf) << "Saved to:" << outPath << "bytes=" << ingest.bytesWritten() << "size=" << res.size;
 
     // After saving, schedule thumbnail generation and index.json updates on a background thread
-    QString outNameCopy2 = outName;
-    QByteArray hashCopy2 = hash;
-    QString outPathCopy = outPath;
-    QString dirPath2 = dir.absolutePath();
     class GenerateThumbTask : public QRunnable {
     public:
-        GenerateThumbTask(const QString &outPath_, const QString &outName_, const QByteArray &hash_, const QString &dirPath_)
-            : outPath(outPath_), outName(outName_), hash(hash_), dirPath(dirPath_) {}
+        GenerateThumbTask(const QString &outPath_, const QString &outName_, const QByteArray &hash_, const QString &dirPath_, const QSize &sniffed_, const QByteArray &data_)
+            : outPath(outPath_), outName(outName_), hash(hash_), dirPath(dirPath_), sniffed(sniffed_), data(data_) {}
         void run() override {
-            QSize sz;
-            QImageReader r(outPath);
-            sz = r.size();
-            QImage img;
-            if (sz.isEmpty()) {
-                img = QImage(outPath);
-                if (!img.isNull()) sz = img.size();
-            }
-            QString thumbName;
-            if (!img.isNull()) {
-                thumbName = QString::fromUtf8(hash) + "-thumb.jpg";
-                QString thumbPath = QDir(dirPath).filePath(thumbName);
-                QImage thumb = img.scaled(300, 300, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-                thumb.save(thumbPath, "JPEG", 85);
-            }
-            QString indexPath = QDir(dirPath).filePath("index.json");
-            QJsonObject rootObj;
-            QFile idxf(indexPath);
-            if (idxf.open(QIODevice::ReadOnly)) {
-                QJsonDocument doc = QJsonDocument::fromJson(idxf.readAll());
-                if (doc.isObject()) rootObj = doc.object();
-                idxf.close();
-            }
-            QJsonObject entry = rootObj.value(outName).toObject();
-            if (!sz.isEmpty()) {
-                entry["width"] = sz.width();
-                entry["height"] = sz.height();
-            }
-            if (!thumbName.isEmpty()) entry["thumbnail"] = thumbName;
-            entry["downloaded_at"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
-            if (!entry.contains("favorite")) entry["favorite"] = false;
-            if (!entry.contains("banned")) entry["banned"] = false;
-            rootObj[outName] = entry;
-            QSaveFile sf(indexPath);
-            if (sf.open(QIODevice::WriteOnly)) {
-                sf.write(QJsonDocument(rootObj).toJson(QJsonDocument::Indented));
-                sf.commit();
-            } else {
-                qWarning() << "Failed to write index.json" << indexPath;
-            }
+            // the only decode of the image, at reduced size, from the bytes
+            // the ingest kept (the file only for bodies too big to keep);
+            // dimensions normally come from the header sniff
+            QString thumbName = ThumbnailGenerator::thumbnailName(hash);
+            const QString thumbPath = QDir(dirPath).filePath(thumbName);
+            QSize decoded;
+            const bool ok = data.isEmpty() ? ThumbnailGenerator::generate(outPath, thumbPath, &decoded, true)
+                                           : ThumbnailGenerator::generate(data, thumbPath, &decoded);
+            data.clear();
+            if (!ok) thumbName.clear();
+            QSize sz = sniffed;
+            if (sz.isEmpty()) sz = decoded;
+            IndexStore *store = IndexStore::forCacheDir(dirPath);
+            store->setSize(outName, sz);
+            store->setThumbnail(outName, thumbName);
+            store->markDownloaded(outName, QDateTime::currentDateTimeUtc());
+            g_pendingIndexTasks--;
         }
     private:
         QString outPath;
         QString outName;
         QByteArray hash;
         QString dirPath;
+        QSize sniffed;
+        QByteArray data;
     };
-    QThreadPool::globalInstance()->start(new GenerateThumbTask(outPathCopy, outNameCopy2, hashCopy2, dirPath2));
+    g_pendingIndexTasks++;
+    QThreadPool::globalInstance()->start(new GenerateThumbTask(outPath, outName, hash, dirPath, res.size, res.data));
     return outPath;
 }
 
+int CacheManager::pendingIndexTasks() {
+    return g_pendingIndexTasks.load();
+}
+
 QString CacheManager::cacheDirPath() const {
     QString cacheBase = QDir::homePath() + "/.cache/wallaroo";
     if (!QDir().exists(cacheBase)) {
@@ -204,6 +270,10 @@ QString CacheManager::cacheDirPath() const {
     return cacheBase;
 }
 
+IndexStore *CacheManager::indexStore() const {
+    return IndexStore::forCacheDir(cacheDirPath());
+}
+
 QString CacheManager::randomImagePath() const {
     QString cacheBase = cacheDirPath();
     QDir dir(cacheBase);
@@ -1,15 +1,63 @@
 #pragma once
 
 #include <QString>
+#include <QByteArray>
+#include <QDir>
+#include <memory>
+
+class IndexStore;
+class ImageIngest;
+class QNetworkReply;
+class QNetworkRequest;
 
 class CacheManager {
 public:
-    // Download URL to cache and return local path (QString)
-    QString downloadAndCache(const QString &url);
+    // Local path of an already cached URL, or an empty string (no network)
+    QString cachedPath(const QString &url) const;
+    // Feed a download's body to the returned ingest chunk by chunk, then call
+    // finishIngest: it saves the file under its content hash, records the URL
+    // and schedules size/thumbnail indexing. Returns the local path or empty
+    // on error.
+    std::unique_ptr<ImageIngest> beginIngest(const QString &url);
+    QString finishIngest(const QString &url, ImageIngest &ingest);
+
+    // Resumable downloads. The request carries Range/If-Range when the ingest
+    // holds bytes from an earlier attempt.
+    static QNetworkRequest downloadRequest(const QString &url, const ImageIngest &ingest);
+    // Check the response headers (metaDataChanged). Restarts the ingest if the
+    // server ignored the range; returns false if the reply must be aborted.
+    static bool acceptResponse(QNetworkReply *reply, ImageIngest &ingest);
+    // Append what the reply has read so far; false (ingest dropped, URL marked
+    // rejected) if the body exceeds the download limits
+    static bool acceptChunk(QNetworkReply *reply, ImageIngest &ingest);
+    // Download guards, checked against Content-Length, the bytes received and
+    // the dimensions sniffed from the header; 0 disables a limit
+    static void setDownloadLimits(qint64 maxBytes, qint64 maxPixels);
+    static constexpr qint64 kDefaultMaxBytes = 64 * 1024 * 1024;
+    static constexpr qint64 kDefaultMaxPixels = 100 * 1000 * 1000;
+    // After a failed transfer: keep the part file when the server supports
+    // ranges, otherwise discard it
+    static void keepPartial(QNetworkReply *reply, ImageIngest &ingest);
+    // Suspended downloads older than this are removed at the start of a scan
+    static constexpr int kPartialMaxAgeDays = 7;
+    void purgeStalePartials() const;
+
+    // Thumbnail/index tasks scheduled by finishIngest that haven't finished;
+    // scans hold back new downloads while this is high
+    static int pendingIndexTasks();
+
+    // Network read buffer per download; bounds peak memory while streaming
+    static constexpr qint64 kIngestChunkBytes = 256 * 1024;
     
     // Return the cache directory path used by the manager
     QString cacheDirPath() const;
 
+    // Return the metadata store (index.json) for the cache directory
+    IndexStore *indexStore() const;
+
     // Return a random image path from the cache, or empty string if none
     QString randomImagePath() const;
+
+private:
+    QDir ensureCacheDir() const;
 };
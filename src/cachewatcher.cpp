@@ -0,0 +1,101 @@
+#include "cachewatcher.h"
+#include "indexstore.h"
+#include "thumbnailgenerator.h"
+#include "perflog.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QDebug>
+
+CacheWatcher::CacheWatcher(const QString &cacheDir, QObject *parent)
+    : QObject(parent),
+      m_cacheDir(QDir(cacheDir).absolutePath())
+{
+    QDir().mkpath(m_cacheDir);
+    m_store = IndexStore::forCacheDir(m_cacheDir);
+    m_known = scanImages();
+
+    m_debounce.setSingleShot(true);
+    m_debounce.setInterval(kDebounceMs);
+    connect(&m_debounce, &QTimer::timeout, this, &CacheWatcher::emitDelta);
+    m_rescan.setSingleShot(true);
+    m_rescan.setInterval(kRescanMs);
+    connect(&m_rescan, &QTimer::timeout, this, &CacheWatcher::rescan);
+
+    if (!m_watcher.addPath(m_cacheDir)) {
+        qWarning() << "CacheWatcher: cannot watch" << m_cacheDir;
+    }
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &CacheWatcher::onDirectoryChanged);
+    connect(m_store, &IndexStore::entriesChanged, this, &CacheWatcher::onEntriesChanged);
+}
+
+bool CacheWatcher::isImageName(const QString &name)
+{
+    // same extension rule as the random picker: allow trailing query-strings
+    static const QRegularExpression extRegex(R"(\.(?:png|jpe?g|bmp|webp|gif)(?:$|\?))", QRegularExpression::CaseInsensitiveOption);
+    return !ThumbnailGenerator::isThumbnailName(name) && extRegex.match(name).hasMatch();
+}
+
+QSet<QString> CacheWatcher::scanImages() const
+{
+    QSet<QString> out;
+    const QStringList names = QDir(m_cacheDir).entryList(QDir::Files | QDir::NoSymLinks);
+    for (const QString &name : names) {
+        if (isImageName(name)) out.insert(name);
+    }
+    return out;
+}
+
+void CacheWatcher::onDirectoryChanged()
+{
+    // most of these are the store's own files; its keys arrive separately
+    if (!m_rescan.isActive()) m_rescan.start();
+}
+
+void CacheWatcher::onEntriesChanged(const QStringList &keys)
+{
+    for (const QString &k : keys) m_pendingKeys.insert(k);
+    if (!m_debounce.isActive()) m_debounce.start();
+}
+
+void CacheWatcher::emitDelta()
+{
+    CacheDelta delta;
+    const QDir dir(m_cacheDir);
+    for (const QString &k : std::as_const(m_pendingKeys)) {
+        if (!isImageName(k)) continue;
+        const bool onDisk = QFileInfo::exists(dir.filePath(k));
+        if (!m_known.contains(k)) {
+            // metadata for files not on disk (yet) is picked up when they appear
+            if (onDisk && m_store->contains(k)) {
+                m_known.insert(k);
+                delta.added << k;
+            }
+        } else if (!onDisk) {
+            m_known.remove(k);
+            delta.removed << k;
+        } else {
+            delta.modified << k;
+        }
+    }
+    m_pendingKeys.clear();
+    if (delta.isEmpty()) return;
+    emit changed(delta);
+}
+
+void CacheWatcher::rescan()
+{
+    CacheDelta delta;
+    const QSet<QString> now = scanImages();
+    for (const QString &name : now) {
+        if (!m_known.contains(name)) delta.added << name;
+    }
+    for (const QString &name : std::as_const(m_known)) {
+        if (!now.contains(name)) delta.removed << name;
+    }
+    m_known = now;
+    if (delta.isEmpty()) return;
+    qCDebug(lcPerf) << "CacheWatcher: out-of-band added=" << delta.added.size() << "removed=" << delta.removed.size();
+    emit changed(delta);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QFileSystemWatcher>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+class IndexStore;
+
+// File names (relative to the cache dir) that changed since the last delta
+struct CacheDelta {
+    QStringList added;
+    QStringList removed;
+    // index metadata changed (size, thumbnail, favorite, banned, subreddit)
+    QStringList modified;
+
+    bool isEmpty() const { return added.isEmpty() && removed.isEmpty() && modified.isEmpty(); }
+};
+
+// Watches a cache directory's IndexStore and turns bursts of mutations into
+// one debounced CacheDelta so views can update in place instead of reloading
+// everything. The store names the keys it changed, so downloads and deletes
+// made through it need no directory listing. The directory itself is also
+// watched (inotify via QFileSystemWatcher), but only to catch files added or
+// removed behind the store's back; those are found by a rescan that runs at
+// most every kRescanMs.
+class CacheWatcher : public QObject {
+    Q_OBJECT
+public:
+    explicit CacheWatcher(const QString &cacheDir, QObject *parent = nullptr);
+
+    QString cacheDir() const { return m_cacheDir; }
+
+    // Window used to coalesce bursts of events (a scan writes many files);
+    // a delta is emitted at most this often
+    static constexpr int kDebounceMs = 250;
+    // Minimum spacing of directory rescans for out-of-band changes
+    static constexpr int kRescanMs = 2000;
+
+signals:
+    void changed(const CacheDelta &delta);
+
+private slots:
+    void onDirectoryChanged();
+    void onEntriesChanged(const QStringList &keys);
+    void emitDelta();
+    void rescan();
+
+private:
+    // cached image name (thumbnails and index files excluded)
+    static bool isImageName(const QString &name);
+    // image file names currently in the directory
+    QSet<QString> scanImages() const;
+
+    QString m_cacheDir;
+    IndexStore *m_store = nullptr;
+    QFileSystemWatcher m_watcher;
+    QTimer m_debounce;
+    QTimer m_rescan;
+    QSet<QString> m_known;
+    // keys the store reported since the last delta
+    QSet<QString> m_pendingKeys;
+};
@@ -0,0 +1,244 @@
+#include "compressedbitmap.h"
+
+#include <QtAlgorithms>
+#include <algorithm>
+#include <iterator>
+
+namespace {
+constexpr int kBitsetWords = 65536 / 64;
+}
+
+int CompressedBitmap::findContainer(quint16 high) const
+{
+    auto it = std::lower_bound(m_containers.cbegin(), m_containers.cend(), high,
+                               [](const Container &c, quint16 h) { return c.high < h; });
+    if (it == m_containers.cend() || it->high != high) return -1;
+    return int(it - m_containers.cbegin());
+}
+
+void CompressedBitmap::toBitset(Container &c)
+{
+    if (c.isBitset()) return;
+    c.bits = QVector<quint64>(kBitsetWords, 0);
+    for (quint16 low : c.array) c.bits[low >> 6] |= quint64(1) << (low & 63);
+    c.array.clear();
+}
+
+void CompressedBitmap::normalize(Container &c)
+{
+    if (c.isBitset() && c.card <= kArrayMax) {
+        QVector<quint16> arr;
+        arr.reserve(c.card);
+        for (int w = 0; w < kBitsetWords; ++w) {
+            quint64 word = c.bits[w];
+            while (word) {
+                int bit = qCountTrailingZeroBits(word);
+                arr.append(quint16((w << 6) | bit));
+                word &= word - 1;
+            }
+        }
+        c.array = arr;
+        c.bits.clear();
+    } else if (!c.isBitset() && c.card > kArrayMax) {
+        toBitset(c);
+    }
+}
+
+void CompressedBitmap::add(quint32 v)
+{
+    const quint16 high = quint16(v >> 16);
+    const quint16 low = quint16(v & 0xFFFF);
+    int idx = findContainer(high);
+    if (idx < 0) {
+        Container c;
+        c.high = high;
+        auto pos = std::lower_bound(m_containers.begin(), m_containers.end(), high,
+                                    [](const Container &x, quint16 h) { return x.high < h; });
+        idx = int(pos - m_containers.begin());
+        m_containers.insert(idx, c);
+    }
+    Container &c = m_containers[idx];
+    if (c.isBitset()) {
+        quint64 &word = c.bits[low >> 6];
+        quint64 mask = quint64(1) << (low & 63);
+        if (word & mask) return;
+        word |= mask;
+        c.card++;
+        return;
+    }
+    auto it = std::lower_bound(c.array.begin(), c.array.end(), low);
+    if (it != c.array.end() && *it == low) return;
+    c.array.insert(it, low);
+    c.card++;
+    normalize(c);
+}
+
+void CompressedBitmap::remove(quint32 v)
+{
+    int idx = findContainer(quint16(v >> 16));
+    if (idx < 0) return;
+    Container &c = m_containers[idx];
+    const quint16 low = quint16(v & 0xFFFF);
+    if (c.isBitset()) {
+        quint64 &word = c.bits[low >> 6];
+        quint64 mask = quint64(1) << (low & 63);
+        if (!(word & mask)) return;
+        word &= ~mask;
+        c.card--;
+        normalize(c);
+    } else {
+        auto it = std::lower_bound(c.array.begin(), c.array.end(), low);
+        if (it == c.array.end() || *it != low) return;
+        c.array.erase(it);
+        c.card--;
+    }
+    if (c.card == 0) m_containers.remove(idx);
+}
+
+bool CompressedBitmap::contains(quint32 v) const
+{
+    int idx = findContainer(quint16(v >> 16));
+    if (idx < 0) return false;
+    const Container &c = m_containers[idx];
+    const quint16 low = quint16(v & 0xFFFF);
+    if (c.isBitset()) return c.bits[low >> 6] & (quint64(1) << (low & 63));
+    return std::binary_search(c.array.cbegin(), c.array.cend(), low);
+}
+
+quint64 CompressedBitmap::cardinality() const
+{
+    quint64 n = 0;
+    for (const Container &c : m_containers) n += quint64(c.card);
+    return n;
+}
+
+CompressedBitmap::Container CompressedBitmap::combine(const Container &a, const Container &b, Op op)
+{
+    Container out;
+    out.high = a.high;
+    if (!a.isBitset() && !b.isBitset()) {
+        switch (op) {
+        case Op::And:
+            std::set_intersection(a.array.cbegin(), a.array.cend(), b.array.cbegin(), b.array.cend(), std::back_inserter(out.array));
+            break;
+        case Op::Or:
+            std::set_union(a.array.cbegin(), a.array.cend(), b.array.cbegin(), b.array.cend(), std::back_inserter(out.array));
+            break;
+        case Op::AndNot:
+            std::set_difference(a.array.cbegin(), a.array.cend(), b.array.cbegin(), b.array.cend(), std::back_inserter(out.array));
+            break;
+        }
+        out.card = out.array.size();
+        normalize(out);
+        return out;
+    }
+    // at least one side is dense: work word by word
+    Container x = a;
+    Container y = b;
+    toBitset(x);
+    toBitset(y);
+    out.bits = QVector<quint64>(kBitsetWords, 0);
+    for (int w = 0; w < kBitsetWords; ++w) {
+        quint64 word = 0;
+        switch (op) {
+        case Op::And: word = x.bits[w] & y.bits[w]; break;
+        case Op::Or: word = x.bits[w] | y.bits[w]; break;
+        case Op::AndNot: word = x.bits[w] & ~y.bits[w]; break;
+        }
+        out.bits[w] = word;
+        out.card += qPopulationCount(word);
+    }
+    normalize(out);
+    return out;
+}
+
+CompressedBitmap CompressedBitmap::combine(const CompressedBitmap &a, const CompressedBitmap &b, Op op)
+{
+    CompressedBitmap out;
+    int i = 0, j = 0;
+    const int na = a.m_containers.size();
+    const int nb = b.m_containers.size();
+    while (i < na || j < nb) {
+        if (j >= nb || (i < na && a.m_containers[i].high < b.m_containers[j].high)) {
+            // only in a
+            if (op != Op::And) out.m_containers.append(a.m_containers[i]);
+            ++i;
+        } else if (i >= na || b.m_containers[j].high < a.m_containers[i].high) {
+            // only in b
+            if (op == Op::Or) out.m_containers.append(b.m_containers[j]);
+            ++j;
+        } else {
+            Container c = combine(a.m_containers[i], b.m_containers[j], op);
+            if (c.card > 0) out.m_containers.append(c);
+            ++i;
+            ++j;
+        }
+    }
+    return out;
+}
+
+CompressedBitmap CompressedBitmap::operator&(const CompressedBitmap &other) const
+{
+    return combine(*this, other, Op::And);
+}
+
+CompressedBitmap CompressedBitmap::operator|(const CompressedBitmap &other) const
+{
+    return combine(*this, other, Op::Or);
+}
+
+CompressedBitmap &CompressedBitmap::operator|=(const CompressedBitmap &other)
+{
+    *this = combine(*this, other, Op::Or);
+    return *this;
+}
+
+CompressedBitmap CompressedBitmap::andNot(const CompressedBitmap &other) const
+{
+    return combine(*this, other, Op::AndNot);
+}
+
+quint32 CompressedBitmap::select(quint64 k) const
+{
+    for (const Container &c : m_containers) {
+        if (k >= quint64(c.card)) {
+            k -= quint64(c.card);
+            continue;
+        }
+        const quint32 base = quint32(c.high) << 16;
+        if (!c.isBitset()) return base | c.array[int(k)];
+        for (int w = 0; w < kBitsetWords; ++w) {
+            quint64 word = c.bits[w];
+            quint64 n = quint64(qPopulationCount(word));
+            if (k >= n) {
+                k -= n;
+                continue;
+            }
+            // drop the k lowest set bits, the next one is the answer
+            for (quint64 s = 0; s < k; ++s) word &= word - 1;
+            return base | quint32((w << 6) | qCountTrailingZeroBits(word));
+        }
+    }
+    return 0;
+}
+
+QVector<quint32> CompressedBitmap::toVector() const
+{
+    QVector<quint32> out;
+    out.reserve(int(cardinality()));
+    for (const Container &c : m_containers) {
+        const quint32 base = quint32(c.high) << 16;
+        if (!c.isBitset()) {
+            for (quint16 low : c.array) out.append(base | low);
+            continue;
+        }
+        for (int w = 0; w < kBitsetWords; ++w) {
+            quint64 word = c.bits[w];
+            while (word) {
+                out.append(base | quint32((w << 6) | qCountTrailingZeroBits(word)));
+                word &= word - 1;
+            }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QVector>
+#include <QtGlobal>
+
+// Roaring-style compressed bitmap over 32-bit IDs. Values are grouped by
+// their high 16 bits; each group is a sorted uint16 array while sparse and
+// a 65536-bit bitset once it holds more than kArrayMax values.
+class CompressedBitmap {
+public:
+    static constexpr int kArrayMax = 4096;
+
+    void add(quint32 v);
+    void remove(quint32 v);
+    bool contains(quint32 v) const;
+    bool isEmpty() const { return m_containers.isEmpty(); }
+    quint64 cardinality() const;
+
+    CompressedBitmap operator&(const CompressedBitmap &other) const;
+    CompressedBitmap operator|(const CompressedBitmap &other) const;
+    CompressedBitmap &operator|=(const CompressedBitmap &other);
+    // Values in this bitmap but not in other
+    CompressedBitmap andNot(const CompressedBitmap &other) const;
+
+    // k-th smallest value (0-based); k must be < cardinality()
+    quint32 select(quint64 k) const;
+    QVector<quint32> toVector() const;
+
+private:
+    struct Container {
+        quint16 high = 0;
+        int card = 0;
+        QVector<quint16> array;  // sorted, used while card <= kArrayMax
+        QVector<quint64> bits;   // 1024 words, used above kArrayMax
+        bool isBitset() const { return !bits.isEmpty(); }
+    };
+    enum class Op { And, Or, AndNot };
+
+    int findContainer(quint16 high) const;
+    static void toBitset(Container &c);
+    static void normalize(Container &c);
+    static Container combine(const Container &a, const Container &b, Op op);
+    static CompressedBitmap combine(const CompressedBitmap &a, const CompressedBitmap &b, Op op);
+
+    QVector<Container> m_containers; // sorted by high
+};
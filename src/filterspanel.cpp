@@ -5,6 +5,7 @@
 #include <QCheckBox>
 #include <QScrollArea>
 #include <QGridLayout>
+#include <QSet>
 
 FiltersPanel::FiltersPanel(QWidget *parent)
     : QWidget(parent), combo_(new QComboBox(this))
@@ -41,6 +42,13 @@ FiltersPanel::FiltersPanel(QWidget *parent)
 
 void FiltersPanel::setAvailableResolutions(const QList<QSize> &resolutions)
 {
+    if (resolutionsContainer_ && resolutions == m_availableResolutions) return;
+    m_availableResolutions = resolutions;
+    // remember what the user unchecked so incremental updates don't reset it
+    QSet<QString> unchecked;
+    for (auto it = m_resolutionChecks.constBegin(); it != m_resolutionChecks.constEnd(); ++it) {
+        if (!it.value()->isChecked()) unchecked.insert(it.key());
+    }
     // Create scrollable two-column grid the first time, or recreate the inner widget when updating
     if (!resolutionsContainer_) {
         resolutionsContainer_ = new QScrollArea(this);
@@ -82,29 +90,35 @@ void FiltersPanel::setAvailableResolutions(const QList<QSize> &resolutions)
     for (const QSize &s : resolutions) {
         QString key = QString("%1x%2").arg(s.width()).arg(s.height());
         QCheckBox *cb = new QCheckBox(key, resolutionsWidget_);
-        cb->setChecked(true);
+        cb->setChecked(!unchecked.contains(key));
         int col = idx % 2;
         row = 1 + (idx / 2);
         resolutionsGrid_->addWidget(cb, row, col);
         m_resolutionChecks.insert(key, cb);
         connect(cb, &QCheckBox::toggled, this, [this]() {
-            // gather selected
-            QList<QSize> sel;
-            for (auto it = m_resolutionChecks.constBegin(); it != m_resolutionChecks.constEnd(); ++it) {
-                if (it.value()->isChecked()) {
-                    QString k = it.key();
-                    QStringList parts = k.split('x');
-                    if (parts.size() == 2) {
-                        int w = parts[0].toInt();
-                        int h = parts[1].toInt();
-                        sel.append(QSize(w,h));
-                    }
-                }
-            }
-            emit resolutionsChanged(sel);
+            emit resolutionsChanged(selectedResolutions());
         });
         ++idx;
     }
+    // newly appeared resolutions start checked; keep the viewer's selection in step
+    if (!unchecked.isEmpty()) emit resolutionsChanged(selectedResolutions());
+}
+
+QList<QSize> FiltersPanel::selectedResolutions() const
+{
+    QList<QSize> sel;
+    for (auto it = m_resolutionChecks.constBegin(); it != m_resolutionChecks.constEnd(); ++it) {
+        if (it.value()->isChecked()) {
+            QString k = it.key();
+            QStringList parts = k.split('x');
+            if (parts.size() == 2) {
+                int w = parts[0].toInt();
+                int h = parts[1].toInt();
+                sel.append(QSize(w,h));
+            }
+        }
+    }
+    return sel;
 }
 
 ThumbnailViewer::AspectFilterMode FiltersPanel::mode() const {
@@ -15,7 +15,8 @@ public:
     void setMode(ThumbnailViewer::AspectFilterMode m);
     bool favoritesOnly() const;
     void setFavoritesOnly(bool v);
-    // Populate the panel with available resolutions (width x height) and show checkboxes
+    // Populate the panel with available resolutions (width x height) and show checkboxes.
+    // Unchanged lists are ignored; existing check states are kept across updates.
     void setAvailableResolutions(const QList<QSize> &resolutions);
 
 signals:
@@ -25,6 +26,9 @@ signals:
     void resolutionsChanged(const QList<QSize> &selected);
 
 private:
+    // resolutions whose checkbox is checked
+    QList<QSize> selectedResolutions() const;
+
     QComboBox *combo_;
     QCheckBox *favOnly_ = nullptr;
     // Container for dynamically generated resolution checkboxes (scrollable, 2-column grid)
@@ -32,6 +36,7 @@ private:
     QWidget *resolutionsWidget_ = nullptr;
     QGridLayout *resolutionsGrid_ = nullptr;
     QMap<QString, QCheckBox*> m_resolutionChecks;
+    QList<QSize> m_availableResolutions;
 };
 
 #endif // FILTERSPANEL_H
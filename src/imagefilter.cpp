@@ -0,0 +1,66 @@
+#include "imagefilter.h"
+
+#include <QtGlobal>
+
+QString ImageFilter::normalizeSubreddit(const QString &name)
+{
+    QString n = name.trimmed();
+    if (n.startsWith("r/", Qt::CaseInsensitive)) n = n.mid(2);
+    return n.toLower();
+}
+
+bool ImageFilter::acceptsMetadata(const QString &subreddit, bool favorite, bool banned) const
+{
+    if (banned) return false;
+    if (favoritesOnly && !favorite) return false;
+    if (!allowedSubreddits.isEmpty()) {
+        QString sr = normalizeSubreddit(subreddit);
+        if (sr.isEmpty() || !allowedSubreddits.contains(sr)) return false;
+    }
+    return true;
+}
+
+bool ImageFilter::acceptsSize(const QSize &sz) const
+{
+    if (mode == All) return true;
+    if (sz.isEmpty()) return false;
+    double ar = double(sz.width()) / double(sz.height());
+
+    if (mode == Exact) {
+        // If selected resolutions are specified, only accept images that match one of them
+        if (!selectedResolutions.isEmpty()) {
+            for (const QSize &s : selectedResolutions) {
+                if (s.width() == sz.width() && s.height() == sz.height()) return true;
+            }
+            return false;
+        }
+        // Fallback: aspect-based exact match if no resolutions selected
+        return qAbs(ar - targetAspect) <= 0.03;
+    }
+    // Rough: match orientation only (horizontal vs vertical)
+    bool primaryHorizontal = targetAspect >= 1.0;
+    bool imgHorizontal = sz.width() >= sz.height();
+    if (primaryHorizontal != imgHorizontal) return false;
+
+    // Now ensure that when center-cropped to the target aspect ratio the resulting
+    // dimensions are at least as large as the screen dimensions.
+    int cropW, cropH;
+    if (ar > targetAspect) {
+        // image is wider than target -> crop width
+        cropH = sz.height();
+        cropW = int(double(cropH) * targetAspect + 0.5);
+    } else {
+        // image is taller (or equal) -> crop height
+        cropW = sz.width();
+        cropH = int(double(cropW) / targetAspect + 0.5);
+    }
+    return (cropW >= screenSize.width()) && (cropH >= screenSize.height());
+}
+
+bool ImageFilter::couldAcceptSize(const QSize &sz) const
+{
+    if (mode == All || sz.isEmpty()) return true;
+    if (mode == Exact && !selectedResolutions.isEmpty()) return !excludedResolutions.contains(sz);
+    // aspect and screen-crop rules depend on the size alone
+    return acceptsSize(sz);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QList>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+// Snapshot of the thumbnail filter state, evaluable without a ThumbnailViewer
+// (metadata backends, random pickers).
+struct ImageFilter {
+    // Same values as ThumbnailViewer::AspectFilterMode
+    enum Mode {
+        All = 0,
+        Exact = 1,
+        Rough = 2
+    };
+    Mode mode = All;
+    double targetAspect = 16.0/9.0;
+    // Used by Rough mode: the center crop must cover the screen
+    QSize screenSize = QSize(1920, 1080);
+    // Exact mode: accepted resolutions; empty means "match targetAspect"
+    QList<QSize> selectedResolutions;
+    // Exact mode, before download: known resolutions the user unchecked. A
+    // size not in the cache yet gets a new (checked) box, so only these are final.
+    QList<QSize> excludedResolutions;
+    // Normalized (lower-case, no "r/") names; empty means allow all
+    QStringList allowedSubreddits;
+    bool favoritesOnly = false;
+
+    // Lower-case and strip a leading "r/"
+    static QString normalizeSubreddit(const QString &name);
+
+    // Subreddit/favorite/banned part of the filter
+    bool acceptsMetadata(const QString &subreddit, bool favorite, bool banned) const;
+    // Aspect/resolution part of the filter
+    bool acceptsSize(const QSize &size) const;
+    // Whether an image of this size could ever be shown, judged before it is
+    // downloaded. An unknown (empty) size passes.
+    bool couldAcceptSize(const QSize &size) const;
+};
@@ -0,0 +1,288 @@
+#include "imageingest.h"
+#include "urlindex.h"
+#include "perflog.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QDebug>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+quint32 be16(const uchar *p) { return (quint32(p[0]) << 8) | p[1]; }
+quint32 be32(const uchar *p) { return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | p[3]; }
+quint32 le16(const uchar *p) { return quint32(p[0]) | (quint32(p[1]) << 8); }
+quint32 le24(const uchar *p) { return quint32(p[0]) | (quint32(p[1]) << 8) | (quint32(p[2]) << 16); }
+quint32 le32(const uchar *p) { return le16(p) | (le16(p + 2) << 16); }
+
+QSize jpegSize(const uchar *p, qint64 n) {
+    qint64 i = 2;
+    while (i + 4 <= n) {
+        if (p[i] != 0xFF) return QSize();
+        const uchar marker = p[i + 1];
+        if (marker == 0xFF) { ++i; continue; } // fill byte
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) { i += 2; continue; }
+        const quint32 segLen = be16(p + i + 2);
+        const bool sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (sof) {
+            if (i + 9 > n) return QSize();
+            return QSize(int(be16(p + i + 7)), int(be16(p + i + 5)));
+        }
+        if (segLen < 2) return QSize();
+        i += 2 + segLen;
+    }
+    return QSize();
+}
+
+} // namespace
+
+QSize ImageIngest::sniffSize(const uchar *p, qint64 n)
+{
+    static const uchar png[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    if (n >= 24 && memcmp(p, png, 8) == 0 && memcmp(p + 12, "IHDR", 4) == 0) {
+        return QSize(int(be32(p + 16)), int(be32(p + 20)));
+    }
+    if (n >= 4 && p[0] == 0xFF && p[1] == 0xD8) return jpegSize(p, n);
+    if (n >= 10 && (memcmp(p, "GIF87a", 6) == 0 || memcmp(p, "GIF89a", 6) == 0)) {
+        return QSize(int(le16(p + 6)), int(le16(p + 8)));
+    }
+    if (n >= 26 && p[0] == 'B' && p[1] == 'M') {
+        const qint32 h = qint32(le32(p + 22)); // negative for top-down bitmaps
+        return QSize(int(le32(p + 18)), h < 0 ? -h : h);
+    }
+    if (n >= 30 && memcmp(p, "RIFF", 4) == 0 && memcmp(p + 8, "WEBP", 4) == 0) {
+        if (memcmp(p + 12, "VP8 ", 4) == 0) {
+            return QSize(int(le16(p + 26) & 0x3FFF), int(le16(p + 28) & 0x3FFF));
+        }
+        if (memcmp(p + 12, "VP8L", 4) == 0 && p[20] == 0x2F) {
+            const quint32 bits = le32(p + 21);
+            return QSize(int((bits & 0x3FFF) + 1), int(((bits >> 14) & 0x3FFF) + 1));
+        }
+        if (memcmp(p + 12, "VP8X", 4) == 0) {
+            return QSize(int(le24(p + 24) + 1), int(le24(p + 27) + 1));
+        }
+    }
+    return QSize();
+}
+
+ImageIngest::ImageIngest(const QString &cacheDir, const QString &ext, const QString &url)
+    : m_dir(cacheDir), m_ext(ext), m_url(url)
+{
+    // one part file per source URL so a later run finds it again
+    const QByteArray key = QCryptographicHash::hash(UrlIndex::normalize(url).toUtf8(), QCryptographicHash::Sha1).toHex();
+    m_file.setFileName(QDir(cacheDir).filePath(".ingest-" + QString::fromLatin1(key) + ".part"));
+}
+
+ImageIngest::~ImageIngest()
+{
+    // never leave an unaccounted part file behind
+    if (!m_done) abort();
+}
+
+QString ImageIngest::sidecarPath() const
+{
+    return m_file.fileName() + ".json";
+}
+
+bool ImageIngest::open()
+{
+    // resume only when the sidecar agrees with what is on disk
+    QFile side(sidecarPath());
+    if (side.open(QIODevice::ReadOnly)) {
+        const QJsonObject meta = QJsonDocument::fromJson(side.readAll()).object();
+        side.close();
+        const qint64 offset = qint64(meta.value("offset").toDouble(0));
+        if (offset > 0 && QFileInfo(m_file.fileName()).size() == offset) {
+            m_etag = meta.value("etag").toString().toLatin1();
+            m_lastModified = meta.value("last_modified").toString().toLatin1();
+            if (!validator().isEmpty() && m_file.open(QIODevice::ReadWrite)) {
+                // the hash state isn't persistable: fold the kept bytes in again
+                while (!m_file.atEnd()) {
+                    const QByteArray chunk = m_file.read(256 * 1024);
+                    if (chunk.isEmpty()) break;
+                    m_hash.addData(chunk);
+                    feedSniffer(chunk);
+                    feedBuffer(chunk);
+                    m_bytes += chunk.size();
+                }
+                if (m_bytes == offset) {
+                    m_resumeOffset = offset;
+                    qCDebug(lcPerf) << "ImageIngest: resuming" << m_url << "at" << offset;
+                    return true;
+                }
+                m_file.close();
+            }
+        }
+        resetState();
+    }
+    QFile::remove(sidecarPath());
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "ImageIngest: cannot create part file" << m_file.fileName() << m_file.errorString();
+        m_failed = true;
+        return false;
+    }
+    return true;
+}
+
+void ImageIngest::resetState()
+{
+    m_hash.reset();
+    m_head.clear();
+    m_size = QSize();
+    m_sniffing = true;
+    m_body.clear();
+    m_buffering = true;
+    m_bytes = 0;
+    m_resumeOffset = 0;
+    m_etag.clear();
+    m_lastModified.clear();
+}
+
+void ImageIngest::setValidators(const QByteArray &etag, const QByteArray &lastModified)
+{
+    m_etag = etag;
+    m_lastModified = lastModified;
+}
+
+bool ImageIngest::restart()
+{
+    if (m_failed) return false;
+    const QByteArray etag = m_etag, lastModified = m_lastModified;
+    resetState();
+    m_etag = etag;
+    m_lastModified = lastModified;
+    QFile::remove(sidecarPath());
+    if (!m_file.resize(0) || !m_file.seek(0)) {
+        qWarning() << "ImageIngest: cannot truncate" << m_file.fileName();
+        m_failed = true;
+        return false;
+    }
+    return true;
+}
+
+void ImageIngest::feedSniffer(const QByteArray &chunk)
+{
+    if (!m_sniffing) return;
+    m_head.append(chunk.left(kMaxSniffBytes - m_head.size()));
+    m_size = sniffSize(reinterpret_cast<const uchar*>(m_head.constData()), m_head.size());
+    if (!m_size.isEmpty() || m_head.size() >= kMaxSniffBytes) {
+        m_sniffing = false;
+        m_head.clear();
+    }
+}
+
+void ImageIngest::feedBuffer(const QByteArray &chunk)
+{
+    if (!m_buffering) return;
+    if (m_body.size() + chunk.size() > kMaxBufferedBytes) {
+        // too big to hold: the thumbnail reads the file instead
+        m_buffering = false;
+        m_body = QByteArray();
+        return;
+    }
+    m_body.append(chunk);
+}
+
+bool ImageIngest::append(const QByteArray &chunk)
+{
+    if (m_failed || chunk.isEmpty()) return !m_failed;
+    m_hash.addData(chunk);
+    if (m_file.write(chunk) != chunk.size()) {
+        qWarning() << "ImageIngest: write failed" << m_file.fileName() << m_file.errorString();
+        m_failed = true;
+        return false;
+    }
+    feedSniffer(chunk);
+    feedBuffer(chunk);
+    m_bytes += chunk.size();
+    return true;
+}
+
+bool ImageIngest::suspend()
+{
+    if (m_failed || m_bytes == 0 || validator().isEmpty() || !m_file.flush()) {
+        abort();
+        return false;
+    }
+    m_file.close();
+    QJsonObject meta;
+    meta.insert("url", m_url);
+    meta.insert("offset", double(m_bytes));
+    if (!m_etag.isEmpty()) meta.insert("etag", QString::fromLatin1(m_etag));
+    if (!m_lastModified.isEmpty()) meta.insert("last_modified", QString::fromLatin1(m_lastModified));
+    QSaveFile side(sidecarPath());
+    if (!side.open(QIODevice::WriteOnly)) {
+        abort();
+        return false;
+    }
+    side.write(QJsonDocument(meta).toJson(QJsonDocument::Compact));
+    if (!side.commit()) {
+        abort();
+        return false;
+    }
+    m_done = true;
+    qCDebug(lcPerf) << "ImageIngest: kept" << m_bytes << "bytes of" << m_url << "for resume";
+    return true;
+}
+
+ImageIngest::Result ImageIngest::finish()
+{
+    Result r;
+    if (m_failed || !m_file.isOpen()) return r;
+    if (!m_file.flush()) {
+        qWarning() << "ImageIngest: flush failed" << m_file.fileName();
+        return r;
+    }
+    m_file.close();
+    m_done = true;
+    QFile::remove(sidecarPath());
+    r.hash = m_hash.result().toHex();
+    r.fileName = QString::fromUtf8(r.hash) + "." + m_ext;
+    r.path = QDir(m_dir).filePath(r.fileName);
+    r.size = m_size;
+    r.data = std::move(m_body);
+    if (QFile::exists(r.path)) {
+        // same content already cached
+        QFile::remove(m_file.fileName());
+        r.existed = true;
+        r.ok = true;
+        return r;
+    }
+    if (!QFile::rename(m_file.fileName(), r.path)) {
+        qWarning() << "ImageIngest: cannot move" << m_file.fileName() << "to" << r.path;
+        QFile::remove(m_file.fileName());
+        return r;
+    }
+    r.ok = true;
+    return r;
+}
+
+void ImageIngest::abort()
+{
+    m_failed = true;
+    m_done = true;
+    m_file.close();
+    QFile::remove(m_file.fileName());
+    QFile::remove(sidecarPath());
+}
+
+int ImageIngest::purgeStale(const QString &cacheDir, int maxAgeDays)
+{
+    QDir dir(cacheDir);
+    const QDateTime cutoff = QDateTime::currentDateTimeUtc().addDays(-maxAgeDays);
+    int removed = 0;
+    const QFileInfoList parts = dir.entryInfoList(QStringList() << ".ingest-*.part", QDir::Files | QDir::Hidden);
+    for (const QFileInfo &fi : parts) {
+        if (fi.lastModified().toUTC() >= cutoff) continue;
+        QFile::remove(fi.absoluteFilePath());
+        QFile::remove(fi.absoluteFilePath() + ".json");
+        removed++;
+    }
+    return removed;
+}
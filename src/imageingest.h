@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QSize>
+#include <QString>
+
+// Single-pass ingest of one downloaded image: chunks are written to a
+// ".part" file in the cache dir while being hashed, and the dimensions are
+// sniffed from the first bytes, so the body is never re-read to name or
+// measure it. finish() moves the file to "<sha256>.<ext>". Bodies up to
+// kMaxBufferedBytes are also kept in memory and handed back in the result,
+// so the thumbnail is decoded without reading the file again; larger ones
+// are dropped from memory as soon as they pass the limit.
+//
+// The part file is named after the source URL. An interrupted download can
+// be suspended: the part stays on disk next to a sidecar recording the
+// offset and the server's validator (ETag/Last-Modified), and the next
+// ingest of the same URL resumes from there.
+class ImageIngest {
+public:
+    ImageIngest(const QString &cacheDir, const QString &ext, const QString &url);
+    ~ImageIngest();
+    ImageIngest(const ImageIngest &) = delete;
+    ImageIngest &operator=(const ImageIngest &) = delete;
+
+    // Create the part file, or reopen a suspended one (see resumeOffset)
+    bool open();
+    bool append(const QByteArray &chunk);
+    qint64 bytesWritten() const { return m_bytes; }
+    QString url() const { return m_url; }
+    // Dimensions from the header, empty until enough bytes arrived (or unknown format)
+    QSize sniffedSize() const { return m_size; }
+
+    // Bytes already on disk from a previous attempt (0 for a fresh download)
+    qint64 resumeOffset() const { return m_resumeOffset; }
+    // Value for If-Range: the ETag if known, else Last-Modified
+    QByteArray validator() const { return m_etag.isEmpty() ? m_lastModified : m_etag; }
+    void setValidators(const QByteArray &etag, const QByteArray &lastModified);
+    // The server sent the whole body (ignored the range): discard what we had
+    bool restart();
+    // Keep the part file and its sidecar for a later resume; false if there
+    // is nothing worth keeping (no bytes or no validator)
+    bool suspend();
+
+    struct Result {
+        bool ok = false;
+        bool existed = false;   // identical content was already cached
+        QString path;
+        QString fileName;
+        QByteArray hash;        // hex sha256
+        QSize size;
+        QByteArray data;        // the whole body, unless over kMaxBufferedBytes
+    };
+    Result finish();
+    // Drop the part file and sidecar
+    void abort();
+
+    // Width/height from a PNG, JPEG, GIF, BMP or WebP header; empty if the
+    // bytes are insufficient or the format is unknown
+    static QSize sniffSize(const uchar *data, qint64 len);
+    // Remove suspended downloads not touched for maxAgeDays
+    static int purgeStale(const QString &cacheDir, int maxAgeDays);
+
+    // Bytes of header kept for sniffing before giving up (large EXIF blocks)
+    static constexpr int kMaxSniffBytes = 64 * 1024;
+    // Largest body kept in memory for the thumbnail decode
+    static constexpr qint64 kMaxBufferedBytes = 32 * 1024 * 1024;
+
+private:
+    QString sidecarPath() const;
+    void feedSniffer(const QByteArray &chunk);
+    void feedBuffer(const QByteArray &chunk);
+    void resetState();
+
+    QString m_dir;
+    QString m_ext;
+    QString m_url;
+    QFile m_file;
+    QCryptographicHash m_hash{QCryptographicHash::Sha256};
+    QByteArray m_head;
+    QSize m_size;
+    bool m_sniffing = true;
+    QByteArray m_body;
+    bool m_buffering = true;
+    qint64 m_bytes = 0;
+    qint64 m_resumeOffset = 0;
+    QByteArray m_etag;
+    QByteArray m_lastModified;
+    bool m_failed = false;
+    bool m_done = false;     // finished, suspended or aborted
+};
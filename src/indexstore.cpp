@@ -0,0 +1,575 @@
+#include "indexstore.h"
+#include "binaryindex.h"
+#include "imagefilter.h"
+#include "metadatabackend.h"
+#include "metadatatable.h"
+#include "perflog.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThreadPool>
+#include <QTimer>
+#include <QRandomGenerator>
+#include <QVector>
+#include <algorithm>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include <unistd.h>
+
+QByteArray IndexMutation::toJournalRecord() const
+{
+    QJsonObject rec;
+    switch (op) {
+    case Set: rec.insert("op", "set"); break;
+    case SetIfMissing: rec.insert("op", "set_if_missing"); break;
+    case Remove: rec.insert("op", "remove"); break;
+    }
+    rec.insert("key", key);
+    if (!fields.isEmpty()) rec.insert("fields", fields);
+    return QJsonDocument(rec).toJson(QJsonDocument::Compact) + '\n';
+}
+
+bool IndexMutation::fromJournalRecord(const QByteArray &line, IndexMutation &out)
+{
+    QJsonDocument doc = QJsonDocument::fromJson(line);
+    if (!doc.isObject()) return false;
+    QJsonObject rec = doc.object();
+    QString op = rec.value("op").toString();
+    if (op == "set") out.op = Set;
+    else if (op == "set_if_missing") out.op = SetIfMissing;
+    else if (op == "remove") out.op = Remove;
+    else return false;
+    out.key = rec.value("key").toString();
+    out.fields = rec.value("fields").toObject();
+    return !out.key.isEmpty();
+}
+
+IndexStore *IndexStore::forCacheDir(const QString &cacheDir)
+{
+    static QMutex registryMutex;
+    static QHash<QString, IndexStore*> registry;
+
+    QString dirPath = QDir(cacheDir).absolutePath();
+    QMutexLocker lock(&registryMutex);
+    IndexStore *store = registry.value(dirPath, nullptr);
+    if (store) return store;
+
+    store = new IndexStore(dirPath);
+    // the first caller may be a pool thread; keep the store on the main thread
+    if (QCoreApplication::instance()) {
+        store->moveToThread(QCoreApplication::instance()->thread());
+        QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, store, [store]() {
+            store->flushNow();
+        });
+    }
+    registry.insert(dirPath, store);
+    return store;
+}
+
+IndexStore::IndexStore(const QString &cacheDir)
+    : QObject(nullptr), m_cacheDir(cacheDir)
+{
+    load();
+    if (openJournal()) m_journalBytes = m_journal.size();
+}
+
+IndexStore::~IndexStore() = default;
+
+QString IndexStore::indexPath() const
+{
+    return QDir(m_cacheDir).filePath("index.json");
+}
+
+QString IndexStore::binaryIndexPath() const
+{
+    return QDir(m_cacheDir).filePath("index.bin");
+}
+
+QString IndexStore::journalPath() const
+{
+    return QDir(m_cacheDir).filePath("index.journal");
+}
+
+QString IndexStore::compactingJournalPath() const
+{
+    return QDir(m_cacheDir).filePath("index.journal.compacting");
+}
+
+void IndexStore::load()
+{
+    QElapsedTimer timer; timer.start();
+    // index.json stays the source of truth; index.bin is only used while it
+    // still describes exactly that file
+    QFileInfo jsonInfo(indexPath());
+    BinaryIndex bin;
+    bool fromBinary = jsonInfo.exists() && bin.open(binaryIndexPath())
+        && bin.sourceSize() == jsonInfo.size()
+        && bin.sourceMtimeMs() == jsonInfo.lastModified().toMSecsSinceEpoch();
+    if (fromBinary) {
+        m_table = MetadataTable::fromBinary(bin);
+    } else {
+        QJsonObject root;
+        QFile f(indexPath());
+        if (f.open(QIODevice::ReadOnly)) {
+            QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
+            if (doc.isObject()) root = doc.object();
+            f.close();
+        }
+        // the parsed JSON is dropped here; the table is the only copy kept
+        m_table = MetadataTable::fromJson(root);
+    }
+    // a journal left by an interrupted compaction is older than the live one
+    int replayed = replayJournal(compactingJournalPath());
+    replayed += replayJournal(journalPath());
+    qCDebug(lcPerf) << "IndexStore: loaded" << m_table->rowCount() << "entries from"
+                    << (fromBinary ? binaryIndexPath() : indexPath())
+                    << "replayed=" << replayed << "ms=" << timer.elapsed();
+}
+
+int IndexStore::replayJournal(const QString &path)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return 0;
+    int count = 0;
+    while (!f.atEnd()) {
+        QByteArray line = f.readLine().trimmed();
+        if (line.isEmpty()) continue;
+        IndexMutation m;
+        // a torn final record (crash mid-append) is simply skipped
+        if (!IndexMutation::fromJournalRecord(line, m)) {
+            qWarning() << "IndexStore: skipping unreadable journal record in" << path;
+            continue;
+        }
+        applyLocked(m);
+        count++;
+    }
+    return count;
+}
+
+bool IndexStore::openJournal()
+{
+    m_journal.setFileName(journalPath());
+    if (!m_journal.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "IndexStore: failed to open journal" << journalPath();
+        return false;
+    }
+    return true;
+}
+
+QJsonObject IndexStore::entry(const QString &key) const
+{
+    QMutexLocker lock(&m_mutex);
+    const int row = m_table->find(key);
+    return row >= 0 ? m_table->entryJson(row) : QJsonObject();
+}
+
+bool IndexStore::contains(const QString &key) const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_table->find(key) >= 0;
+}
+
+std::shared_ptr<const MetadataTable> IndexStore::table() const
+{
+    // fast path: the published snapshot is current, no lock and no rebuild
+    std::shared_ptr<const MetadataTable> t = std::atomic_load(&m_published);
+    if (t && t->version() == m_generation.load(std::memory_order_acquire)) return t;
+    QMutexLocker lock(&m_mutex);
+    return publishLocked();
+}
+
+quint64 IndexStore::version() const
+{
+    return m_generation.load(std::memory_order_acquire);
+}
+
+MetadataTable &IndexStore::writableTableLocked()
+{
+    if (m_tableShared) {
+        // shallow: each column is copied when it is first written
+        m_table = std::make_shared<MetadataTable>(*m_table);
+        m_tableShared = false;
+    }
+    return *m_table;
+}
+
+std::shared_ptr<const MetadataTable> IndexStore::publishLocked() const
+{
+    std::shared_ptr<const MetadataTable> current = std::atomic_load(&m_published);
+    const quint64 generation = m_generation.load(std::memory_order_relaxed);
+    if (current && current->version() == generation) return current;
+    // the working table already holds every mutation: stamp it and hand it
+    // out. A table already shared (with a compaction) was stamped when it
+    // was handed over and has not changed since, so it is not written to.
+    if (!m_tableShared) m_table->setVersion(generation);
+    m_tableShared = true;
+    std::atomic_store(&m_published, std::shared_ptr<const MetadataTable>(m_table));
+    return m_table;
+}
+
+void IndexStore::apply(const IndexMutation &m)
+{
+    if (m.key.isEmpty()) return;
+    {
+        QMutexLocker lock(&m_mutex);
+        commitLocked(m);
+    }
+    maybeCompact();
+}
+
+bool IndexStore::commitLocked(const IndexMutation &m)
+{
+    if (!applyLocked(m)) return false;
+    // coalesce change notifications into one queued emission on the store's thread
+    m_changedKeys.insert(m.key);
+    if (!m_notifyPending) {
+        m_notifyPending = true;
+        QMetaObject::invokeMethod(this, &IndexStore::emitEntriesChanged, Qt::QueuedConnection);
+    }
+    // group commit: the record waits in memory for the next journal sync,
+    // which writes and fsyncs the whole burst off the data lock
+    const QByteArray record = m.toJournalRecord();
+    m_pendingJournal += record;
+    m_journalBytes += record.size();
+    if (!m_journalSyncQueued) {
+        m_journalSyncQueued = true;
+        QMetaObject::invokeMethod(this, [this]() {
+            QTimer::singleShot(kJournalSyncMs, this, [this]() {
+                QThreadPool::globalInstance()->start([this]() { syncJournal(); });
+            });
+        }, Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void IndexStore::syncJournal()
+{
+    QMutexLocker journalLock(&m_journalMutex);
+    QByteArray records;
+    {
+        QMutexLocker lock(&m_mutex);
+        records.swap(m_pendingJournal);
+        m_journalSyncQueued = false;
+    }
+    if (records.isEmpty() || !m_journal.isOpen()) return;
+    if (m_journal.write(records) != records.size() || !m_journal.flush()) {
+        qWarning() << "IndexStore: failed to append to" << journalPath();
+    }
+    ::fsync(m_journal.handle());
+}
+
+bool IndexStore::applyLocked(const IndexMutation &m)
+{
+    const int row = m_table->find(m.key);
+    if (m.op == IndexMutation::Remove) {
+        if (row < 0) return false;
+        writableTableLocked().removeEntry(m.key);
+        ++m_generation;
+        if (m_backend) m_backend->entryRemoved(m.key);
+        return true;
+    }
+    QJsonObject entry = row >= 0 ? m_table->entryJson(row) : QJsonObject();
+    bool changed = row < 0;
+    for (auto it = m.fields.constBegin(); it != m.fields.constEnd(); ++it) {
+        if (m.op == IndexMutation::SetIfMissing && entry.contains(it.key())) continue;
+        if (entry.value(it.key()) == it.value()) continue;
+        entry.insert(it.key(), it.value());
+        changed = true;
+    }
+    if (!changed) return false;
+    writableTableLocked().setEntry(m.key, entry);
+    ++m_generation;
+    if (m_backend) m_backend->entryChanged(m.key, entry);
+    return true;
+}
+
+void IndexStore::emitEntriesChanged()
+{
+    QStringList keys;
+    {
+        QMutexLocker lock(&m_mutex);
+        keys = QStringList(m_changedKeys.cbegin(), m_changedKeys.cend());
+        m_changedKeys.clear();
+        m_notifyPending = false;
+        // publish one snapshot for the whole burst so listeners read it lock-free
+        publishLocked();
+    }
+    if (!keys.isEmpty()) emit entriesChanged(keys);
+}
+
+void IndexStore::setSize(const QString &key, const QSize &size)
+{
+    if (size.isEmpty()) return;
+    IndexMutation m;
+    m.key = key;
+    m.fields.insert("width", size.width());
+    m.fields.insert("height", size.height());
+    apply(m);
+}
+
+void IndexStore::setThumbnail(const QString &key, const QString &thumbName)
+{
+    if (thumbName.isEmpty()) return;
+    IndexMutation m;
+    m.key = key;
+    m.fields.insert("thumbnail", thumbName);
+    apply(m);
+}
+
+void IndexStore::setSubredditIfMissing(const QString &key, const QString &subreddit)
+{
+    if (subreddit.isEmpty()) return;
+    // an empty string counts as missing, so this can't be a plain SetIfMissing
+    QMutexLocker lock(&m_mutex);
+    const int row = m_table->find(key);
+    if (row >= 0 && !m_table->subreddit(row).isEmpty()) return;
+    IndexMutation m;
+    m.key = key;
+    m.fields.insert("subreddit", subreddit);
+    commitLocked(m);
+    lock.unlock();
+    maybeCompact();
+}
+
+void IndexStore::setFavorite(const QString &key, bool favorite)
+{
+    IndexMutation m;
+    m.key = key;
+    m.fields.insert("favorite", favorite);
+    apply(m);
+    syncJournal();
+}
+
+bool IndexStore::toggleFavorite(const QString &key)
+{
+    QMutexLocker lock(&m_mutex);
+    const int row = m_table->find(key);
+    bool fav = !(row >= 0 && m_table->favorite(row));
+    IndexMutation m;
+    m.key = key;
+    m.fields.insert("favorite", fav);
+    commitLocked(m);
+    lock.unlock();
+    maybeCompact();
+    syncJournal();
+    return fav;
+}
+
+void IndexStore::setBanned(const QString &key, bool banned)
+{
+    IndexMutation m;
+    m.key = key;
+    m.fields.insert("banned", banned);
+    apply(m);
+    syncJournal();
+}
+
+void IndexStore::markDownloaded(const QString &key, const QDateTime &when)
+{
+    IndexMutation stamp;
+    stamp.key = key;
+    stamp.fields.insert("downloaded_at", when.toUTC().toString(Qt::ISODate));
+    IndexMutation defaults;
+    defaults.op = IndexMutation::SetIfMissing;
+    defaults.key = key;
+    defaults.fields.insert("favorite", false);
+    defaults.fields.insert("banned", false);
+    {
+        QMutexLocker lock(&m_mutex);
+        commitLocked(stamp);
+        commitLocked(defaults);
+    }
+    maybeCompact();
+}
+
+void IndexStore::remove(const QString &key)
+{
+    IndexMutation m;
+    m.op = IndexMutation::Remove;
+    m.key = key;
+    apply(m);
+}
+
+void IndexStore::maybeCompact()
+{
+    qint64 size;
+    {
+        QMutexLocker lock(&m_mutex);
+        size = m_journalBytes;
+    }
+    if (size >= kCompactThresholdBytes) compact(false);
+}
+
+void IndexStore::setBackend(std::unique_ptr<MetadataBackend> backend)
+{
+    QMutexLocker lock(&m_mutex);
+    m_backend = std::move(backend);
+    if (m_backend) m_backend->importIfNeeded(*m_table);
+}
+
+bool IndexStore::hasBackend() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_backend != nullptr;
+}
+
+QStringList IndexStore::query(const ImageFilter &filter) const
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_backend) return m_backend->query(filter);
+
+    // scan the columnar table; subreddit acceptance is resolved once per ID
+    const std::shared_ptr<const MetadataTable> t = publishLocked();
+    QVector<char> subAccepted(t->subreddits().size() + 1);
+    for (int i = 0; i < t->subreddits().size(); ++i) {
+        subAccepted[i] = filter.acceptsMetadata(t->subreddits().at(i), true, false);
+    }
+    subAccepted[t->subreddits().size()] = filter.acceptsMetadata(QString(), true, false);
+
+    struct Hit { int row; qint64 downloadedAt; };
+    QVector<Hit> hits;
+    for (int row = 0; row < t->rowCount(); ++row) {
+        if (t->banned(row)) continue;
+        if (filter.favoritesOnly && !t->favorite(row)) continue;
+        const quint16 sub = t->subredditId(row);
+        if (!subAccepted[sub == MetadataTable::kNoSubreddit ? t->subreddits().size() : sub]) continue;
+        if (!filter.acceptsSize(t->imageSize(row))) continue;
+        hits.append({ row, t->downloadedAtMs(row) });
+    }
+    std::stable_sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b) {
+        return a.downloadedAt > b.downloadedAt;
+    });
+    QStringList out;
+    out.reserve(hits.size());
+    for (const Hit &h : hits) out << t->key(h.row);
+    return out;
+}
+
+QString IndexStore::randomKey(const ImageFilter &filter) const
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        if (m_backend) return m_backend->randomKey(filter);
+    }
+    QStringList keys = query(filter);
+    if (keys.isEmpty()) return QString();
+    return keys.at(QRandomGenerator::global()->bounded(keys.size()));
+}
+
+bool IndexStore::flushNow()
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        if (m_backend) m_backend->sync();
+    }
+    compact(true);
+    return !QFile::exists(compactingJournalPath());
+}
+
+void IndexStore::compact(bool synchronous)
+{
+    // only one compaction at a time. A background request while one runs is
+    // dropped (the journal stays over the threshold, so the next mutation asks
+    // again); shutdown waits for the running one.
+    {
+        QMutexLocker lock(&m_compactMutex);
+        if (m_compacting && !synchronous) return;
+        while (m_compacting) m_compactDone.wait(&m_compactMutex);
+        m_compacting = true;
+    }
+    std::shared_ptr<const MetadataTable> table;
+    quint64 generation;
+    {
+        // the journal is rotated under m_journalMutex alone; the data lock is
+        // only taken to pick up queued records and to freeze the table
+        QMutexLocker journalLock(&m_journalMutex);
+        QByteArray records;
+        {
+            QMutexLocker lock(&m_mutex);
+            records.swap(m_pendingJournal);
+        }
+        if (!records.isEmpty() && m_journal.isOpen()) m_journal.write(records);
+        const QString pending = compactingJournalPath();
+        if (m_journal.size() == 0 && !QFile::exists(pending)) {
+            finishCompaction();
+            return;
+        }
+        // rotate the live journal out of the way. Every record in it was
+        // applied before it was queued, so the table frozen below covers them;
+        // records queued from now on go to the new journal.
+        m_journal.flush();
+        ::fsync(m_journal.handle());
+        m_journal.close();
+        if (QFile::exists(pending)) {
+            // a previous compaction failed: keep its records and add ours
+            QFile in(journalPath());
+            QFile out(pending);
+            if (in.open(QIODevice::ReadOnly) && out.open(QIODevice::WriteOnly | QIODevice::Append)) {
+                out.write(in.readAll());
+                out.flush();
+                ::fsync(out.handle());
+            }
+            in.close();
+            out.close();
+            QFile::remove(journalPath());
+        } else {
+            QFile::rename(journalPath(), pending);
+        }
+        openJournal();
+        // the JSON is built from a frozen table off the lock; later mutations
+        // edit a copy
+        QMutexLocker lock(&m_mutex);
+        m_journalBytes = m_pendingJournal.size();
+        generation = m_generation.load(std::memory_order_relaxed);
+        // stamped before it is shared: nothing writes to it from now on
+        m_table->setVersion(generation);
+        table = m_table;
+        m_tableShared = true;
+    }
+    auto job = [this, table, generation]() {
+        if (writeSnapshot(*table, generation)) QFile::remove(compactingJournalPath());
+        finishCompaction();
+    };
+    if (synchronous) job();
+    else QThreadPool::globalInstance()->start(job);
+}
+
+void IndexStore::finishCompaction()
+{
+    QMutexLocker lock(&m_compactMutex);
+    m_compacting = false;
+    m_compactDone.wakeAll();
+}
+
+bool IndexStore::writeSnapshot(const MetadataTable &table, quint64 generation)
+{
+    QMutexLocker lock(&m_writeMutex);
+    // a newer snapshot has already been committed (or nothing changed)
+    if (generation <= m_writtenGeneration) return true;
+    QElapsedTimer timer; timer.start();
+    QSaveFile sf(indexPath());
+    if (!sf.open(QIODevice::WriteOnly)) {
+        qWarning() << "IndexStore: failed to open" << indexPath();
+        return false;
+    }
+    sf.write(QJsonDocument(table.toJson()).toJson(QJsonDocument::Indented));
+    if (!sf.commit()) {
+        qWarning() << "IndexStore: failed to write" << indexPath();
+        return false;
+    }
+    m_writtenGeneration = generation;
+    // refresh the mapped mirror so the next cold start skips the JSON parse
+    QFileInfo jsonInfo(indexPath());
+    if (!BinaryIndex::write(binaryIndexPath(), table, jsonInfo.size(), jsonInfo.lastModified().toMSecsSinceEpoch())) {
+        qWarning() << "IndexStore: failed to write" << binaryIndexPath();
+    }
+    qCDebug(lcPerf) << "IndexStore: wrote" << table.rowCount() << "entries ms=" << timer.elapsed();
+    return true;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <QObject>
+#include <QJsonObject>
+#include <QFile>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QWaitCondition>
+#include <QSize>
+#include <QDateTime>
+#include <atomic>
+#include <memory>
+
+class MetadataBackend;
+class MetadataTable;
+struct ImageFilter;
+
+// A single change to one index.json entry (also the journal record format)
+struct IndexMutation {
+    enum Op {
+        Set = 0,          // merge `fields` into the entry
+        SetIfMissing = 1, // merge only the fields the entry doesn't have yet
+        Remove = 2        // drop the entry
+    };
+    Op op = Set;
+    QString key;
+    QJsonObject fields;
+
+    // One-line journal representation
+    QByteArray toJournalRecord() const;
+    static bool fromJournalRecord(const QByteArray &line, IndexMutation &out);
+};
+
+// IndexStore owns the metadata of one cache directory (index.json).
+// It keeps the authoritative copy in memory as a MetadataTable (the parsed
+// JSON is not kept); mutations may come from any thread. Mutations are
+// group-committed to index.journal next to the snapshot: a burst is written
+// and fsync'd once, kJournalSyncMs after its first record, outside the data
+// lock (favorite and ban edits are synced before they return). Once the
+// journal grows past kCompactThresholdBytes it is folded back into
+// index.json in the background.
+class IndexStore : public QObject {
+    Q_OBJECT
+public:
+    // Return the process-wide store for cacheDir, loading index.json on first use
+    static IndexStore *forCacheDir(const QString &cacheDir);
+
+    QString cacheDir() const { return m_cacheDir; }
+    QString indexPath() const;
+
+    // One entry in index.json form (built from the table)
+    QJsonObject entry(const QString &key) const;
+    bool contains(const QString &key) const;
+    // Current immutable snapshot of the index in columnar form. Writers publish
+    // a new version once per burst of mutations; readers take the pointer
+    // without locking and may keep it as long as they like.
+    std::shared_ptr<const MetadataTable> table() const;
+    // Version of the latest mutation; equals table()->version() once published
+    quint64 version() const;
+
+    // Typed mutations (thread-safe)
+    void apply(const IndexMutation &m);
+    void setSize(const QString &key, const QSize &size);
+    void setThumbnail(const QString &key, const QString &thumbName);
+    void setSubredditIfMissing(const QString &key, const QString &subreddit);
+    void setFavorite(const QString &key, bool favorite);
+    // Flip the favorite flag and return the new value
+    bool toggleFavorite(const QString &key);
+    void setBanned(const QString &key, bool banned);
+    // Stamp downloaded_at and default the favorite/banned flags
+    void markDownloaded(const QString &key, const QDateTime &when);
+    void remove(const QString &key);
+
+    // Attach a query backend (e.g. SQLite); it is brought up to date first.
+    // Must be called on the main thread.
+    void setBackend(std::unique_ptr<MetadataBackend> backend);
+    bool hasBackend() const;
+    // Keys accepted by the filter, newest first. Uses the backend when one is
+    // attached, otherwise scans the in-memory index.
+    QStringList query(const ImageFilter &filter) const;
+    // Random accepted key, or an empty string
+    QString randomKey(const ImageFilter &filter) const;
+
+    // Fold the journal into index.json synchronously (used on shutdown)
+    bool flushNow();
+
+    // Journal size that triggers a background compaction
+    static constexpr qint64 kCompactThresholdBytes = 256 * 1024;
+    // Delay from the first queued journal record to the write + fsync
+    static constexpr int kJournalSyncMs = 250;
+
+signals:
+    // Keys whose entry changed or was removed; coalesced and delivered on the
+    // store's (main) thread
+    void entriesChanged(const QStringList &keys);
+
+private:
+    explicit IndexStore(const QString &cacheDir);
+    ~IndexStore() override;
+    QString binaryIndexPath() const;
+    QString journalPath() const;
+    QString compactingJournalPath() const;
+    void load();
+    int replayJournal(const QString &path);
+    bool openJournal();
+    // apply + queue the journal record; caller holds m_mutex. Returns false
+    // if nothing changed.
+    bool commitLocked(const IndexMutation &m);
+    // write and fsync the queued journal records; takes m_journalMutex, then
+    // m_mutex only to take the records
+    void syncJournal();
+    bool applyLocked(const IndexMutation &m);
+    void maybeCompact();
+    void compact(bool synchronous);
+    void finishCompaction();
+    bool writeSnapshot(const MetadataTable &table, quint64 generation);
+    // the working table, copied first if readers have been given it
+    MetadataTable &writableTableLocked();
+    // publish the working table for the current generation if needed
+    std::shared_ptr<const MetadataTable> publishLocked() const;
+    void emitEntriesChanged();
+
+    QString m_cacheDir;
+    mutable QMutex m_mutex;
+    std::atomic<quint64> m_generation{0}; // bumped on every mutation (under m_mutex)
+    // the journal file, guarded by m_journalMutex (taken before m_mutex)
+    QMutex m_journalMutex;
+    QFile m_journal;
+    // records not yet written, and the journal size including them (m_mutex)
+    QByteArray m_pendingJournal;
+    qint64 m_journalBytes = 0;
+    bool m_journalSyncQueued = false;
+    std::unique_ptr<MetadataBackend> m_backend;
+    // the index itself, edited per mutation; once published (or handed to a
+    // compaction) it is shared and the next mutation edits a copy
+    std::shared_ptr<MetadataTable> m_table;
+    mutable bool m_tableShared = false;
+    // accessed with std::atomic_load/atomic_store only
+    mutable std::shared_ptr<const MetadataTable> m_published;
+    // one compaction at a time; synchronous callers wait for a running one
+    QMutex m_compactMutex;
+    QWaitCondition m_compactDone;
+    bool m_compacting = false;
+    QSet<QString> m_changedKeys;
+    bool m_notifyPending = false;
+    // serializes writers and drops snapshots older than the last one committed
+    QMutex m_writeMutex;
+    quint64 m_writtenGeneration = 0;
+};
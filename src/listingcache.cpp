@@ -0,0 +1,176 @@
+#include "listingcache.h"
+#include "perflog.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+
+ListingCache *ListingCache::instance()
+{
+    static ListingCache *cache = new ListingCache(defaultDir());
+    return cache;
+}
+
+QString ListingCache::defaultDir()
+{
+    QString configDir = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/wallaroo";
+    return configDir + "/listings";
+}
+
+const char *ListingCache::outcomeName(Outcome o)
+{
+    switch (o) {
+    case Fresh: return "fresh";
+    case NotModified: return "not-modified";
+    case Stale: return "stale";
+    case Failed: break;
+    }
+    return "failed";
+}
+
+ListingCache::ListingCache(const QString &dir)
+    : m_dir(dir)
+{
+    load();
+}
+
+QString ListingCache::bodyPath(const QString &url) const
+{
+    const QByteArray key = QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return m_dir + "/" + QString::fromLatin1(key) + ".json";
+}
+
+QByteArray ListingCache::readBody(const QString &url) const
+{
+    QFile f(bodyPath(url));
+    if (!f.open(QIODevice::ReadOnly)) return QByteArray();
+    return f.readAll();
+}
+
+void ListingCache::load()
+{
+    QFile f(m_dir + "/index.json");
+    if (!f.open(QIODevice::ReadOnly)) return;
+    const QJsonObject root = QJsonDocument::fromJson(f.readAll()).object();
+    for (auto it = root.constBegin(); it != root.constEnd(); ++it) {
+        const QJsonObject obj = it.value().toObject();
+        Entry e;
+        e.etag = obj.value("etag").toString().toLatin1();
+        e.lastModified = obj.value("last_modified").toString().toLatin1();
+        e.bodyHash = obj.value("body_sha1").toString().toLatin1();
+        e.fetchedAtMs = qint64(obj.value("fetched_at").toDouble());
+        e.complete = obj.value("complete").toBool();
+        m_entries.insert(it.key(), e);
+    }
+    qCDebug(lcPerf) << "ListingCache: loaded" << m_entries.size() << "listings from" << m_dir;
+}
+
+bool ListingCache::saveLocked()
+{
+    QJsonObject root;
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        QJsonObject obj;
+        if (!it->etag.isEmpty()) obj.insert("etag", QString::fromLatin1(it->etag));
+        if (!it->lastModified.isEmpty()) obj.insert("last_modified", QString::fromLatin1(it->lastModified));
+        obj.insert("body_sha1", QString::fromLatin1(it->bodyHash));
+        obj.insert("fetched_at", double(it->fetchedAtMs));
+        obj.insert("complete", it->complete);
+        root.insert(it.key(), obj);
+    }
+    QDir().mkpath(m_dir);
+    QSaveFile sf(m_dir + "/index.json");
+    if (!sf.open(QIODevice::WriteOnly)) {
+        qWarning() << "ListingCache: failed to write" << sf.fileName();
+        return false;
+    }
+    sf.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+    return sf.commit();
+}
+
+void ListingCache::prepare(QNetworkRequest &req) const
+{
+    QMutexLocker lock(&m_mutex);
+    auto it = m_entries.constFind(req.url().toString());
+    if (it == m_entries.constEnd()) return;
+    if (!it->etag.isEmpty()) req.setRawHeader("If-None-Match", it->etag);
+    if (!it->lastModified.isEmpty()) req.setRawHeader("If-Modified-Since", it->lastModified);
+}
+
+ListingCache::Result ListingCache::resolve(QNetworkReply *reply)
+{
+    // keyed by what we asked for, not where redirects ended up
+    const QString url = reply->request().url().toString();
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    Result r;
+
+    QMutexLocker lock(&m_mutex);
+    auto it = m_entries.find(url);
+    const bool known = it != m_entries.end();
+
+    if (status == 304 && known) {
+        r.body = readBody(url);
+        if (!r.body.isEmpty()) {
+            r.outcome = NotModified;
+            r.complete = it->complete;
+            it->fetchedAtMs = QDateTime::currentMSecsSinceEpoch();
+            return r;
+        }
+        // body vanished from disk; the caller refetches unconditionally next time
+        m_entries.erase(it);
+        saveLocked();
+        return r;
+    }
+
+    if (reply->error() != QNetworkReply::NoError) {
+        // offline or server trouble: serve what we have
+        if (known && (status == 0 || status >= 500)) {
+            r.body = readBody(url);
+            if (!r.body.isEmpty()) {
+                r.outcome = Stale;
+                r.complete = it->complete;
+            }
+        }
+        return r;
+    }
+
+    r.body = reply->readAll();
+    const QByteArray hash = QCryptographicHash::hash(r.body, QCryptographicHash::Sha1).toHex();
+    Entry e = known ? *it : Entry();
+    // servers without validators still let us skip work on identical bodies
+    r.outcome = (known && e.bodyHash == hash) ? NotModified : Fresh;
+    r.complete = r.outcome == NotModified && e.complete;
+    e.etag = reply->rawHeader("ETag");
+    e.lastModified = reply->rawHeader("Last-Modified");
+    e.fetchedAtMs = QDateTime::currentMSecsSinceEpoch();
+    if (r.outcome == Fresh) {
+        QDir().mkpath(m_dir);
+        QSaveFile sf(bodyPath(url));
+        if (!sf.open(QIODevice::WriteOnly) || sf.write(r.body) != r.body.size() || !sf.commit()) {
+            qWarning() << "ListingCache: failed to store body for" << url;
+            return r;
+        }
+        e.bodyHash = hash;
+        e.complete = false;
+    }
+    m_entries.insert(url, e);
+    saveLocked();
+    return r;
+}
+
+void ListingCache::setComplete(const QString &url, bool complete)
+{
+    QMutexLocker lock(&m_mutex);
+    auto it = m_entries.find(url);
+    if (it == m_entries.end() || it->complete == complete) return;
+    it->complete = complete;
+    saveLocked();
+}
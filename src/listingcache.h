@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+class QNetworkReply;
+class QNetworkRequest;
+
+// Persistent HTTP cache for subreddit listing responses (listings/ in the
+// config dir). Requests are sent conditionally with the stored ETag /
+// Last-Modified, so an unchanged listing costs a 304 with no body. When the
+// network is unreachable the last stored body is served instead.
+//
+// Layout: listings/index.json holds the validators per request URL, each body
+// is kept as listings/<sha1(url)>.json.
+class ListingCache {
+public:
+    static ListingCache *instance();
+    static QString defaultDir();
+
+    enum Outcome {
+        Fresh,       // new body from the server
+        NotModified, // 304, or a 200 whose body matches the stored one
+        Stale,       // network failure; stored body served
+        Failed       // nothing usable
+    };
+    struct Result {
+        Outcome outcome = Failed;
+        QByteArray body;
+        // false if an earlier scan of this listing left downloads unfinished
+        bool complete = false;
+    };
+
+    // Add If-None-Match / If-Modified-Since for a stored listing
+    void prepare(QNetworkRequest &req) const;
+    // Classify a finished listing reply, storing a fresh body
+    Result resolve(QNetworkReply *reply);
+    // Record whether every image of the listing ended up in the cache; an
+    // unchanged listing is only skipped entirely once this was true
+    void setComplete(const QString &url, bool complete);
+
+    static const char *outcomeName(Outcome o);
+
+private:
+    explicit ListingCache(const QString &dir);
+    void load();
+    bool saveLocked();
+    QString bodyPath(const QString &url) const;
+    QByteArray readBody(const QString &url) const;
+
+    struct Entry {
+        QByteArray etag;
+        QByteArray lastModified;
+        QByteArray bodyHash;
+        qint64 fetchedAtMs = 0;
+        bool complete = false;
+    };
+    QString m_dir;
+    mutable QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+};
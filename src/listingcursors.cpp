@@ -0,0 +1,93 @@
+#include "listingcursors.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+
+ListingCursors *ListingCursors::instance()
+{
+    static ListingCursors *cursors = new ListingCursors(defaultPath());
+    return cursors;
+}
+
+QString ListingCursors::defaultPath()
+{
+    QString configDir = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/wallaroo";
+    return configDir + "/cursors.json";
+}
+
+ListingCursors::ListingCursors(const QString &path)
+    : m_path(path)
+{
+    load();
+}
+
+void ListingCursors::load()
+{
+    QFile f(m_path);
+    if (!f.open(QIODevice::ReadOnly)) return;
+    const QJsonObject root = QJsonDocument::fromJson(f.readAll()).object();
+    for (auto it = root.constBegin(); it != root.constEnd(); ++it) {
+        const QJsonObject obj = it.value().toObject();
+        Cursor c;
+        c.newest = obj.value("newest").toString();
+        c.newestUtc = obj.value("newest_utc").toDouble();
+        c.oldest = obj.value("oldest").toString();
+        c.oldestUtc = obj.value("oldest_utc").toDouble();
+        if (!c.isNull()) m_cursors.insert(it.key().toLower(), c);
+    }
+}
+
+ListingCursors::Cursor ListingCursors::cursor(const QString &subreddit) const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_cursors.value(subreddit.toLower());
+}
+
+void ListingCursors::extend(const QString &subreddit, const Cursor &seen)
+{
+    if (seen.isNull()) return;
+    QMutexLocker lock(&m_mutex);
+    Cursor &c = m_cursors[subreddit.toLower()];
+    bool changed = false;
+    if (c.isNull() || seen.newestUtc > c.newestUtc) {
+        c.newest = seen.newest;
+        c.newestUtc = seen.newestUtc;
+        changed = true;
+    }
+    if (!seen.oldest.isEmpty() && (c.oldest.isEmpty() || seen.oldestUtc < c.oldestUtc)) {
+        c.oldest = seen.oldest;
+        c.oldestUtc = seen.oldestUtc;
+        changed = true;
+    }
+    if (changed) saveLocked();
+}
+
+bool ListingCursors::saveLocked()
+{
+    QJsonObject root;
+    for (auto it = m_cursors.constBegin(); it != m_cursors.constEnd(); ++it) {
+        QJsonObject obj;
+        obj.insert("newest", it->newest);
+        obj.insert("newest_utc", it->newestUtc);
+        if (!it->oldest.isEmpty()) {
+            obj.insert("oldest", it->oldest);
+            obj.insert("oldest_utc", it->oldestUtc);
+        }
+        root.insert(it.key(), obj);
+    }
+    QDir().mkpath(QFileInfo(m_path).absolutePath());
+    QSaveFile sf(m_path);
+    if (!sf.open(QIODevice::WriteOnly)) {
+        qWarning() << "ListingCursors: failed to write" << m_path;
+        return false;
+    }
+    sf.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+    return sf.commit();
+}
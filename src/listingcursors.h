@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+// Per-subreddit listing position (cursors.json in the config dir): the
+// newest post a completed scan has processed, so the next scan stops there,
+// and the oldest one, where a backfill continues into older history.
+//
+// File format: { "<subreddit>": { "newest": "t3_..", "newest_utc": 0,
+//                                 "oldest": "t3_..", "oldest_utc": 0 } }
+class ListingCursors {
+public:
+    static ListingCursors *instance();
+    static QString defaultPath();
+
+    struct Cursor {
+        QString newest;        // fullname ("t3_<id>") of the newest processed post
+        double newestUtc = 0;  // its created_utc
+        QString oldest;        // fullname of the oldest processed post
+        double oldestUtc = 0;
+        bool isNull() const { return newest.isEmpty(); }
+    };
+
+    Cursor cursor(const QString &subreddit) const;
+    // Widen the processed range to include [oldest, newest] and save
+    void extend(const QString &subreddit, const Cursor &seen);
+
+private:
+    explicit ListingCursors(const QString &path);
+    void load();
+    bool saveLocked();
+
+    QString m_path;
+    mutable QMutex m_mutex;
+    QHash<QString, Cursor> m_cursors;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+
+class MetadataTable;
+struct ImageFilter;
+
+// Pluggable query side of the IndexStore. The store stays the owner of the
+// metadata and forwards every resolved change; a backend answers filter and
+// random-selection queries.
+class MetadataBackend {
+public:
+    virtual ~MetadataBackend() = default;
+
+    virtual QString name() const = 0;
+
+    // Bring the backend in line with the store's contents (called once when attached)
+    virtual void importIfNeeded(const MetadataTable &table) = 0;
+    // Mirror a changed / removed entry. May be called from any thread.
+    virtual void entryChanged(const QString &key, const QJsonObject &entry) = 0;
+    virtual void entryRemoved(const QString &key) = 0;
+    // Persist anything pending (called on shutdown)
+    virtual void sync() = 0;
+
+    // Keys accepted by the filter, newest download first
+    virtual QStringList query(const ImageFilter &filter) = 0;
+    // A random accepted key (about uniform), or an empty string
+    virtual QString randomKey(const ImageFilter &filter) = 0;
+};
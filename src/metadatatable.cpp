@@ -0,0 +1,464 @@
+#include "metadatatable.h"
+#include "binaryindex.h"
+
+#include <QDateTime>
+#include <QJsonValue>
+#include <QTimeZone>
+#include <algorithm>
+
+namespace {
+
+int hexDigit(QChar c) {
+    const ushort u = c.unicode();
+    if (u >= '0' && u <= '9') return u - '0';
+    if (u >= 'a' && u <= 'f') return u - 'a' + 10;
+    return -1; // uppercase is rejected so key() reproduces the name exactly
+}
+
+// Split "<64 lowercase hex>.<ext>" into hash bytes and extension
+bool parseHashedKey(const QString &key, MetadataTable::Hash &hash, QString &ext) {
+    if (key.size() < 66 || key.at(64) != QLatin1Char('.')) return false;
+    for (int i = 0; i < 32; ++i) {
+        const int hi = hexDigit(key.at(2 * i));
+        const int lo = hexDigit(key.at(2 * i + 1));
+        if (hi < 0 || lo < 0) return false;
+        hash[i] = quint8((hi << 4) | lo);
+    }
+    ext = key.mid(65);
+    return true;
+}
+
+QString hashToHex(const MetadataTable::Hash &hash) {
+    static const char digits[] = "0123456789abcdef";
+    QString out(64, Qt::Uninitialized);
+    QChar *p = out.data();
+    for (quint8 b : hash) {
+        *p++ = QLatin1Char(digits[b >> 4]);
+        *p++ = QLatin1Char(digits[b & 0xF]);
+    }
+    return out;
+}
+
+bool isHashThumbnail(const QString &thumb, const MetadataTable::Hash &hash) {
+    return thumb.size() == 74 && thumb.endsWith(QLatin1String("-thumb.jpg"))
+        && QStringView(thumb).left(64) == hashToHex(hash);
+}
+
+QString formatTimestamp(qint64 ms) {
+    return QDateTime::fromMSecsSinceEpoch(ms, QTimeZone::utc()).toString(Qt::ISODate);
+}
+
+// Rows after `row` move up by one
+template <typename T>
+void dropRow(QHash<int, T> &side, int row) {
+    if (side.isEmpty()) return;
+    QHash<int, T> out;
+    out.reserve(side.size());
+    for (auto it = side.constBegin(); it != side.constEnd(); ++it) {
+        if (it.key() != row) out.insert(it.key() > row ? it.key() - 1 : it.key(), it.value());
+    }
+    side = std::move(out);
+}
+
+template <typename T>
+void renumberRows(QHash<int, T> &side, const QVector<int> &newRow) {
+    QHash<int, T> out;
+    out.reserve(side.size());
+    for (auto it = side.constBegin(); it != side.constEnd(); ++it) out.insert(newRow[it.key()], it.value());
+    side = std::move(out);
+}
+
+template <typename T>
+void gatherRows(QVector<T> &column, const QVector<int> &order) {
+    QVector<T> out;
+    out.reserve(order.size());
+    for (int row : order) out.append(column.at(row));
+    column = std::move(out);
+}
+
+} // namespace
+
+MetadataTable::Entry MetadataTable::Entry::fromJson(const QJsonObject &json) {
+    Entry e;
+    // whatever the typed fields don't reproduce exactly stays behind in `extra`
+    e.extra = json;
+    const QString sub = json.value(QLatin1String("subreddit")).toString();
+    if (!sub.isEmpty()) {
+        e.subreddit = sub;
+        e.extra.remove(QLatin1String("subreddit"));
+    }
+    const QJsonValue wv = json.value(QLatin1String("width"));
+    const QJsonValue hv = json.value(QLatin1String("height"));
+    const int w = wv.toInt();
+    const int h = hv.toInt();
+    if (w > 0 && h > 0 && wv.toDouble() == w && hv.toDouble() == h) {
+        e.size = QSize(w, h);
+        e.extra.remove(QLatin1String("width"));
+        e.extra.remove(QLatin1String("height"));
+    }
+    const QJsonValue fav = json.value(QLatin1String("favorite"));
+    if (fav.isBool()) {
+        e.favorite = fav.toBool() ? 1 : 0;
+        e.extra.remove(QLatin1String("favorite"));
+    }
+    const QJsonValue banned = json.value(QLatin1String("banned"));
+    if (banned.isBool()) {
+        e.banned = banned.toBool() ? 1 : 0;
+        e.extra.remove(QLatin1String("banned"));
+    }
+    const QString thumb = json.value(QLatin1String("thumbnail")).toString();
+    if (!thumb.isEmpty()) {
+        e.thumbnail = thumb;
+        e.extra.remove(QLatin1String("thumbnail"));
+    }
+    const QString when = json.value(QLatin1String("downloaded_at")).toString();
+    if (!when.isEmpty()) {
+        const QDateTime dt = QDateTime::fromString(when, Qt::ISODate);
+        if (dt.isValid()) {
+            // still sorts by time; the text is only dropped if it formats back identically
+            e.downloadedAtMs = dt.toMSecsSinceEpoch();
+            if (formatTimestamp(e.downloadedAtMs) == when) e.extra.remove(QLatin1String("downloaded_at"));
+        }
+    }
+    return e;
+}
+
+QJsonObject MetadataTable::Entry::toJson() const {
+    QJsonObject json = extra;
+    if (!subreddit.isEmpty()) json.insert(QLatin1String("subreddit"), subreddit);
+    if (size.isValid()) {
+        json.insert(QLatin1String("width"), size.width());
+        json.insert(QLatin1String("height"), size.height());
+    }
+    if (favorite >= 0) json.insert(QLatin1String("favorite"), favorite != 0);
+    if (banned >= 0) json.insert(QLatin1String("banned"), banned != 0);
+    if (!thumbnail.isEmpty()) json.insert(QLatin1String("thumbnail"), thumbnail);
+    if (downloadedAtMs >= 0 && !json.contains(QLatin1String("downloaded_at"))) {
+        json.insert(QLatin1String("downloaded_at"), formatTimestamp(downloadedAtMs));
+    }
+    return json;
+}
+
+template <typename KeyAt, typename EntryAt>
+std::shared_ptr<MetadataTable> MetadataTable::build(int count, KeyAt keyAt, EntryAt entryAt, quint64 version) {
+    auto table = std::make_shared<MetadataTable>();
+    MetadataTable &t = *table;
+    t.m_version = version;
+
+    // Parse keys first so hashed rows can be ordered before filling columns
+    struct Parsed { Hash hash; quint8 ext; int index; };
+    std::vector<Parsed> hashed;
+    QVector<int> others;
+    hashed.reserve(size_t(count));
+    QHash<QString, quint8> extIds;
+    for (int i = 0; i < count; ++i) {
+        Parsed p;
+        QString ext;
+        if (parseHashedKey(keyAt(i), p.hash, ext)) {
+            auto e = extIds.constFind(ext);
+            if (e == extIds.constEnd() && extIds.size() < 256) {
+                e = extIds.insert(ext, quint8(t.m_extensionNames.size()));
+                t.m_extensionNames.append(ext);
+            }
+            if (e != extIds.constEnd()) {
+                p.ext = e.value();
+                p.index = i;
+                hashed.push_back(p);
+                continue;
+            }
+        }
+        others.append(i);
+    }
+    std::sort(hashed.begin(), hashed.end(), [](const Parsed &a, const Parsed &b) {
+        return a.hash != b.hash ? a.hash < b.hash : a.ext < b.ext;
+    });
+
+    t.m_hashedRows = int(hashed.size());
+    t.m_hashes.reserve(t.m_hashedRows);
+    t.m_extension.reserve(t.m_hashedRows);
+    t.m_subreddit.reserve(count);
+    t.m_packedSize.reserve(count);
+    t.m_flags.reserve(count);
+    t.m_downloadedAt.reserve(count);
+
+    for (const Parsed &p : hashed) {
+        t.m_hashes.append(p.hash);
+        t.m_extension.append(p.ext);
+        t.writeRow(t.appendRow(), entryAt(p.index));
+    }
+    for (int i : std::as_const(others)) {
+        const QString key = keyAt(i);
+        t.m_otherRows.insert(key, t.rowCount());
+        t.m_otherKeys.append(key);
+        t.writeRow(t.appendRow(), entryAt(i));
+    }
+    t.m_unsortableRows = others.size();
+    return table;
+}
+
+std::shared_ptr<MetadataTable> MetadataTable::fromJson(const QJsonObject &root, quint64 version) {
+    const auto begin = root.constBegin();
+    return build(int(root.size()),
+                 [&](int i) { return (begin + i).key(); },
+                 [&](int i) { return Entry::fromJson((begin + i).value().toObject()); },
+                 version);
+}
+
+std::shared_ptr<MetadataTable> MetadataTable::fromBinary(const BinaryIndex &bin, quint64 version) {
+    return bin.table(version);
+}
+
+bool MetadataTable::splitHashedKey(const QString &key, Hash &hash, QString &ext) {
+    return parseHashedKey(key, hash, ext);
+}
+
+QString MetadataTable::hashHex(const Hash &hash) {
+    return hashToHex(hash);
+}
+
+int MetadataTable::appendRow() {
+    m_subreddit.append(kNoSubreddit);
+    m_packedSize.append(0);
+    m_flags.append(0);
+    m_downloadedAt.append(-1);
+    return m_flags.size() - 1;
+}
+
+quint16 MetadataTable::internSubreddit(const QString &name) {
+    auto it = m_subredditIds.constFind(name);
+    if (it != m_subredditIds.constEnd()) return it.value();
+    if (m_subredditNames.size() >= kNoSubreddit) return kNoSubreddit;
+    const quint16 id = quint16(m_subredditNames.size());
+    m_subredditIds.insert(name, id);
+    m_subredditNames.append(name);
+    return id;
+}
+
+void MetadataTable::writeRow(int row, const Entry &e) {
+    m_customThumbnails.remove(row);
+    m_bigSizes.remove(row);
+    m_extra.remove(row);
+    QJsonObject extra = e.extra;
+    quint8 flags = 0;
+
+    quint16 sub = kNoSubreddit;
+    if (!e.subreddit.isEmpty()) {
+        sub = internSubreddit(e.subreddit);
+        // out of IDs: keep the name with the row instead
+        if (sub == kNoSubreddit) extra.insert(QLatin1String("subreddit"), e.subreddit);
+    }
+    m_subreddit[row] = sub;
+
+    quint32 packed = 0;
+    const int w = e.size.width();
+    const int h = e.size.height();
+    if (w > 0 && h > 0) {
+        flags |= HasSize;
+        if (w > 0xFFFF || h > 0xFFFF) {
+            flags |= SizeOverflow;
+            m_bigSizes.insert(row, e.size);
+        } else {
+            packed = (quint32(w) << 16) | quint32(h);
+        }
+    } else if (e.size.isValid()) {
+        extra.insert(QLatin1String("width"), w);
+        extra.insert(QLatin1String("height"), h);
+    }
+    m_packedSize[row] = packed;
+
+    if (e.favorite >= 0) flags |= HasFavorite | (e.favorite ? Favorite : 0);
+    if (e.banned >= 0) flags |= HasBanned | (e.banned ? Banned : 0);
+    if (!e.thumbnail.isEmpty()) {
+        if (row < m_hashedRows && isHashThumbnail(e.thumbnail, m_hashes[row])) flags |= HashThumbnail;
+        else m_customThumbnails.insert(row, e.thumbnail);
+    }
+    m_flags[row] = flags;
+    m_downloadedAt[row] = e.downloadedAtMs;
+
+    if (!extra.isEmpty()) m_extra.insert(row, extra);
+}
+
+MetadataTable::Entry MetadataTable::entry(int row) const {
+    Entry e;
+    const quint8 flags = m_flags[row];
+    e.subreddit = subreddit(row);
+    if (flags & HasSize) e.size = imageSize(row);
+    if (flags & HasFavorite) e.favorite = (flags & Favorite) ? 1 : 0;
+    if (flags & HasBanned) e.banned = (flags & Banned) ? 1 : 0;
+    e.thumbnail = thumbnail(row);
+    e.downloadedAtMs = m_downloadedAt[row];
+    e.extra = m_extra.value(row);
+    return e;
+}
+
+QJsonObject MetadataTable::entryJson(int row) const {
+    return entry(row).toJson();
+}
+
+
+QJsonObject MetadataTable::toJson() const {
+    QJsonObject root;
+    for (int row = 0; row < rowCount(); ++row) root.insert(key(row), entryJson(row));
+    return root;
+}
+
+void MetadataTable::setEntry(const QString &key, const QJsonObject &entry) {
+    int row = find(key);
+    if (row < 0) {
+        row = appendRow();
+        m_otherRows.insert(key, row);
+        m_otherKeys.append(key);
+    }
+    writeRow(row, Entry::fromJson(entry));
+    if (m_otherKeys.size() - m_unsortableRows > qMax(kMinUnsortedRows, rowCount() / 8)) sortRows();
+}
+
+bool MetadataTable::removeEntry(const QString &key) {
+    const int row = find(key);
+    if (row < 0) return false;
+    removeRow(row);
+    return true;
+}
+
+void MetadataTable::removeRow(int row) {
+    if (row < m_hashedRows) {
+        m_hashes.remove(row);
+        m_extension.remove(row);
+        --m_hashedRows;
+    } else {
+        m_otherRows.remove(m_otherKeys.at(row - m_hashedRows));
+        m_otherKeys.removeAt(row - m_hashedRows);
+        m_unsortableRows = qMin(m_unsortableRows, int(m_otherKeys.size()));
+    }
+    m_subreddit.remove(row);
+    m_packedSize.remove(row);
+    m_flags.remove(row);
+    m_downloadedAt.remove(row);
+    for (auto it = m_otherRows.begin(); it != m_otherRows.end(); ++it) {
+        if (it.value() > row) --it.value();
+    }
+    dropRow(m_customThumbnails, row);
+    dropRow(m_bigSizes, row);
+    dropRow(m_extra, row);
+}
+
+void MetadataTable::sortRows() {
+    struct Item { Hash hash; quint8 ext; int row; };
+    std::vector<Item> items;
+    items.reserve(size_t(rowCount()));
+    for (int row = 0; row < m_hashedRows; ++row) items.push_back({ m_hashes[row], m_extension[row], row });
+    QVector<int> others;
+    for (int i = 0; i < m_otherKeys.size(); ++i) {
+        Item item;
+        item.row = m_hashedRows + i;
+        QString ext;
+        int extId = -1;
+        if (parseHashedKey(m_otherKeys.at(i), item.hash, ext)) {
+            extId = m_extensionNames.indexOf(ext);
+            if (extId < 0 && m_extensionNames.size() < 256) {
+                extId = m_extensionNames.size();
+                m_extensionNames.append(ext);
+            }
+        }
+        if (extId < 0) {
+            others.append(item.row);
+            continue;
+        }
+        item.ext = quint8(extId);
+        items.push_back(item);
+    }
+    std::sort(items.begin(), items.end(), [](const Item &a, const Item &b) {
+        return a.hash != b.hash ? a.hash < b.hash : a.ext < b.ext;
+    });
+
+    // order[new row] = old row
+    QVector<int> order;
+    QVector<int> newRow(rowCount());
+    order.reserve(rowCount());
+    for (const Item &item : items) {
+        newRow[item.row] = order.size();
+        order.append(item.row);
+    }
+    for (int row : std::as_const(others)) {
+        newRow[row] = order.size();
+        order.append(row);
+    }
+    gatherRows(m_subreddit, order);
+    gatherRows(m_packedSize, order);
+    gatherRows(m_flags, order);
+    gatherRows(m_downloadedAt, order);
+    renumberRows(m_customThumbnails, newRow);
+    renumberRows(m_bigSizes, newRow);
+    renumberRows(m_extra, newRow);
+
+    QStringList otherKeys;
+    for (int row : std::as_const(others)) otherKeys.append(m_otherKeys.at(row - m_hashedRows));
+    m_hashedRows = int(items.size());
+    m_hashes.clear();
+    m_extension.clear();
+    m_hashes.reserve(m_hashedRows);
+    m_extension.reserve(m_hashedRows);
+    for (const Item &item : items) {
+        m_hashes.append(item.hash);
+        m_extension.append(item.ext);
+    }
+    m_otherKeys = otherKeys;
+    m_otherRows.clear();
+    for (int i = 0; i < m_otherKeys.size(); ++i) m_otherRows.insert(m_otherKeys.at(i), m_hashedRows + i);
+    m_unsortableRows = m_otherKeys.size();
+
+    // appended rows kept their thumbnail by name; now they have a hash
+    for (auto it = m_customThumbnails.begin(); it != m_customThumbnails.end();) {
+        if (it.key() < m_hashedRows && isHashThumbnail(it.value(), m_hashes[it.key()])) {
+            m_flags[it.key()] |= HashThumbnail;
+            it = m_customThumbnails.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+int MetadataTable::find(const QString &key) const {
+    Hash hash;
+    QString ext;
+    if (parseHashedKey(key, hash, ext)) {
+        const int extId = m_extensionNames.indexOf(ext);
+        if (extId >= 0) {
+            const auto begin = m_hashes.constBegin();
+            const auto end = begin + m_hashedRows;
+            auto it = std::lower_bound(begin, end, hash);
+            for (; it != end && *it == hash; ++it) {
+                const int row = int(it - begin);
+                if (m_extension[row] == extId) return row;
+            }
+        }
+    }
+    return m_otherRows.value(key, -1);
+}
+
+QString MetadataTable::key(int row) const {
+    if (row < m_hashedRows) {
+        return hashToHex(m_hashes[row]) + QLatin1Char('.') + m_extensionNames[m_extension[row]];
+    }
+    return m_otherKeys[row - m_hashedRows];
+}
+
+QString MetadataTable::subreddit(int row) const {
+    const quint16 id = m_subreddit[row];
+    return id == kNoSubreddit ? QString() : m_subredditNames[id];
+}
+
+QSize MetadataTable::imageSize(int row) const {
+    const quint8 flags = m_flags[row];
+    if (!(flags & HasSize)) return QSize();
+    if (flags & SizeOverflow) return m_bigSizes.value(row);
+    const quint32 packed = m_packedSize[row];
+    return QSize(int(packed >> 16), int(packed & 0xFFFF));
+}
+
+QString MetadataTable::thumbnail(int row) const {
+    if (m_flags[row] & HashThumbnail) {
+        return hashToHex(m_hashes[row]) + QStringLiteral("-thumb.jpg");
+    }
+    return m_customThumbnails.value(row);
+}
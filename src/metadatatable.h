@@ -0,0 +1,133 @@
+#pragma once
+
+#include <QHash>
+#include <QJsonObject>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <array>
+#include <memory>
+
+class BinaryIndex;
+
+// Struct-of-arrays snapshot of index.json shared by every reader.
+//
+// Keys of the usual "<sha256 hex>.<ext>" form are stored as 32 raw bytes
+// plus an interned extension ID, sorted by hash for binary-search lookup.
+// Subreddits are interned to uint16 IDs, sizes are packed into one word and
+// booleans into a flag byte. The rare entries that don't fit (odd key names,
+// custom thumbnail names, oversized dimensions) live in small side tables.
+//
+// Published tables are immutable. The owner edits a private copy with
+// setEntry/removeEntry: copies are cheap (the columns are implicitly shared
+// until written) and an edit only touches the columns of one row. Keys added
+// since the last sort sit unsorted after the sorted rows, looked up by name,
+// until there are enough of them to merge in.
+class MetadataTable {
+public:
+    using Hash = std::array<quint8, 32>;
+    static constexpr quint16 kNoSubreddit = 0xFFFF;
+
+    // One index.json entry, decoded. Fields the typed members don't model,
+    // or don't reproduce exactly, are carried verbatim in `extra`.
+    struct Entry {
+        QString subreddit;           // empty when absent
+        QSize size;                  // invalid when absent
+        int favorite = -1;           // -1 when absent, else 0 or 1
+        int banned = -1;
+        QString thumbnail;           // empty when absent
+        qint64 downloadedAtMs = -1;  // -1 when absent
+        QJsonObject extra;
+
+        static Entry fromJson(const QJsonObject &json);
+        QJsonObject toJson() const;
+    };
+
+    static std::shared_ptr<MetadataTable> fromJson(const QJsonObject &root, quint64 version = 0);
+    // From a mapped index.bin: its columns are copied as they are (see
+    // BinaryIndex::table)
+    static std::shared_ptr<MetadataTable> fromBinary(const BinaryIndex &bin, quint64 version = 0);
+
+    // IndexStore generation this snapshot was built from
+    quint64 version() const { return m_version; }
+    void setVersion(quint64 version) { m_version = version; }
+    int rowCount() const { return m_flags.size(); }
+    // Row for a key (file name), or -1
+    int find(const QString &key) const;
+
+    QString key(int row) const;
+    quint16 subredditId(int row) const { return m_subreddit[row]; }
+    // Interned subreddit names as stored in index.json (not normalized)
+    const QStringList &subreddits() const { return m_subredditNames; }
+    QString subreddit(int row) const;
+    QSize imageSize(int row) const;
+    bool hasSize(int row) const { return m_flags[row] & HasSize; }
+    bool favorite(int row) const { return m_flags[row] & Favorite; }
+    bool banned(int row) const { return m_flags[row] & Banned; }
+    QString thumbnail(int row) const;
+    // Milliseconds since epoch, or -1 if unknown
+    qint64 downloadedAtMs(int row) const { return m_downloadedAt[row]; }
+    Entry entry(int row) const;
+    // The row as an index.json entry / the whole table as index.json
+    QJsonObject entryJson(int row) const;
+    QJsonObject toJson() const;
+
+    // Insert or replace the entry for key (unpublished tables only)
+    void setEntry(const QString &key, const QJsonObject &entry);
+    // Drop the entry for key; false if there was none
+    bool removeEntry(const QString &key);
+
+private:
+    // index.bin stores and restores the columns below directly
+    friend class BinaryIndex;
+    enum Flags : quint8 {
+        HasSize = 1 << 0,
+        Favorite = 1 << 1,
+        Banned = 1 << 2,
+        HashThumbnail = 1 << 3,   // thumbnail is "<hash>-thumb.jpg"
+        SizeOverflow = 1 << 4,    // dimension above 65535, see m_bigSizes
+        HasFavorite = 1 << 5,     // the entry has a favorite field
+        HasBanned = 1 << 6        // the entry has a banned field
+    };
+    // Unsorted rows beyond which setEntry merges them into the sorted ones
+    static constexpr int kMinUnsortedRows = 256;
+
+    // Rows from keyAt(i) and entryAt(i) for i < count, sorted into place
+    template <typename KeyAt, typename EntryAt>
+    static std::shared_ptr<MetadataTable> build(int count, KeyAt keyAt, EntryAt entryAt, quint64 version);
+    // Append a row with empty columns
+    int appendRow();
+    // Encode entry into the columns and side tables of an existing row
+    void writeRow(int row, const Entry &entry);
+    void removeRow(int row);
+    // Move unsorted rows with hashed keys into the sorted region
+    void sortRows();
+    quint16 internSubreddit(const QString &name);
+    // "<64 lowercase hex>.<ext>" split into hash and extension, and back
+    static bool splitHashedKey(const QString &key, Hash &hash, QString &ext);
+    static QString hashHex(const Hash &hash);
+
+    quint64 m_version = 0;
+    // hashed rows come first (sorted by hash), then rows with other key names
+    // and keys added since the last sort
+    int m_hashedRows = 0;
+    QVector<Hash> m_hashes;
+    QVector<quint8> m_extension;
+    QStringList m_extensionNames;
+    QVector<quint16> m_subreddit;
+    QStringList m_subredditNames;
+    QHash<QString, quint16> m_subredditIds;
+    QVector<quint32> m_packedSize;
+    QVector<quint8> m_flags;
+    QVector<qint64> m_downloadedAt;
+
+    QStringList m_otherKeys;
+    QHash<QString, int> m_otherRows;
+    // other keys that can't be sorted in (not "<hash>.<ext>")
+    int m_unsortableRows = 0;
+    QHash<int, QString> m_customThumbnails;
+    QHash<int, QSize> m_bigSizes;
+    // fields the columns don't model, or don't reproduce exactly
+    QHash<int, QJsonObject> m_extra;
+};
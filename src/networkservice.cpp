@@ -0,0 +1,86 @@
+#include "networkservice.h"
+#include "ratelimiter.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QThreadStorage>
+#include <atomic>
+
+namespace {
+std::atomic<qint64> g_requests{0};
+std::atomic<qint64> g_tlsRequests{0};
+std::atomic<qint64> g_handshakes{0};
+std::atomic<qint64> g_http2{0};
+
+// reply property: when `encrypted` was emitted for it (msecsSinceReference)
+const char *const kEncryptedAt = "wallaroo_encryptedAt";
+// encrypted signals for one host closer than this belong to one handshake
+constexpr qint64 kSameHandshakeMs = 100;
+}
+
+QNetworkAccessManager *NetworkService::manager()
+{
+    // deleted automatically when the owning thread finishes
+    static QThreadStorage<QNetworkAccessManager*> managers;
+    if (!managers.hasLocalData()) {
+        auto *mgr = new QNetworkAccessManager;
+        QObject::connect(mgr, &QNetworkAccessManager::encrypted, mgr, [](QNetworkReply *reply) {
+            reply->setProperty(kEncryptedAt, QElapsedTimer::msecsSinceReference());
+        });
+        // last counted HTTP/2 handshake per host:port of this manager
+        QObject::connect(mgr, &QNetworkAccessManager::finished, mgr, [lastHttp2 = QHash<QString, qint64>()](QNetworkReply *reply) mutable {
+            g_requests++;
+            if (reply->url().scheme() == "https") g_tlsRequests++;
+            const bool http2 = reply->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool();
+            if (http2) g_http2++;
+            const QVariant encryptedAt = reply->property(kEncryptedAt);
+            if (encryptedAt.isValid()) {
+                // An HTTP/1 connection signals `encrypted` to the one reply
+                // that opened it. A new HTTP/2 connection signals it, at
+                // once, to every reply queued on it; count that burst once.
+                const qint64 at = encryptedAt.toLongLong();
+                if (!http2) {
+                    g_handshakes++;
+                } else {
+                    const QString host = reply->url().host() + ':' + QString::number(reply->url().port(443));
+                    const auto last = lastHttp2.constFind(host);
+                    if (last == lastHttp2.constEnd() || qAbs(at - *last) > kSameHandshakeMs) {
+                        g_handshakes++;
+                        lastHttp2.insert(host, at);
+                    }
+                }
+            }
+            // every reply tunes its host's rate limit before the caller sees it
+            RateLimiter::instance()->observe(reply);
+        });
+        managers.setLocalData(mgr);
+    }
+    return managers.localData();
+}
+
+QNetworkRequest NetworkService::request(const QUrl &url)
+{
+    QNetworkRequest req(url);
+    req.setRawHeader("User-Agent", "wallaroo/0.1");
+    req.setAttribute(QNetworkRequest::Http2AllowedAttribute, true);
+    return req;
+}
+
+NetworkService::Stats NetworkService::stats()
+{
+    Stats s;
+    s.requests = g_requests.load();
+    s.tlsRequests = g_tlsRequests.load();
+    s.handshakes = g_handshakes.load();
+    s.http2 = g_http2.load();
+    return s;
+}
+
+QString NetworkService::statsSummary()
+{
+    const Stats s = stats();
+    return QString("requests=%1 tls=%2 handshakes=%3 reused=%4 http2=%5")
+        .arg(s.requests).arg(s.tlsRequests).arg(s.handshakes).arg(s.reused()).arg(s.http2);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <QNetworkRequest>
+#include <QString>
+#include <QUrl>
+
+class QNetworkAccessManager;
+
+// Long-lived network access shared by RedditFetcher, CacheManager and
+// UpdateWorker. QNetworkAccessManager is not thread-safe, so there is one
+// per thread, created on first use and kept for the thread's lifetime; its
+// connection pool (keep-alive, HTTP/2 multiplexing, at most 6 HTTP/1
+// connections per host) is therefore reused across requests and scans.
+// Every finished reply is reported to RateLimiter.
+class NetworkService {
+public:
+    // Manager for the calling thread
+    static QNetworkAccessManager *manager();
+    // Request with the app's User-Agent and HTTP/2 allowed
+    static QNetworkRequest request(const QUrl &url);
+
+    struct Stats {
+        qint64 requests = 0;   // finished requests
+        qint64 tlsRequests = 0;
+        // New TLS connections: the replies QNetworkAccessManager reported
+        // `encrypted` for, with the replies queued on one new HTTP/2
+        // connection (all told at once) counted as one
+        qint64 handshakes = 0;
+        qint64 http2 = 0;      // requests served over HTTP/2
+        // TLS requests that rode on an existing connection
+        qint64 reused() const { return qMax<qint64>(0, tlsRequests - handshakes); }
+    };
+    // Process-wide counters since start-up
+    static Stats stats();
+    static QString statsSummary();
+};
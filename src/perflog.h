@@ -0,0 +1,7 @@
+#pragma once
+
+#include <QLoggingCategory>
+
+// Timings, counts and progress of the index, cache and scan machinery. Off
+// by default; enable with QT_LOGGING_RULES="wallaroo.perf.debug=true".
+Q_DECLARE_LOGGING_CATEGORY(lcPerf)
@@ -0,0 +1,133 @@
+#include "ratelimiter.h"
+
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QStringList>
+#include <QDebug>
+#include <cmath>
+
+RateLimiter *RateLimiter::instance()
+{
+    static RateLimiter *limiter = new RateLimiter;
+    return limiter;
+}
+
+RateLimiter::Bucket &RateLimiter::bucketLocked(const QString &host)
+{
+    auto it = m_buckets.find(host);
+    if (it != m_buckets.end()) return *it;
+    Bucket b;
+    // the listing API publishes its quota; stay polite until it does
+    if (host == "reddit.com" || host.endsWith(".reddit.com")) {
+        b.rate = kApiInitialRate;
+        b.burst = kApiInitialBurst;
+        b.tokens = kApiInitialBurst;
+    }
+    b.refilledAtMs = QDateTime::currentMSecsSinceEpoch();
+    return *m_buckets.insert(host, b);
+}
+
+void RateLimiter::refill(Bucket &b, qint64 nowMs)
+{
+    if (b.rate > 0 && nowMs > b.refilledAtMs)
+        b.tokens = qMin(b.burst, b.tokens + (nowMs - b.refilledAtMs) * b.rate / 1000.0);
+    b.refilledAtMs = nowMs;
+}
+
+qint64 RateLimiter::acquire(const QString &host)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker lock(&m_mutex);
+    Bucket &b = bucketLocked(host.toLower());
+    if (b.pausedUntilMs > now) {
+        m_delayed++;
+        return b.pausedUntilMs - now;
+    }
+    if (b.rate <= 0) return 0;
+    refill(b, now);
+    if (b.tokens >= 1) {
+        b.tokens -= 1;
+        return 0;
+    }
+    m_delayed++;
+    return qMax<qint64>(1, qint64(std::ceil((1 - b.tokens) / b.rate * 1000.0)));
+}
+
+qint64 RateLimiter::retryAfterMs(QNetworkReply *reply)
+{
+    const QByteArray value = reply->rawHeader("Retry-After").trimmed();
+    if (value.isEmpty()) return -1;
+    // either delta-seconds or an HTTP date
+    bool ok = false;
+    const qint64 secs = value.toLongLong(&ok);
+    if (ok) return qMax<qint64>(0, secs) * 1000;
+    const QDateTime when = QDateTime::fromString(QString::fromLatin1(value), Qt::RFC2822Date);
+    if (!when.isValid()) return -1;
+    return qMax<qint64>(0, when.toMSecsSinceEpoch() - QDateTime::currentMSecsSinceEpoch());
+}
+
+void RateLimiter::observe(QNetworkReply *reply)
+{
+    const QString host = reply->url().host().toLower();
+    if (host.isEmpty()) return;
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QMutexLocker lock(&m_mutex);
+    Bucket &b = bucketLocked(host);
+
+    // reddit reports the quota left in the current window and its remaining seconds
+    bool okRemaining = false, okReset = false;
+    const double remaining = reply->rawHeader("X-Ratelimit-Remaining").toDouble(&okRemaining);
+    const double reset = reply->rawHeader("X-Ratelimit-Reset").toDouble(&okReset);
+    if (okRemaining && okReset && reset > 0) {
+        refill(b, now);
+        if (remaining < 1) {
+            b.pausedUntilMs = qMax(b.pausedUntilMs, now + qint64(reset * 1000));
+            b.tokens = 0;
+        }
+        b.rate = qMax(kMinRate, remaining / reset);
+        b.burst = qBound(1.0, remaining, kApiInitialBurst * 2);
+        b.tokens = qMin(b.tokens, qMax(0.0, remaining));
+    }
+
+    if (status == 429 || status == 503) {
+        m_throttled++;
+        qint64 pause = retryAfterMs(reply);
+        if (pause < 0) pause = qint64(kDefaultRetryAfterSecs) * 1000;
+        b.pausedUntilMs = qMax(b.pausedUntilMs, now + pause);
+        refill(b, now);
+        if (b.rate <= 0) {
+            b.rate = kThrottledRate;
+            b.burst = kThrottledRate;
+        } else {
+            b.rate = qMax(kMinRate, b.rate / 2);
+        }
+        b.tokens = 0;
+        qWarning() << "RateLimiter:" << host << "returned" << status << "- pausing" << pause << "ms, rate now" << b.rate << "/s";
+    }
+}
+
+qint64 RateLimiter::delayedCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_delayed;
+}
+
+qint64 RateLimiter::throttledCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_throttled;
+}
+
+QString RateLimiter::summary() const
+{
+    QMutexLocker lock(&m_mutex);
+    QStringList limited;
+    for (auto it = m_buckets.constBegin(); it != m_buckets.constEnd(); ++it) {
+        if (it->rate > 0) limited << QString("%1=%2/s").arg(it.key()).arg(it->rate, 0, 'f', 2);
+    }
+    return QString("deferred=%1 throttled=%2 %3").arg(m_delayed).arg(m_throttled).arg(limited.join(' '));
+}
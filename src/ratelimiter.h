@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+class QNetworkReply;
+
+// Process-wide token bucket per host, shared by every listing fetch and
+// image download. Hosts start unlimited, except reddit.com's API which starts
+// at a conservative rate. Every reply passing through NetworkService adapts
+// its host's bucket:
+//   - X-Ratelimit-Remaining / X-Ratelimit-Reset spread the remaining quota
+//     evenly over the reset window
+//   - 429 / 503 (with or without Retry-After) pause the host and cap, or
+//     halve, its rate
+class RateLimiter {
+public:
+    static RateLimiter *instance();
+
+    // Take a token for a request to host. Returns 0 if the request may start
+    // now, otherwise the milliseconds to wait before asking again.
+    qint64 acquire(const QString &host);
+    // Adapt the host's bucket to a finished reply
+    void observe(QNetworkReply *reply);
+
+    // acquire() calls that returned a wait, and 429/503 responses seen
+    qint64 delayedCount() const;
+    qint64 throttledCount() const;
+    QString summary() const;
+
+    // starting rate for the reddit.com API until its headers are seen
+    static constexpr double kApiInitialRate = 1.0; // requests per second
+    static constexpr double kApiInitialBurst = 4;
+    // rate imposed on a previously unlimited host after its first 429
+    static constexpr double kThrottledRate = 4.0;
+    static constexpr double kMinRate = 0.1;
+    // pause after a 429/503 without Retry-After
+    static constexpr int kDefaultRetryAfterSecs = 30;
+
+private:
+    RateLimiter() = default;
+    struct Bucket {
+        double rate = 0;    // tokens per second; 0 means unlimited
+        double burst = 1;
+        double tokens = 1;
+        qint64 refilledAtMs = 0;
+        qint64 pausedUntilMs = 0;
+    };
+    Bucket &bucketLocked(const QString &host);
+    static void refill(Bucket &b, qint64 nowMs);
+    static qint64 retryAfterMs(QNetworkReply *reply);
+
+    mutable QMutex m_mutex;
+    QHash<QString, Bucket> m_buckets;
+    qint64 m_delayed = 0;
+    qint64 m_throttled = 0;
+};
@@ -1,43 +1,74 @@
 #include "redditfetcher.h"
+#include "networkservice.h"
+#include "listingcache.h"
 
-#include <QNetworkAccessManager>
 #include <QNetworkRequest>
-#include <QNetworkReply>
-#include <QEventLoop>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QUrlQuery>
 
-std::vector<std::string> RedditFetcher::fetchRecentImageUrls(const QString &subreddit, int limit) {
-    QNetworkAccessManager mgr;
-    QString url = QString("https://www.reddit.com/r/%1/new.json?limit=%2").arg(subreddit).arg(limit);
-    QNetworkRequest req(url);
-    req.setRawHeader("User-Agent", "wallaroo/0.1");
-    QNetworkReply *reply = mgr.get(req);
-    QEventLoop loop;
-    QObject::connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
-    loop.exec();
-    std::vector<std::string> out;
-    if (reply->error() != QNetworkReply::NoError) {
-        reply->deleteLater();
-        return out;
-    }
-    QByteArray data = reply->readAll();
-    reply->deleteLater();
+namespace {
+QUrl g_baseUrl(QStringLiteral("https://www.reddit.com"));
+}
+
+void RedditFetcher::setBaseUrl(const QUrl &base) {
+    if (!base.isValid() || base.host().isEmpty()) return;
+    g_baseUrl = base;
+}
+
+QUrl RedditFetcher::baseUrl() {
+    return g_baseUrl;
+}
+
+QNetworkRequest RedditFetcher::listingRequest(const QString &subreddit, int limit, const QString &after) {
+    QUrl url = g_baseUrl;
+    QString path = url.path();
+    while (path.endsWith('/')) path.chop(1);
+    url.setPath(path + QString("/r/%1/new.json").arg(subreddit));
+    QUrlQuery query;
+    query.addQueryItem("limit", QString::number(qBound(1, limit, kMaxPageSize)));
+    if (!after.isEmpty()) query.addQueryItem("after", after);
+    url.setQuery(query);
+    QNetworkRequest req = NetworkService::request(url);
+    // conditional on the stored copy, so unchanged listings come back as 304;
+    // deeper pages shift with every new post and aren't worth caching
+    if (after.isEmpty()) ListingCache::instance()->prepare(req);
+    return req;
+}
 
+RedditFetcher::Page RedditFetcher::parsePage(const QByteArray &data) {
+    Page page;
     QJsonDocument doc = QJsonDocument::fromJson(data);
-    if (!doc.isObject()) return out;
-    QJsonObject root = doc.object();
-    QJsonArray children = root.value("data").toObject().value("children").toArray();
+    if (!doc.isObject()) return page;
+    const QJsonObject listing = doc.object().value("data").toObject();
+    page.after = listing.value("after").toString();
+    QJsonArray children = listing.value("children").toArray();
     for (auto v : children) {
         QJsonObject d = v.toObject().value("data").toObject();
+        Post post;
+        post.name = d.value("name").toString();
+        post.subreddit = d.value("subreddit").toString();
+        post.createdUtc = d.value("created_utc").toDouble();
+        post.postHint = d.value("post_hint").toString();
+        post.over18 = d.value("over_18").toBool();
+        post.gallery = d.value("is_gallery").toBool();
+        post.video = d.value("is_video").toBool();
+        const QJsonObject source = d.value("preview").toObject().value("images").toArray()
+                                       .at(0).toObject().value("source").toObject();
+        post.previewSize = QSize(source.value("width").toInt(), source.value("height").toInt());
         QString url = d.value("url_overridden_by_dest").toString();
         if (url.isEmpty()) url = d.value("url").toString();
-        if (url.isEmpty()) continue;
-        if (url.endsWith(".jpg") || url.endsWith(".jpeg") || url.endsWith(".png") || url.endsWith(".webp") || url.contains("imgur.com")) {
-            out.push_back(url.toStdString());
+        if (!post.video && (url.endsWith(".jpg") || url.endsWith(".jpeg") || url.endsWith(".png") || url.endsWith(".webp") || url.contains("imgur.com"))) {
+            post.url = url;
         }
-        // galleries and i.redd.it handled later
+        // galleries handled later
+        page.posts.push_back(post);
     }
-    return out;
+    return page;
+}
+
+bool RedditFetcher::isNewerThan(const Post &post, const QString &stopName, double stopUtc) {
+    // the timestamp still stops a walk if the cursor post was deleted
+    return post.name != stopName && !(stopUtc > 0 && post.createdUtc <= stopUtc);
 }
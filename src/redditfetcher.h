@@ -1,10 +1,44 @@
 #pragma once
 
 #include <QString>
+#include <QByteArray>
+#include <QNetworkRequest>
+#include <QSize>
+#include <QUrl>
 #include <vector>
 
 class RedditFetcher {
 public:
-    // Return candidate image URLs from the most recent `limit` posts
-    std::vector<std::string> fetchRecentImageUrls(const QString &subreddit, int limit = 10);
+    // One post of a listing page, with what the listing says about its media
+    struct Post {
+        QString name;          // fullname, "t3_<id>"
+        QString subreddit;     // as reddit spells it; tells combined listings apart
+        double createdUtc = 0;
+        QString url;           // candidate image URL, empty if the post has none
+        QSize previewSize;     // preview.images[0].source; empty if unknown
+        QString postHint;      // "image", "link", "hosted:video", ...
+        bool over18 = false;
+        bool gallery = false;
+        bool video = false;
+    };
+    // One page of /new.json, newest first; `after` continues into older posts
+    struct Page {
+        std::vector<Post> posts;
+        QString after;
+    };
+
+    // reddit returns at most this many posts per page
+    static constexpr int kMaxPageSize = 100;
+
+    // Where listings are fetched from, "https://www.reddit.com" by default.
+    // Pointing it at a local server replays recorded listings (and through
+    // them, images) offline. Set once at start-up, before any scan.
+    static void setBaseUrl(const QUrl &base);
+    static QUrl baseUrl();
+
+    // Building blocks for asynchronous callers (UpdateWorker)
+    static QNetworkRequest listingRequest(const QString &subreddit, int limit, const QString &after = QString());
+    static Page parsePage(const QByteArray &data);
+    // Whether `post` is newer than the post (stopName, stopUtc)
+    static bool isNewerThan(const Post &post, const QString &stopName, double stopUtc);
 };
@@ -0,0 +1,90 @@
+#include "scanscheduler.h"
+#include "sourcespanel.h"
+#include "perflog.h"
+
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <QDebug>
+#include <algorithm>
+
+ScanScheduler::ScanScheduler(SourcesPanel *panel, QObject *parent)
+    : QObject(parent), m_panel(panel)
+{
+    m_timer.setInterval(kTickMs);
+    connect(&m_timer, &QTimer::timeout, this, &ScanScheduler::tick);
+}
+
+void ScanScheduler::setEnabled(bool enabled)
+{
+    if (enabled) m_timer.start();
+    else m_timer.stop();
+}
+
+void ScanScheduler::setBusy(bool busy)
+{
+    m_busy = busy;
+}
+
+void ScanScheduler::tick()
+{
+    if (m_busy || !m_panel) return;
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    // never-scheduled subreddits count as due since the epoch
+    QList<QPair<QDateTime, QString>> due;
+    for (const QString &sub : m_panel->enabledSources()) {
+        const QDateTime next = m_panel->schedule(sub).nextScan;
+        if (!next.isValid()) due.append({ QDateTime::fromMSecsSinceEpoch(0), sub });
+        else if (next <= now) due.append({ next, sub });
+    }
+    if (due.isEmpty()) return;
+    std::stable_sort(due.begin(), due.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    QStringList subs;
+    for (int i = 0; i < due.size() && subs.size() < kMaxSubredditsPerScan; ++i) subs << due.at(i).second;
+    for (const QString &sub : std::as_const(subs)) m_running.insert(sub);
+    qCDebug(lcPerf) << "ScanScheduler: due" << subs << "of" << due.size();
+    emit scanDue(subs);
+}
+
+void ScanScheduler::recordScan(const QString &subreddit, int newImages)
+{
+    if (!m_panel) return;
+    m_running.remove(subreddit);
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    const QDateTime last = m_panel->lastUpdatedMap().value(subreddit);
+    double rate = m_panel->schedule(subreddit).imagesPerHour;
+    if (newImages >= 0 && last.isValid() && last < now) {
+        // at least a minute, so a quick rescan can't claim a huge rate
+        const double hours = qMax<qint64>(60, last.secsTo(now)) / 3600.0;
+        const double observed = newImages / hours;
+        rate = rate < 0 ? observed : kEwmaAlpha * observed + (1 - kEwmaAlpha) * rate;
+    }
+    m_panel->setLastUpdated(subreddit, now);
+    reschedule(subreddit, rate);
+}
+
+void ScanScheduler::scanFinished(const QString &subreddit)
+{
+    if (!m_panel || !m_running.remove(subreddit)) return;
+    // a scheduled scan that didn't move the cursor (failures, cancel): retry
+    // soon without touching the estimate
+    SourcesPanel::Schedule s = m_panel->schedule(subreddit);
+    s.nextScan = QDateTime::currentDateTimeUtc().addSecs(kMinIntervalSecs);
+    m_panel->setSchedule(subreddit, s);
+    emit scheduleChanged();
+}
+
+void ScanScheduler::reschedule(const QString &subreddit, double imagesPerHour)
+{
+    double secs = kDefaultIntervalSecs;
+    if (imagesPerHour == 0) secs = kMaxIntervalSecs;
+    else if (imagesPerHour > 0) secs = kTargetNewImages / imagesPerHour * 3600.0;
+    secs = qBound<double>(kMinIntervalSecs, secs, kMaxIntervalSecs);
+    secs *= 1 + kJitter * (2 * QRandomGenerator::global()->generateDouble() - 1);
+
+    SourcesPanel::Schedule s;
+    s.imagesPerHour = imagesPerHour;
+    s.nextScan = QDateTime::currentDateTimeUtc().addSecs(qint64(secs));
+    m_panel->setSchedule(subreddit, s);
+    qCDebug(lcPerf) << "ScanScheduler:" << subreddit << "rate" << imagesPerHour << "images/h, next scan in" << qint64(secs / 60) << "min";
+    emit scheduleChanged();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+class SourcesPanel;
+
+// Background polling of the enabled subreddits. Each subreddit's arrival rate
+// of new images is estimated (an EWMA over incremental scans) and its next
+// scan is placed where about kTargetNewImages should have arrived, so busy
+// subreddits are polled often and quiet ones rarely. The schedule lives in
+// the sources panel (and so in sources.json), which also displays it.
+class ScanScheduler : public QObject {
+    Q_OBJECT
+public:
+    explicit ScanScheduler(SourcesPanel *panel, QObject *parent = nullptr);
+
+    void setEnabled(bool enabled);
+    // While a scan (scheduled or manual) runs nothing new is started
+    void setBusy(bool busy);
+
+    static constexpr int kTickMs = 60 * 1000;
+    static constexpr double kTargetNewImages = 5;
+    static constexpr double kEwmaAlpha = 0.3;    // weight of the newest observation
+    static constexpr int kMinIntervalSecs = 15 * 60;
+    static constexpr int kMaxIntervalSecs = 24 * 3600;
+    static constexpr int kDefaultIntervalSecs = 2 * 3600;  // rate still unknown
+    static constexpr double kJitter = 0.15;      // +-15% so subreddits drift apart
+    // global cap: subreddits per scheduled scan
+    static constexpr int kMaxSubredditsPerScan = 3;
+
+public slots:
+    // An incremental scan moved the subreddit's cursor; newImages is the
+    // number of wanted images listed since the previous cursor, or -1 if
+    // there was none (first scan)
+    void recordScan(const QString &subreddit, int newImages);
+    // A subreddit's part of a scan ended (recorded or not)
+    void scanFinished(const QString &subreddit);
+
+signals:
+    // The due subreddits, most overdue first, to scan incrementally
+    void scanDue(const QStringList &subreddits);
+    // Schedules changed and should be saved
+    void scheduleChanged();
+
+private slots:
+    void tick();
+
+private:
+    void reschedule(const QString &subreddit, double imagesPerHour);
+
+    SourcesPanel *m_panel = nullptr;
+    QTimer m_timer;
+    bool m_busy = false;
+    // scheduled subreddits not yet finished
+    QSet<QString> m_running;
+};
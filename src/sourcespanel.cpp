@@ -1,4 +1,6 @@
 #include "sourcespanel.h"
+#include "indexstore.h"
+#include "metadatatable.h"
 
 #include <QListWidget>
 #include <QLineEdit>
@@ -59,7 +61,9 @@ SourcesPanel::SourcesPanel(QWidget *parent)
 
     // react to manual check/uncheck changes
     connect(m_list, &QListWidget::itemChanged, this, [this](QListWidgetItem *it){
-        Q_UNUSED(it);
+        // disabled sources aren't polled; drop or restore their schedule text
+        QString raw = it->data(Qt::UserRole).toString();
+        if (m_itemLabels.contains(raw)) refreshLabel(raw);
         emit enabledSourcesChanged(enabledSources());
     });
 
@@ -74,6 +78,16 @@ SourcesPanel::SourcesPanel(QWidget *parent)
     QAction *actUpdate10 = menu.addAction("Scan last 10 posts");
     QAction *actUpdate50 = menu.addAction("Scan last 50 posts");
     QAction *actUpdate100 = menu.addAction("Scan last 100 posts");
+    QAction *actBackfill = menu.addAction("Backfill older posts");
+    // controls for a scan in progress on this subreddit
+    QAction *actPause = nullptr;
+    QAction *actCancel = nullptr;
+    QProgressBar *bar = m_itemProgress.value(raw);
+    if (bar && bar->isVisible()) {
+        menu.addSeparator();
+        actPause = menu.addAction(m_updatesPaused ? "Resume scan" : "Pause scan");
+        actCancel = menu.addAction("Cancel scan of this subreddit");
+    }
         menu.addSeparator();
         QAction *actRemove = menu.addAction("Remove");
         QAction *chosen = menu.exec(m_list->viewport()->mapToGlobal(pt));
@@ -95,6 +109,12 @@ SourcesPanel::SourcesPanel(QWidget *parent)
             emit updateRequested(raw, 50);
         } else if (chosen == actUpdate100) {
             emit updateRequested(raw, 100);
+        } else if (chosen == actBackfill) {
+            emit backfillRequested(raw);
+        } else if (chosen && chosen == actPause) {
+            emit pauseUpdatesRequested(!m_updatesPaused);
+        } else if (chosen && chosen == actCancel) {
+            emit cancelUpdateRequested(raw);
         }
     });
 }
@@ -127,6 +147,7 @@ void SourcesPanel::createListItem(const QString &raw, bool enabled)
 
     m_list->addItem(it);
     m_list->setItemWidget(it, w);
+    refreshLabel(raw);
 }
 
 void SourcesPanel::setSources(const QStringList &sources)
@@ -177,6 +198,7 @@ bool SourcesPanel::loadFromFile(const QString &path)
     f.close();
     QStringList s;
     m_lastUpdated.clear();
+    m_schedules.clear();
     if (doc.isArray()) {
         QJsonArray arr = doc.array();
         for (const auto &v : arr) if (v.isString()) s << v.toString();
@@ -195,6 +217,10 @@ bool SourcesPanel::loadFromFile(const QString &path)
                     QDateTime dt = QDateTime::fromString(entry.value("last_updated").toString(), Qt::ISODate);
                     if (dt.isValid()) m_lastUpdated.insert(key, dt);
                 }
+                Schedule sched;
+                sched.imagesPerHour = entry.value("images_per_hour").toDouble(-1);
+                sched.nextScan = QDateTime::fromString(entry.value("next_scan").toString(), Qt::ISODate);
+                if (sched.imagesPerHour >= 0 || sched.nextScan.isValid()) m_schedules.insert(key, sched);
             }
         }
         // now populate list with proper checked state
@@ -229,6 +255,11 @@ bool SourcesPanel::saveToFile(const QString &path) const
         entry.insert("enabled", it->checkState() == Qt::Checked);
         if (m_lastUpdated.contains(s)) entry.insert("last_updated", m_lastUpdated.value(s).toString(Qt::ISODate));
         else entry.insert("last_updated", "");
+        if (m_schedules.contains(s)) {
+            const Schedule &sched = m_schedules[s];
+            if (sched.imagesPerHour >= 0) entry.insert("images_per_hour", sched.imagesPerHour);
+            if (sched.nextScan.isValid()) entry.insert("next_scan", sched.nextScan.toString(Qt::ISODate));
+        }
         obj.insert(s, entry);
     }
     QJsonDocument doc(obj);
@@ -250,46 +281,75 @@ void SourcesPanel::setLastUpdated(const QString &subreddit, const QDateTime &whe
     m_lastUpdated.insert(subreddit, when);
 }
 
+SourcesPanel::Schedule SourcesPanel::schedule(const QString &subreddit) const
+{
+    return m_schedules.value(subreddit);
+}
+
+void SourcesPanel::setSchedule(const QString &subreddit, const Schedule &schedule)
+{
+    if (subreddit.isEmpty()) return;
+    m_schedules.insert(subreddit, schedule);
+    refreshLabel(subreddit);
+}
+
+void SourcesPanel::refreshLabel(const QString &raw)
+{
+    QListWidgetItem *it = nullptr;
+    for (int i=0;i<m_list->count() && !it;++i) {
+        QListWidgetItem *cand = m_list->item(i);
+        QString name = cand->data(Qt::UserRole).toString();
+        if (name.isEmpty()) name = cand->text();
+        if (name == raw) it = cand;
+    }
+    if (!it) return;
+    int c = m_counts.value(raw, 0);
+    QString labelText;
+    if (c > 0) labelText = QString("%1 (%2)").arg(raw).arg(c);
+    else labelText = raw;
+    QString tip = raw;
+    // the scheduler's decision: when this source is polled next, and why
+    const Schedule sched = m_schedules.value(raw);
+    if (sched.nextScan.isValid() && it->checkState() == Qt::Checked) {
+        const QDateTime next = sched.nextScan.toLocalTime();
+        const bool due = next <= QDateTime::currentDateTime();
+        labelText += due ? QString(" - due") : QString(" - next %1").arg(next.toString("HH:mm"));
+        tip += QString("\nnext scan: %1").arg(next.toString(Qt::ISODate));
+    }
+    if (sched.imagesPerHour >= 0) tip += QString("\n~%1 new images/hour").arg(sched.imagesPerHour, 0, 'f', 1);
+    if (m_lastUpdated.contains(raw)) tip += QString("\nlast scanned: %1").arg(m_lastUpdated.value(raw).toLocalTime().toString(Qt::ISODate));
+    // update label if we created a custom widget for this raw name
+    if (m_itemLabels.contains(raw)) {
+        m_itemLabels.value(raw)->setText(labelText);
+        m_itemLabels.value(raw)->setToolTip(tip);
+        it->setToolTip(tip);
+    } else {
+        // fallback to modifying the item text
+        it->setText(labelText);
+        it->setToolTip(tip);
+    }
+}
+
 void SourcesPanel::updateCounts(const QString &cacheDir)
 {
     if (cacheDir.isEmpty()) return;
-    QString indexPath = cacheDir + "/index.json";
-    QFile f(indexPath);
-    QMap<QString,int> counts;
-    if (f.open(QIODevice::ReadOnly)) {
-        QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
-        f.close();
-        if (doc.isObject()) {
-            QJsonObject obj = doc.object();
-            for (auto it = obj.constBegin(); it != obj.constEnd(); ++it) {
-                QJsonObject entry = it.value().toObject();
-                QString sub = entry.value("subreddit").toString();
-                if (!sub.isEmpty()) counts[sub] += 1;
-            }
+    const auto table = IndexStore::forCacheDir(cacheDir)->table();
+    // recount only when the index snapshot changed since the last call
+    if (cacheDir != m_countsCacheDir || table->version() != m_countsVersion) {
+        m_counts.clear();
+        // count by interned subreddit ID, then resolve names once
+        QVector<int> perId(table->subreddits().size(), 0);
+        for (int r = 0; r < table->rowCount(); ++r) {
+            const quint16 id = table->subredditId(r);
+            if (id != MetadataTable::kNoSubreddit) perId[id] += 1;
         }
+        for (int i = 0; i < perId.size(); ++i) m_counts[table->subreddits().at(i)] += perId.at(i);
+        m_countsCacheDir = cacheDir;
+        m_countsVersion = table->version();
     }
 
     // Update displayed text for each list item to include count
-    for (int i=0;i<m_list->count();++i) {
-        QListWidgetItem *it = m_list->item(i);
-        QString raw = it->data(Qt::UserRole).toString();
-        if (raw.isEmpty()) raw = it->text();
-        int c = counts.value(raw, 0);
-        QString labelText;
-        if (c > 0) labelText = QString("%1 (%2)").arg(raw).arg(c);
-        else labelText = raw;
-        // update label if we created a custom widget for this raw name
-        if (m_itemLabels.contains(raw)) {
-            m_itemLabels.value(raw)->setText(labelText);
-            // Ensure the underlying QListWidgetItem has a sensible tooltip
-            it->setToolTip(raw);
-        } else {
-            // fallback to modifying the item text
-            if (c > 0) it->setText(QString("%1 (%2)").arg(raw).arg(c));
-            else it->setText(raw);
-            it->setToolTip(raw);
-        }
-    }
+    for (const QString &raw : sources()) refreshLabel(raw);
 }
 
 void SourcesPanel::startUpdateProgress(const QString &subreddit)
@@ -318,6 +378,15 @@ void SourcesPanel::setUpdateProgress(const QString &subreddit, int percent)
     p->setVisible(true);
 }
 
+void SourcesPanel::setUpdatesPaused(bool paused)
+{
+    m_updatesPaused = paused;
+    // grey out running bars while the scan is paused
+    for (QProgressBar *p : std::as_const(m_itemProgress)) {
+        if (p) p->setEnabled(!paused);
+    }
+}
+
 void SourcesPanel::finishUpdateProgress(const QString &subreddit)
 {
     if (subreddit.isEmpty()) return;
@@ -327,6 +396,7 @@ void SourcesPanel::finishUpdateProgress(const QString &subreddit)
     p->setVisible(false);
     p->setRange(0, 100);
     p->setValue(0);
+    p->setEnabled(true);
 }
 
 // No manual moc include; AUTOMOC will generate the necessary meta-object code.
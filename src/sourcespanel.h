@@ -22,7 +22,14 @@ public:
     // last-updated timestamps per subreddit (may be null/invalid if never updated)
     QMap<QString, QDateTime> lastUpdatedMap() const;
     void setLastUpdated(const QString &subreddit, const QDateTime &when);
-    // Update displayed per-subreddit cached counts by reading index.json in cacheDir
+    // background polling state (see ScanScheduler), shown next to each source
+    struct Schedule {
+        double imagesPerHour = -1;  // estimated arrival rate; < 0 if unknown
+        QDateTime nextScan;         // invalid if never scheduled
+    };
+    Schedule schedule(const QString &subreddit) const;
+    void setSchedule(const QString &subreddit, const Schedule &schedule);
+    // Update displayed per-subreddit cached counts from the cache dir's index store
     void updateCounts(const QString &cacheDir);
 
     // load/save as a JSON array in a file
@@ -33,6 +40,8 @@ public:
     void startUpdateProgress(const QString &subreddit);
     void setUpdateProgress(const QString &subreddit, int percent);
     void finishUpdateProgress(const QString &subreddit);
+    // Reflect the running scan's pause state in the bars and context menu
+    void setUpdatesPaused(bool paused);
 
 signals:
     void sourcesChanged(const QStringList &sources);
@@ -40,17 +49,30 @@ signals:
     void enabledSourcesChanged(const QStringList &enabled);
     // Request an update for a single subreddit with the given per-subreddit limit
     void updateRequested(const QString &subreddit, int perSubLimit);
+    // Request a scan of posts older than any scanned so far
+    void backfillRequested(const QString &subreddit);
+    // Scan controls from the context menu of a subreddit being scanned
+    void pauseUpdatesRequested(bool paused);
+    void cancelUpdateRequested(const QString &subreddit);
 
 
 private:
     // Create a QListWidgetItem and its corresponding custom widget (label + progress bar)
     void createListItem(const QString &raw, bool enabled = true);
+    // Label text and tooltip from the cached count and schedule
+    void refreshLabel(const QString &raw);
     QListWidget *m_list = nullptr;
     QLineEdit *m_edit = nullptr;
     QPushButton *m_btnAdd = nullptr;
     QMap<QString, QDateTime> m_lastUpdated;
+    QMap<QString, Schedule> m_schedules;
     // Per-item widgets
     QMap<QString, QWidget*> m_itemWidgets;
     QMap<QString, QLabel*> m_itemLabels;
     QMap<QString, QProgressBar*> m_itemProgress;
+    // per-subreddit image counts for the index snapshot m_countsVersion
+    QMap<QString, int> m_counts;
+    QString m_countsCacheDir;
+    quint64 m_countsVersion = 0;
+    bool m_updatesPaused = false;
 };
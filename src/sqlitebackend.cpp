@@ -0,0 +1,266 @@
+#include "sqlitebackend.h"
+#include "imagefilter.h"
+#include "metadatatable.h"
+#include "perflog.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QRandomGenerator>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QDebug>
+
+SqliteBackend::SqliteBackend(const QString &dbPath)
+{
+    m_connectionName = QString("wallaroo-index-%1").arg(quintptr(this), 0, 16);
+    m_db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    m_db.setDatabaseName(dbPath);
+    if (!m_db.open()) {
+        qWarning() << "SqliteBackend: failed to open" << dbPath << m_db.lastError().text();
+        return;
+    }
+    m_ok = ensureSchema();
+}
+
+SqliteBackend::~SqliteBackend()
+{
+    m_db.close();
+    m_db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool SqliteBackend::ensureSchema()
+{
+    QSqlQuery q(m_db);
+    const char *statements[] = {
+        "PRAGMA journal_mode=WAL",
+        "PRAGMA synchronous=NORMAL",
+        "CREATE TABLE IF NOT EXISTS meta (name TEXT PRIMARY KEY, value TEXT)",
+        "CREATE TABLE IF NOT EXISTS images ("
+        " key TEXT PRIMARY KEY,"
+        " subreddit TEXT NOT NULL DEFAULT '',"
+        " favorite INTEGER NOT NULL DEFAULT 0,"
+        " banned INTEGER NOT NULL DEFAULT 0,"
+        " width INTEGER NOT NULL DEFAULT 0,"
+        " height INTEGER NOT NULL DEFAULT 0,"
+        " downloaded_at TEXT NOT NULL DEFAULT '',"
+        " random_key INTEGER NOT NULL)",
+        "CREATE INDEX IF NOT EXISTS images_subreddit ON images(subreddit)",
+        "CREATE INDEX IF NOT EXISTS images_favorite ON images(favorite)",
+        "CREATE INDEX IF NOT EXISTS images_banned ON images(banned)",
+        "CREATE INDEX IF NOT EXISTS images_size ON images(width, height)",
+        "CREATE INDEX IF NOT EXISTS images_downloaded ON images(downloaded_at)",
+        "CREATE INDEX IF NOT EXISTS images_random ON images(random_key)"
+    };
+    for (const char *sql : statements) {
+        if (!q.exec(QString::fromLatin1(sql))) {
+            qWarning() << "SqliteBackend: schema error" << q.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+void SqliteBackend::setMeta(const QString &name, const QString &value)
+{
+    QSqlQuery q(m_db);
+    q.prepare("INSERT OR REPLACE INTO meta(name, value) VALUES(?, ?)");
+    q.addBindValue(name);
+    q.addBindValue(value);
+    q.exec();
+}
+
+QString SqliteBackend::meta(const QString &name) const
+{
+    QSqlQuery q(m_db);
+    q.prepare("SELECT value FROM meta WHERE name = ?");
+    q.addBindValue(name);
+    if (q.exec() && q.next()) return q.value(0).toString();
+    return QString();
+}
+
+void SqliteBackend::importIfNeeded(const MetadataTable &table)
+{
+    if (!m_ok) return;
+    int rows = 0;
+    QSqlQuery count(m_db);
+    if (count.exec("SELECT COUNT(*) FROM images") && count.next()) rows = count.value(0).toInt();
+    // changes are only mirrored lazily, so anything but a clean shutdown means
+    // the table may be behind the journal: re-import in that case
+    bool inSync = meta("clean_shutdown") == "1" && rows == table.rowCount();
+    setMeta("clean_shutdown", "0");
+    if (inSync) return;
+
+    QElapsedTimer timer; timer.start();
+    m_db.transaction();
+    QSqlQuery clear(m_db);
+    clear.exec("DELETE FROM images");
+    for (int row = 0; row < table.rowCount(); ++row) upsert(table.key(row), table.entryJson(row));
+    if (!m_db.commit()) {
+        qWarning() << "SqliteBackend: import failed" << m_db.lastError().text();
+        return;
+    }
+    qCDebug(lcPerf) << "SqliteBackend: imported" << table.rowCount() << "entries from the index ms=" << timer.elapsed();
+}
+
+void SqliteBackend::entryChanged(const QString &key, const QJsonObject &entry)
+{
+    QMutexLocker lock(&m_pendingMutex);
+    m_pendingRemovals.remove(key);
+    m_pending.insert(key, entry);
+}
+
+void SqliteBackend::entryRemoved(const QString &key)
+{
+    QMutexLocker lock(&m_pendingMutex);
+    m_pending.remove(key);
+    m_pendingRemovals.insert(key);
+}
+
+void SqliteBackend::sync()
+{
+    if (!m_ok) return;
+    drainPending();
+    setMeta("clean_shutdown", "1");
+}
+
+void SqliteBackend::drainPending()
+{
+    QHash<QString, QJsonObject> changed;
+    QSet<QString> removed;
+    {
+        QMutexLocker lock(&m_pendingMutex);
+        changed.swap(m_pending);
+        removed.swap(m_pendingRemovals);
+    }
+    if (changed.isEmpty() && removed.isEmpty()) return;
+    m_db.transaction();
+    for (auto it = changed.constBegin(); it != changed.constEnd(); ++it) upsert(it.key(), it.value());
+    QSqlQuery del(m_db);
+    del.prepare("DELETE FROM images WHERE key = ?");
+    for (const QString &key : removed) {
+        del.bindValue(0, key);
+        del.exec();
+    }
+    if (!m_db.commit()) qWarning() << "SqliteBackend: failed to apply changes" << m_db.lastError().text();
+}
+
+bool SqliteBackend::upsert(const QString &key, const QJsonObject &entry)
+{
+    // keep an existing random_key so the random order stays stable
+    QSqlQuery q(m_db);
+    q.prepare("INSERT INTO images(key, subreddit, favorite, banned, width, height, downloaded_at, random_key)"
+              " VALUES(?, ?, ?, ?, ?, ?, ?, ?)"
+              " ON CONFLICT(key) DO UPDATE SET subreddit=excluded.subreddit, favorite=excluded.favorite,"
+              " banned=excluded.banned, width=excluded.width, height=excluded.height,"
+              " downloaded_at=excluded.downloaded_at");
+    q.addBindValue(key);
+    q.addBindValue(ImageFilter::normalizeSubreddit(entry.value("subreddit").toString()));
+    q.addBindValue(entry.value("favorite").toBool(false) ? 1 : 0);
+    q.addBindValue(entry.value("banned").toBool(false) ? 1 : 0);
+    q.addBindValue(entry.value("width").toInt(0));
+    q.addBindValue(entry.value("height").toInt(0));
+    q.addBindValue(entry.value("downloaded_at").toString());
+    q.addBindValue(qint64(QRandomGenerator::global()->generate64() >> 1));
+    if (!q.exec()) {
+        qWarning() << "SqliteBackend: upsert failed for" << key << q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+QString SqliteBackend::whereClause(const ImageFilter &filter, QVariantList &binds) const
+{
+    QStringList terms;
+    terms << "banned = 0";
+    if (filter.favoritesOnly) terms << "favorite = 1";
+    if (!filter.allowedSubreddits.isEmpty()) {
+        QStringList marks;
+        for (const QString &s : filter.allowedSubreddits) {
+            marks << "?";
+            binds << s;
+        }
+        terms << QString("subreddit IN (%1)").arg(marks.join(", "));
+    }
+    if (filter.mode == ImageFilter::Exact) {
+        if (!filter.selectedResolutions.isEmpty()) {
+            QStringList alts;
+            for (const QSize &s : filter.selectedResolutions) {
+                alts << "(width = ? AND height = ?)";
+                binds << s.width() << s.height();
+            }
+            terms << QString("(%1)").arg(alts.join(" OR "));
+        } else {
+            terms << "height > 0 AND width > 0 AND abs(CAST(width AS REAL) / height - ?) <= 0.03";
+            binds << filter.targetAspect;
+        }
+    } else if (filter.mode == ImageFilter::Rough) {
+        // same rule as ImageFilter::acceptsSize: orientation, then the center crop must cover the screen
+        terms << "height > 0 AND width > 0";
+        terms << (filter.targetAspect >= 1.0 ? "width >= height" : "width < height");
+        terms << "(CASE WHEN CAST(width AS REAL) / height > ?"
+                 " THEN height >= ? AND CAST(height * ? + 0.5 AS INTEGER) >= ?"
+                 " ELSE width >= ? AND CAST(width / ? + 0.5 AS INTEGER) >= ? END)";
+        binds << filter.targetAspect
+              << filter.screenSize.height() << filter.targetAspect << filter.screenSize.width()
+              << filter.screenSize.width() << filter.targetAspect << filter.screenSize.height();
+    }
+    return terms.join(" AND ");
+}
+
+QStringList SqliteBackend::query(const ImageFilter &filter)
+{
+    QStringList out;
+    if (!m_ok) return out;
+    drainPending();
+    QVariantList binds;
+    QString sql = QString("SELECT key FROM images WHERE %1 ORDER BY downloaded_at DESC").arg(whereClause(filter, binds));
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    q.prepare(sql);
+    for (const QVariant &v : binds) q.addBindValue(v);
+    if (!q.exec()) {
+        qWarning() << "SqliteBackend: query failed" << q.lastError().text();
+        return out;
+    }
+    while (q.next()) out << q.value(0).toString();
+    return out;
+}
+
+QString SqliteBackend::randomKey(const ImageFilter &filter)
+{
+    if (!m_ok) return QString();
+    drainPending();
+    QVariantList binds;
+    const QString where = whereClause(filter, binds);
+    // a random pivot into the random_key index: the first accepted row at or
+    // after it, wrapping to the smallest key. No count and no offset walk;
+    // INDEXED BY keeps the planner from sorting the rows an equality index
+    // (e.g. images_banned) would give it.
+    const qint64 pivot = qint64(QRandomGenerator::global()->generate64() >> 1);
+    QString key;
+    for (const bool wrap : { false, true }) {
+        QSqlQuery q(m_db);
+        q.prepare(QString("SELECT key FROM images INDEXED BY images_random WHERE %1%2 ORDER BY random_key LIMIT 1")
+                      .arg(where, wrap ? QString() : QString(" AND random_key >= ?")));
+        for (const QVariant &v : binds) q.addBindValue(v);
+        if (!wrap) q.addBindValue(pivot);
+        if (!q.exec()) {
+            qWarning() << "SqliteBackend: random pick failed" << q.lastError().text();
+            return QString();
+        }
+        if (q.next()) {
+            key = q.value(0).toString();
+            break;
+        }
+    }
+    if (key.isEmpty()) return key;
+    // a row after a wide gap in random_key is picked more often; giving the
+    // picked row a new key keeps that from sticking to the same rows
+    QSqlQuery reroll(m_db);
+    reroll.prepare("UPDATE images SET random_key = ? WHERE key = ?");
+    reroll.addBindValue(qint64(QRandomGenerator::global()->generate64() >> 1));
+    reroll.addBindValue(key);
+    if (!reroll.exec()) qWarning() << "SqliteBackend: failed to re-key" << key << reroll.lastError().text();
+    return key;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "metadatabackend.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QSqlDatabase>
+#include <QVariantList>
+
+// SQLite mirror of index.json with indexes on the filtered columns.
+// Queries, import and sync must run on the thread that created the backend;
+// entryChanged/entryRemoved only queue work and are safe from any thread.
+class SqliteBackend : public MetadataBackend {
+public:
+    explicit SqliteBackend(const QString &dbPath);
+    ~SqliteBackend() override;
+
+    QString name() const override { return "sqlite"; }
+    void importIfNeeded(const MetadataTable &table) override;
+    void entryChanged(const QString &key, const QJsonObject &entry) override;
+    void entryRemoved(const QString &key) override;
+    void sync() override;
+    QStringList query(const ImageFilter &filter) override;
+    QString randomKey(const ImageFilter &filter) override;
+
+private:
+    bool ensureSchema();
+    // Apply queued changes in one transaction
+    void drainPending();
+    bool upsert(const QString &key, const QJsonObject &entry);
+    void setMeta(const QString &name, const QString &value);
+    QString meta(const QString &name) const;
+    // WHERE clause (without the keyword) and its bound values for a filter
+    QString whereClause(const ImageFilter &filter, QVariantList &binds) const;
+
+    QString m_connectionName;
+    QSqlDatabase m_db;
+    bool m_ok = false;
+    QMutex m_pendingMutex;
+    // changes queued since the last drain (latest entry per key)
+    QHash<QString, QJsonObject> m_pending;
+    QSet<QString> m_pendingRemovals;
+};
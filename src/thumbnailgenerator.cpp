@@ -0,0 +1,116 @@
+#include "thumbnailgenerator.h"
+
+#include <QBuffer>
+#include <QFile>
+#include <QImageReader>
+#include <QRegularExpression>
+#include <QDebug>
+#include <iterator>
+
+QString ThumbnailGenerator::thumbnailName(const QByteArray &hash)
+{
+    return QString::fromUtf8(hash) + "-thumb.jpg";
+}
+
+QString ThumbnailGenerator::levelPath(const QString &thumbPath, int level)
+{
+    if (level == kBaseLevel || !thumbPath.endsWith(QLatin1String("-thumb.jpg"))) return thumbPath;
+    return thumbPath.chopped(4) + QString("-%1.jpg").arg(level);
+}
+
+QStringList ThumbnailGenerator::levelPaths(const QString &thumbPath)
+{
+    QStringList out;
+    for (int level : kLevels) out << levelPath(thumbPath, level);
+    return out;
+}
+
+int ThumbnailGenerator::levelFor(int pixels)
+{
+    for (int level : kLevels) {
+        if (level >= pixels) return level;
+    }
+    return std::end(kLevels)[-1];
+}
+
+bool ThumbnailGenerator::isThumbnailName(const QString &fileName)
+{
+    static const QRegularExpression re(R"(-thumb(?:-\d+)?\.jpg$)");
+    return re.match(fileName).hasMatch();
+}
+
+QImage ThumbnailGenerator::load(QImageReader &reader, int box, QSize *originalSize)
+{
+    const QSize full = reader.size();
+    if (originalSize) *originalSize = full;
+    if (full.isValid() && (full.width() > box || full.height() > box)) {
+        // the handler (or QImageReader, for formats that can't) scales to this
+        reader.setQuality(kDecodeQuality);
+        reader.setScaledSize(full.scaled(box, box, Qt::KeepAspectRatio).expandedTo(QSize(1, 1)));
+        return reader.read();
+    }
+    QImage img = reader.read();
+    // no size in the header: scale after the full decode
+    if (!img.isNull() && (img.width() > box || img.height() > box)) {
+        if (originalSize) *originalSize = img.size();
+        return img.scaled(box, box, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    if (originalSize && !full.isValid()) *originalSize = img.size();
+    return img;
+}
+
+QImage ThumbnailGenerator::load(const QString &path, int box, QSize *originalSize)
+{
+    QImageReader r(path);
+    return load(r, box, originalSize);
+}
+
+QImage ThumbnailGenerator::loadMapped(const QString &path, int box, QSize *originalSize)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return QImage();
+    const qint64 len = f.size();
+    uchar *mapped = len > 0 ? f.map(0, len) : nullptr;
+    if (!mapped) return load(path, box, originalSize);
+    QImage img = load(QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), qsizetype(len)), box, originalSize);
+    f.unmap(mapped);
+    return img;
+}
+
+QImage ThumbnailGenerator::load(const QByteArray &data, int box, QSize *originalSize)
+{
+    QByteArray bytes = data;
+    QBuffer buf(&bytes);
+    buf.open(QIODevice::ReadOnly);
+    QImageReader r(&buf);
+    return load(r, box, originalSize);
+}
+
+bool ThumbnailGenerator::generate(const QString &imagePath, const QString &thumbPath, QSize *originalSize, bool mapped)
+{
+    // one decode at the largest level; smaller levels are cheap resamples of it
+    const int top = std::end(kLevels)[-1];
+    return writeLevels(mapped ? loadMapped(imagePath, top, originalSize)
+                              : load(imagePath, top, originalSize), thumbPath);
+}
+
+bool ThumbnailGenerator::generate(const QByteArray &data, const QString &thumbPath, QSize *originalSize)
+{
+    return writeLevels(load(data, std::end(kLevels)[-1], originalSize), thumbPath);
+}
+
+bool ThumbnailGenerator::writeLevels(QImage img, const QString &thumbPath)
+{
+    if (img.isNull()) return false;
+    bool ok = true;
+    for (auto it = std::rbegin(kLevels); it != std::rend(kLevels); ++it) {
+        // each level from the one above, so no step shrinks by much more than 2x
+        if (img.width() > *it || img.height() > *it) img = img.scaled(*it, *it, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        const QString path = levelPath(thumbPath, *it);
+        if (!img.save(path, "JPEG", kJpegQuality)) {
+            qWarning() << "ThumbnailGenerator: failed to write" << path;
+            ok = false;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+class QImageReader;
+
+// The one place thumbnails are decoded. The reader is given the final size
+// up front (QImageReader::setScaledSize), so formats that can decode at
+// reduced size do: JPEG picks the coarsest DCT scale (M/8) that still covers
+// it, and a 7680x4320 wallpaper decodes as ~960x540 instead of 33 MP before a
+// small smooth resample to the box. Formats without that (PNG) are decoded
+// fully and resampled smoothly, as before.
+//
+// Each image gets a small pyramid of thumbnails, written in one pass from a
+// single decode: "<hash>-thumb.jpg" (kBaseLevel, the name the index records)
+// plus "<hash>-thumb-<px>.jpg" for the other levels, so views can pick the
+// level that covers their size and device pixel ratio.
+class ThumbnailGenerator {
+public:
+    static constexpr int kLevels[] = { 128, 256, 512 };
+    static constexpr int kBaseLevel = 256;
+    static constexpr int kJpegQuality = 85;
+    // reader quality: >= 50 keeps the accurate DCT and a smooth final resample
+    static constexpr int kDecodeQuality = 100;
+
+    // "<hash>-thumb.jpg", next to the image in the cache dir
+    static QString thumbnailName(const QByteArray &hash);
+    // Path of one pyramid level, given the base thumbnail's path or name
+    static QString levelPath(const QString &thumbPath, int level);
+    // All levels of the pyramid, base included
+    static QStringList levelPaths(const QString &thumbPath);
+    // Smallest level covering `pixels` (device pixels), else the largest
+    static int levelFor(int pixels);
+    // True for pyramid files (any level), which aren't cached images
+    static bool isThumbnailName(const QString &fileName);
+
+    // Decode to fit within box x box (never enlarged). originalSize, if
+    // given, receives the full image size from the header.
+    static QImage load(QImageReader &reader, int box, QSize *originalSize = nullptr);
+    static QImage load(const QString &path, int box, QSize *originalSize = nullptr);
+    // Same, reading through a read-only mapping of the file: for images just
+    // written, which are still in the page cache
+    static QImage loadMapped(const QString &path, int box, QSize *originalSize = nullptr);
+    // Same, from encoded bytes already in memory
+    static QImage load(const QByteArray &data, int box, QSize *originalSize = nullptr);
+
+    // Write every pyramid level of imagePath, thumbPath naming the base level
+    static bool generate(const QString &imagePath, const QString &thumbPath,
+                         QSize *originalSize = nullptr, bool mapped = false);
+    // Same, from the encoded image in memory (e.g. a download just ingested)
+    static bool generate(const QByteArray &data, const QString &thumbPath, QSize *originalSize = nullptr);
+
+private:
+    static bool writeLevels(QImage img, const QString &thumbPath);
+};
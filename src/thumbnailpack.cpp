@@ -0,0 +1,417 @@
+#include "thumbnailpack.h"
+#include "thumbnailgenerator.h"
+#include "perflog.h"
+
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QPair>
+#include <QVector>
+#include <QSaveFile>
+#include <QThreadPool>
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+
+#include <unistd.h>
+
+namespace {
+
+const char kFileMagic[4] = { 'W', 'T', 'P', 'K' };
+const char kRecordMagic[4] = { 'T', 'I', 'L', 'E' };
+constexpr qint64 kFileHeaderBytes = 16;
+
+struct RecordHeader {
+    char magic[4];
+    quint16 level;
+    quint16 width;
+    quint16 height;
+    quint16 keyLen;
+    quint32 bytesPerLine;
+    char key[ThumbnailPack::kMaxKeyBytes];
+};
+static_assert(sizeof(RecordHeader) % 16 == 0, "pixels must stay 16-byte aligned");
+
+qint64 padded(qint64 n) {
+    return (n + 15) & ~qint64(15);
+}
+
+qint64 recordBytes(const RecordHeader &h) {
+    return qint64(sizeof(RecordHeader)) + padded(qint64(h.bytesPerLine) * h.height);
+}
+
+QByteArray fileHeader() {
+    QByteArray out(kFileHeaderBytes, '\0');
+    std::memcpy(out.data(), kFileMagic, 4);
+    const quint32 version = ThumbnailPack::kVersion;
+    std::memcpy(out.data() + 4, &version, sizeof(version));
+    return out;
+}
+
+} // namespace
+
+ThumbnailPack *ThumbnailPack::forCacheDir(const QString &cacheDir)
+{
+    static QMutex registryMutex;
+    static QHash<QString, ThumbnailPack*> registry;
+
+    const QString dirPath = QDir(cacheDir).absolutePath();
+    QMutexLocker lock(&registryMutex);
+    ThumbnailPack *pack = registry.value(dirPath, nullptr);
+    if (!pack) {
+        pack = new ThumbnailPack(QDir(dirPath).filePath("thumbs.pack"));
+        registry.insert(dirPath, pack);
+    }
+    return pack;
+}
+
+ThumbnailPack::ThumbnailPack(const QString &path)
+    : m_path(path)
+{
+    QMutexLocker lock(&m_mutex);
+    openLocked();
+}
+
+qint64 ThumbnailPack::Loc::recordBytes() const
+{
+    return qint64(sizeof(RecordHeader)) + padded(qint64(bytesPerLine) * height);
+}
+
+QString ThumbnailPack::tileKey(const QString &key, int level)
+{
+    return key + QLatin1Char('@') + QString::number(level);
+}
+
+bool ThumbnailPack::openLocked()
+{
+    m_file = std::make_unique<QFile>(m_path);
+    m_current = nullptr;
+    m_tiles.clear();
+    m_size = 0;
+    m_deadBytes = 0;
+    if (!m_file->open(QIODevice::ReadWrite)) {
+        qWarning() << "ThumbnailPack: cannot open" << m_path;
+        m_file.reset();
+        return false;
+    }
+    const qint64 size = m_file->size();
+    const QByteArray header = m_file->read(kFileHeaderBytes);
+    quint32 version = 0;
+    if (header.size() == kFileHeaderBytes) std::memcpy(&version, header.constData() + 4, sizeof(version));
+    if (header.size() != kFileHeaderBytes || std::memcmp(header.constData(), kFileMagic, 4) != 0 || version != kVersion) {
+        // new, foreign or older pack: start over
+        m_file->resize(0);
+        m_file->seek(0);
+        m_file->write(fileHeader());
+        m_file->flush();
+        m_size = kFileHeaderBytes;
+        return true;
+    }
+
+    // walk the record headers to rebuild the offset table
+    uchar *data = size > kFileHeaderBytes ? m_file->map(0, size) : nullptr;
+    qint64 pos = kFileHeaderBytes;
+    while (data && pos + qint64(sizeof(RecordHeader)) <= size) {
+        RecordHeader h;
+        std::memcpy(&h, data + pos, sizeof(h));
+        if (std::memcmp(h.magic, kRecordMagic, 4) != 0 || h.keyLen > kMaxKeyBytes
+            || h.bytesPerLine < quint32(h.width) * 4 || pos + recordBytes(h) > size) break;
+        Loc loc;
+        loc.offset = pos + sizeof(RecordHeader);
+        loc.width = h.width;
+        loc.height = h.height;
+        loc.bytesPerLine = h.bytesPerLine;
+        const QString key = tileKey(QString::fromLatin1(h.key, h.keyLen), h.level);
+        auto old = m_tiles.constFind(key);
+        if (old != m_tiles.constEnd()) m_deadBytes += old->recordBytes();
+        m_tiles.insert(key, loc);
+        pos += recordBytes(h);
+    }
+    m_size = pos;
+    if (data && pos == size) {
+        // the walk's mapping serves the first images
+        auto m = std::make_unique<Mapping>();
+        m->pack = this;
+        m->file = m_file.get();
+        m->data = data;
+        m->size = size;
+        m_current = m.get();
+        m_mappings.push_back(std::move(m));
+    } else if (data) {
+        m_file->unmap(data);
+    }
+    if (pos < size) {
+        qWarning() << "ThumbnailPack: dropping" << size - pos << "bytes of torn records from" << m_path;
+        m_file->resize(pos);
+    }
+    qCDebug(lcPerf) << "ThumbnailPack: loaded" << m_tiles.size() << "tiles," << m_size << "bytes," << m_deadBytes << "dead from" << m_path;
+    return true;
+}
+
+const uchar *ThumbnailPack::mappedLocked(qint64 offset, qint64 len)
+{
+    if (!m_file || offset + len > m_size) return nullptr;
+    if (!m_current || offset + len > m_current->size) {
+        // one mapping of the whole file rather than one per appended tail
+        uchar *p = m_file->map(0, m_size);
+        if (!p) return nullptr;
+        retireMappingLocked();
+        auto m = std::make_unique<Mapping>();
+        m->pack = this;
+        m->file = m_file.get();
+        m->data = p;
+        m->size = m_size;
+        m_current = m.get();
+        m_mappings.push_back(std::move(m));
+    }
+    return m_current->data + offset;
+}
+
+void ThumbnailPack::retireMappingLocked()
+{
+    Mapping *old = m_current;
+    m_current = nullptr;
+    if (old && old->images == 0) unmapLocked(old);
+}
+
+void ThumbnailPack::unmapLocked(Mapping *m)
+{
+    QFile *file = m->file;
+    file->unmap(m->data);
+    m_mappings.erase(std::find_if(m_mappings.begin(), m_mappings.end(),
+                                  [m](const std::unique_ptr<Mapping> &p) { return p.get() == m; }));
+    // a file replaced by compaction is closed with its last mapping
+    if (file == m_file.get()) return;
+    const bool mapped = std::any_of(m_mappings.begin(), m_mappings.end(),
+                                    [file](const std::unique_ptr<Mapping> &p) { return p->file == file; });
+    if (!mapped) {
+        m_retired.erase(std::find_if(m_retired.begin(), m_retired.end(),
+                                     [file](const std::unique_ptr<QFile> &f) { return f.get() == file; }));
+    }
+}
+
+void ThumbnailPack::releaseImage(void *mapping)
+{
+    Mapping *m = static_cast<Mapping*>(mapping);
+    ThumbnailPack *pack = m->pack;
+    QMutexLocker lock(&pack->m_mutex);
+    if (--m->images == 0 && m != pack->m_current) pack->unmapLocked(m);
+}
+
+QImage ThumbnailPack::image(const QString &key, int level)
+{
+    QMutexLocker lock(&m_mutex);
+    auto it = m_tiles.constFind(tileKey(key, level));
+    if (it == m_tiles.constEnd()) return QImage();
+    const uchar *bits = mappedLocked(it->offset, qint64(it->bytesPerLine) * it->height);
+    if (!bits) return QImage();
+    // read-only view over the mapping; writes would detach into a copy. The
+    // mapping is released with the last image sharing these bits.
+    m_current->images++;
+    return QImage(bits, it->width, it->height, it->bytesPerLine, QImage::Format_ARGB32_Premultiplied,
+                  &ThumbnailPack::releaseImage, m_current);
+}
+
+bool ThumbnailPack::append(const QString &key, int level, const QImage &img)
+{
+    const QByteArray keyBytes = key.toLatin1();
+    if (img.isNull() || keyBytes.size() > kMaxKeyBytes || level <= 0 || level > 0xffff) return false;
+    const QImage tile = img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    RecordHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kRecordMagic, 4);
+    h.level = quint16(level);
+    h.width = quint16(tile.width());
+    h.height = quint16(tile.height());
+    h.keyLen = quint16(keyBytes.size());
+    h.bytesPerLine = quint32(tile.bytesPerLine());
+    std::memcpy(h.key, keyBytes.constData(), keyBytes.size());
+    const qint64 pixelBytes = qint64(h.bytesPerLine) * h.height;
+
+    QMutexLocker lock(&m_mutex);
+    if (!m_file) return false;
+    if (m_size + recordBytes(h) > kMaxFileBytes) {
+        if (!m_fullReported) {
+            qWarning() << "ThumbnailPack:" << m_path << "is full," << m_deadBytes << "bytes dead";
+            m_fullReported = true;
+        }
+        maybeCompactLocked(true);
+        return false;
+    }
+    m_file->seek(m_size);
+    bool ok = m_file->write(reinterpret_cast<const char*>(&h), sizeof(h)) == qint64(sizeof(h))
+        && m_file->write(reinterpret_cast<const char*>(tile.constBits()), pixelBytes) == pixelBytes;
+    const qint64 pad = padded(pixelBytes) - pixelBytes;
+    if (ok && pad > 0) ok = m_file->write(QByteArray(pad, '\0')) == pad;
+    if (!ok || !m_file->flush()) {
+        qWarning() << "ThumbnailPack: append failed for" << key << "-" << m_file->errorString();
+        m_file->resize(m_size);
+        return false;
+    }
+    Loc loc;
+    loc.offset = m_size + sizeof(RecordHeader);
+    loc.width = h.width;
+    loc.height = h.height;
+    loc.bytesPerLine = h.bytesPerLine;
+    const QString k = tileKey(key, level);
+    auto old = m_tiles.constFind(k);
+    if (old != m_tiles.constEnd()) m_deadBytes += old->recordBytes();
+    m_tiles.insert(k, loc);
+    m_size += recordBytes(h);
+    maybeCompactLocked(false);
+    return true;
+}
+
+void ThumbnailPack::remove(const QString &key)
+{
+    QMutexLocker lock(&m_mutex);
+    for (int level : ThumbnailGenerator::kLevels) {
+        auto it = m_tiles.find(tileKey(key, level));
+        if (it == m_tiles.end()) continue;
+        m_deadBytes += it->recordBytes();
+        m_tiles.erase(it);
+    }
+    maybeCompactLocked(false);
+}
+
+void ThumbnailPack::maybeCompactLocked(bool full)
+{
+    // amortized: a compaction only runs after as many dead bytes as it keeps
+    // live ones, or as soon as it frees space in a full pack
+    const qint64 threshold = full ? kMinDeadBytes : qMax(kMinDeadBytes, m_size / 2);
+    if (m_compactQueued || m_deadBytes < threshold) return;
+    m_compactQueued = true;
+    QThreadPool::globalInstance()->start([this] { compact(); });
+}
+
+qint64 ThumbnailPack::compact(const QSet<QString> &liveKeys)
+{
+    return compactImpl(&liveKeys);
+}
+
+qint64 ThumbnailPack::compact()
+{
+    return compactImpl(nullptr);
+}
+
+qint64 ThumbnailPack::compactImpl(const QSet<QString> *liveKeys)
+{
+    // 1. under the lock: the live records as of now, and a pin on a mapping
+    //    that covers them
+    QVector<QPair<QString, Loc>> snapshot;
+    Mapping *pinned = nullptr;
+    qint64 before = 0;
+    {
+        QMutexLocker lock(&m_mutex);
+        m_compactQueued = false;
+        if (!m_file || m_compacting) return 0;
+        if (m_size > kFileHeaderBytes && !mappedLocked(kFileHeaderBytes, m_size - kFileHeaderBytes)) return 0;
+        m_compacting = true;
+        before = m_size;
+        pinned = m_current;
+        if (pinned) pinned->images++;
+        snapshot.reserve(m_tiles.size());
+        for (auto it = m_tiles.constBegin(); it != m_tiles.constEnd(); ++it) {
+            if (liveKeys && !liveKeys->contains(it.key().left(it.key().lastIndexOf(QLatin1Char('@'))))) continue;
+            snapshot.append({ it.key(), it.value() });
+        }
+    }
+    auto unpin = [this, pinned]() {
+        if (pinned && --pinned->images == 0 && pinned != m_current) unmapLocked(pinned);
+    };
+
+    // 2. without it: copy those records into the new file and sync them.
+    //    Loader threads keep appending to the old file, views keep reading it.
+    QSaveFile out(m_path);
+    QHash<qint64, qint64> moved;  // old pixel offset -> new one
+    bool ok = out.open(QIODevice::WriteOnly) && out.write(fileHeader()) == kFileHeaderBytes;
+    qint64 pos = kFileHeaderBytes;
+    for (const auto &tile : std::as_const(snapshot)) {
+        if (!ok) break;
+        const qint64 len = tile.second.recordBytes();
+        const qint64 start = tile.second.offset - qint64(sizeof(RecordHeader));
+        ok = out.write(reinterpret_cast<const char*>(pinned->data + start), len) == len;
+        moved.insert(tile.second.offset, pos + qint64(sizeof(RecordHeader)));
+        pos += len;
+    }
+    if (ok) ok = out.flush() && ::fsync(out.handle()) == 0;
+
+    // 3. under the lock again: carry over what was appended meanwhile, drop
+    //    what was removed, then swap files
+    QMutexLocker lock(&m_mutex);
+    if (ok) {
+        QHash<QString, Loc> tiles;
+        tiles.reserve(m_tiles.size());
+        for (auto it = m_tiles.constBegin(); ok && it != m_tiles.constEnd(); ++it) {
+            Loc loc = it.value();
+            if (loc.offset < before) {
+                // copied in step 2, unless liveKeys left it out
+                auto m = moved.constFind(loc.offset);
+                if (m == moved.constEnd()) continue;
+                loc.offset = m.value();
+            } else {
+                const qint64 len = loc.recordBytes();
+                const uchar *record = mappedLocked(loc.offset - qint64(sizeof(RecordHeader)), len);
+                ok = record && out.write(reinterpret_cast<const char*>(record), len) == len;
+                loc.offset = pos + qint64(sizeof(RecordHeader));
+                pos += len;
+            }
+            tiles.insert(it.key(), loc);
+        }
+        // removed or superseded since the snapshot: already dead in the new file
+        qint64 live = kFileHeaderBytes;
+        for (const Loc &loc : std::as_const(tiles)) live += loc.recordBytes();
+        const qint64 dead = pos - live;
+        auto file = std::make_unique<QFile>(m_path);
+        if (ok && out.commit() && file->open(QIODevice::ReadWrite)) {
+            // images may still point into the old file: it stays open until
+            // the last of them is gone
+            retireMappingLocked();
+            QFile *old = m_file.get();
+            const bool mapped = std::any_of(m_mappings.begin(), m_mappings.end(),
+                                            [old](const std::unique_ptr<Mapping> &p) { return p->file == old; });
+            if (mapped) m_retired.push_back(std::move(m_file));
+            m_file = std::move(file);
+            m_tiles = std::move(tiles);
+            m_size = pos;
+            m_deadBytes = dead;
+            m_fullReported = false;
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok) {
+        out.cancelWriting();
+        qWarning() << "ThumbnailPack: compaction of" << m_path << "failed";
+    }
+    unpin();
+    m_compacting = false;
+    if (!ok) return 0;
+    qCDebug(lcPerf) << "ThumbnailPack: compacted" << m_path << "to" << m_tiles.size() << "tiles," << before - m_size << "bytes reclaimed,"
+                    << m_retired.size() << "old files still mapped";
+    return before - m_size;
+}
+
+int ThumbnailPack::tileCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_tiles.size();
+}
+
+qint64 ThumbnailPack::fileSize() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_size;
+}
+
+qint64 ThumbnailPack::deadBytes() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_deadBytes;
+}
+
+int ThumbnailPack::mappingCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return int(m_mappings.size());
+}
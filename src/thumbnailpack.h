@@ -0,0 +1,111 @@
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <memory>
+#include <vector>
+
+class QFile;
+
+// Decoded thumbnail tiles for one cache dir, packed into a single append-only
+// file (thumbs.pack). Tiles are premultiplied ARGB32 at the pyramid levels
+// (ThumbnailGenerator::kLevels), appended the first time a level's JPEG is
+// decoded; views draw them at a pixel ratio that fits their cell, without
+// resampling. Later loads build a QImage directly over the memory-mapped
+// bytes: no open, read or decode per tile.
+//
+// File: "WTPK" + version, then records of
+//   [RecordHeader][bytesPerLine * height pixel bytes][pad to 16 bytes]
+// in host byte order (the pack is a local cache, like the thumbnails). The
+// offset table, keyed by image base name (the content hash) and level, is
+// rebuilt by walking the headers on open; a torn last record is cut off. A
+// later record for the same key and level supersedes earlier ones.
+//
+// Superseded and removed tiles are dead bytes. Once they pass half the file
+// (and kMinDeadBytes) a background compaction rewrites the pack without
+// them. Appends that would grow the file past kMaxFileBytes are refused, and
+// the views decode the pyramid JPEG instead.
+//
+// Each QImage keeps the mapping it points into alive. When the file has
+// grown past the current mapping it is mapped again in full; older
+// mappings, and files replaced by compaction, go with their last image.
+class ThumbnailPack {
+public:
+    static ThumbnailPack *forCacheDir(const QString &cacheDir);
+
+    // Tile of `key` at pyramid `level`, or a null image. The image, and
+    // copies sharing its data, keep the mapping valid.
+    QImage image(const QString &key, int level);
+    // Store a tile (converted to ARGB32_Premultiplied); false on error or
+    // when the pack is full
+    bool append(const QString &key, int level, const QImage &img);
+    // Drop every level of `key`, e.g. when its image is deleted
+    void remove(const QString &key);
+    // Rewrite the pack with only the newest tile of each key and level,
+    // restricted to liveKeys if given. Returns the bytes reclaimed. The
+    // records are copied without the lock held, from a snapshot over a
+    // pinned mapping; the lock is taken again only to carry over tiles
+    // appended meanwhile and swap files.
+    qint64 compact(const QSet<QString> &liveKeys);
+    qint64 compact();
+
+    int tileCount() const;
+    qint64 fileSize() const;
+    qint64 deadBytes() const;
+    // Mappings alive: the current one plus older ones images still use
+    int mappingCount() const;
+
+    static constexpr int kMaxKeyBytes = 64;
+    // 2: tiles are stored per pyramid level instead of per device size
+    static constexpr quint32 kVersion = 2;
+    static constexpr qint64 kMaxFileBytes = qint64(1) << 30;
+    static constexpr qint64 kMinDeadBytes = 64 * 1024 * 1024;
+
+private:
+    explicit ThumbnailPack(const QString &path);
+    struct Loc {
+        qint64 offset = 0;  // of the pixels
+        int width = 0;
+        int height = 0;
+        qsizetype bytesPerLine = 0;
+        qint64 recordBytes() const;
+    };
+    struct Mapping {
+        ThumbnailPack *pack = nullptr;
+        QFile *file = nullptr;
+        uchar *data = nullptr;
+        qint64 size = 0;    // maps [0, size) of file
+        int images = 0;     // QImages over it, see releaseImage
+    };
+    static QString tileKey(const QString &key, int level);
+    bool openLocked();
+    // pointer to [offset, offset + len) of the current file, remapping the
+    // whole file if it grew past the current mapping
+    const uchar *mappedLocked(qint64 offset, qint64 len);
+    // the current mapping stops serving new images; unmapped now if unused
+    void retireMappingLocked();
+    void unmapLocked(Mapping *m);
+    // QImage cleanup function for images over a mapping
+    static void releaseImage(void *mapping);
+    qint64 compactImpl(const QSet<QString> *liveKeys);
+    // queue a background compaction once enough of the file is dead
+    void maybeCompactLocked(bool full);
+
+    QString m_path;
+    mutable QMutex m_mutex;
+    std::unique_ptr<QFile> m_file;
+    qint64 m_size = 0;
+    qint64 m_deadBytes = 0;
+    std::vector<std::unique_ptr<Mapping>> m_mappings;
+    Mapping *m_current = nullptr;
+    // files replaced by compact() while images still mapped them
+    std::vector<std::unique_ptr<QFile>> m_retired;
+    QHash<QString, Loc> m_tiles;
+    bool m_compactQueued = false;
+    bool m_fullReported = false;
+    // one compaction at a time
+    bool m_compacting = false;
+};
@@ -1,4 +1,10 @@
 #include "thumbnailviewer.h"
+#include "indexstore.h"
+#include "metadatatable.h"
+#include "cachewatcher.h"
+#include "thumbnailgenerator.h"
+#include "thumbnailpack.h"
+#include "perflog.h"
 #include <QDir>
 #include <QFileInfoList>
 #include <QLabel>
@@ -8,18 +14,19 @@
 #include <QPixmap>
 #include <QMouseEvent>
 #include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QSlider>
 #include <QFileInfo>
-#include <QImageReader>
 #include <QDebug>
 #include <QElapsedTimer>
 #include <QGuiApplication>
 #include <QScreen>
 #include <QThreadPool>
 #include <QRunnable>
-#include <QSaveFile>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <algorithm>
 
 // Simple clickable QLabel
 class ClickableLabel : public QLabel {
@@ -58,8 +65,23 @@ ThumbnailViewer::ThumbnailViewer(QWidget *parent)
     m_scroll->setWidget(m_container);
     m_scroll->setWidgetResizable(true);
 
+    // zoom: reloads from the thumbnail pyramid only, never the originals
+    m_zoom = new QSlider(Qt::Horizontal, this);
+    m_zoom->setRange(kMinThumbSize, kMaxThumbSize);
+    m_zoom->setSingleStep(8);
+    m_zoom->setPageStep(32);
+    m_zoom->setValue(m_thumbSize);
+    m_zoom->setTracking(false);
+    m_zoom->setMaximumWidth(200);
+    connect(m_zoom, &QSlider::valueChanged, this, &ThumbnailViewer::setThumbSize);
+    auto *zoomRow = new QHBoxLayout;
+    zoomRow->addStretch();
+    zoomRow->addWidget(new QLabel("Size", this));
+    zoomRow->addWidget(m_zoom);
+
     auto *layout = new QVBoxLayout(this);
     layout->setContentsMargins(0,0,0,0);
+    layout->addLayout(zoomRow);
     layout->addWidget(m_scroll);
     setLayout(layout);
 
@@ -73,9 +95,26 @@ void ThumbnailViewer::clearGrid()
         l->deleteLater();
     }
     m_labels.clear();
+    m_labelByName.clear();
+}
+
+void ThumbnailViewer::removeThumbnail(const QString &fileName)
+{
+    ClickableLabel *l = m_labelByName.take(fileName);
+    if (!l) return;
+    m_grid->removeWidget(l);
+    m_labels.removeOne(l);
+    l->deleteLater();
 }
 
 void ThumbnailViewer::addThumbnail(const QString &filePath, int row, int col)
+{
+    ClickableLabel *label = createThumbnail(filePath);
+    m_grid->addWidget(label, row, col);
+    m_labels.append(label);
+}
+
+ClickableLabel *ThumbnailViewer::createThumbnail(const QString &filePath)
 {
     auto *label = new ClickableLabel;
     label->setAlignment(Qt::AlignCenter);
@@ -105,30 +144,49 @@ void ThumbnailViewer::addThumbnail(const QString &filePath, int row, int col)
 
     // store file path on the widget for dedupe checks
     label->setProperty("filePath", filePath);
+    m_labelByName.insert(QFileInfo(filePath).fileName(), label);
 
-    m_grid->addWidget(label, row, col);
-    m_labels.append(label);
+    startLoad(filePath, true);
+    return label;
+}
+
+void ThumbnailViewer::startLoad(const QString &filePath, bool allowOriginal)
+{
+    // tiles are kept per pyramid level and shown at a pixel ratio that fits
+    // them to the cell, so zooming within a level reuses them
+    const int level = ThumbnailGenerator::levelFor(qRound(m_thumbSize * devicePixelRatioF()));
+    // packed tile at this level: a QImage over the mapped pack, no file access
+    const QFileInfo info(filePath);
+    const QImage packed = ThumbnailPack::forCacheDir(info.absolutePath())->image(info.baseName(), level);
+    if (!packed.isNull()) {
+        m_packedLoads++;
+        m_pendingLoads++;
+        onThumbnailLoaded(filePath, packed);
+        return;
+    }
 
     // Asynchronously load the thumbnail/image in a background runnable to avoid blocking UI
     QString path = filePath;
     ThumbnailViewer *self = this;
     class LoadRunnable : public QRunnable {
     public:
-        LoadRunnable(const QString &p, ThumbnailViewer *v, int sz) : p(p), viewer(v), thumbSz(sz) {}
+        LoadRunnable(const QString &p, ThumbnailViewer *v, int level, bool orig) : p(p), viewer(v), level(level), allowOriginal(orig) {}
         void run() override {
-            QImage img;
+            QImage scaled;
             QFileInfo fi(p);
-            QString thumbCandidate = fi.absolutePath() + "/" + fi.baseName() + "-thumb.jpg";
-            if (QFile::exists(thumbCandidate)) {
-                QImageReader r(thumbCandidate);
-                img = r.read();
-            }
-            if (img.isNull()) {
-                QImageReader r2(p);
-                img = r2.read();
+            // the pyramid level covering the cell in device pixels, else the
+            // base level (older caches have only that), decoded to the level
+            const QString base = fi.absolutePath() + "/" + fi.baseName() + "-thumb.jpg";
+            QStringList candidates;
+            candidates << ThumbnailGenerator::levelPath(base, level);
+            if (!candidates.contains(base)) candidates << base;
+            for (const QString &c : std::as_const(candidates)) {
+                if (scaled.isNull() && QFile::exists(c)) scaled = ThumbnailGenerator::load(c, level);
             }
-            if (img.isNull()) return;
-            QImage scaled = img.scaled(thumbSz, thumbSz, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            // no thumbnail yet: decode the image itself at reduced size
+            if (scaled.isNull() && allowOriginal) scaled = ThumbnailGenerator::load(p, level);
+            // pack it, so the next load at this level skips the decode
+            if (!scaled.isNull()) ThumbnailPack::forCacheDir(fi.absolutePath())->append(fi.baseName(), level, scaled);
             // invoke the UI thread to set the pixmap using the functor overload (no metatype required)
             // copy members into local variables so the lambda can capture them by value
             ThumbnailViewer *v = viewer;
@@ -141,50 +199,95 @@ void ThumbnailViewer::addThumbnail(const QString &filePath, int row, int col)
     private:
         QString p;
         ThumbnailViewer *viewer;
-        int thumbSz;
+        int level;
+        bool allowOriginal;
     };
-    QThreadPool::globalInstance()->start(new LoadRunnable(path, self, m_thumbSize));
+    m_decodedLoads++;
+    m_pendingLoads++;
+    QThreadPool::globalInstance()->start(new LoadRunnable(path, self, level, allowOriginal));
 }
 
-void ThumbnailViewer::loadFromCache(const QString &cacheDir)
+void ThumbnailViewer::setThumbSize(int size)
 {
-    clearGrid();
+    size = qBound(kMinThumbSize, size, kMaxThumbSize);
+    if (size == m_thumbSize) return;
+    const qreal dpr = devicePixelRatioF();
+    const bool levelChanged = ThumbnailGenerator::levelFor(qRound(size * dpr))
+                              != ThumbnailGenerator::levelFor(qRound(m_thumbSize * dpr));
+    m_thumbSize = size;
+    if (m_zoom->value() != size) {
+        QSignalBlocker block(m_zoom);
+        m_zoom->setValue(size);
+    }
+    // resize in place: the current tiles are refitted to the cell, and only
+    // reloaded when the zoom crosses into another level
+    for (ClickableLabel *l : std::as_const(m_labels)) {
+        l->setFixedSize(m_thumbSize, m_thumbSize);
+        const QPixmap pm = l->pixmap();
+        if (!pm.isNull()) l->setPixmap(cellPixmap(pm));
+        if (levelChanged) startLoad(l->property("filePath").toString(), false);
+    }
+    relayoutGrid();
+    emit thumbSizeChanged(m_thumbSize);
+}
 
+int ThumbnailViewer::thumbSize() const
+{
+    return m_thumbSize;
+}
+
+void ThumbnailViewer::loadFromCache(const QString &cacheDir)
+{
     QElapsedTimer timer; timer.start();
+    m_gridTimer.start();
+    m_packedLoads = 0;
+    m_decodedLoads = 0;
     int scanned = 0;
     int accepted = 0;
 
     QDir dir(cacheDir);
-    if (!dir.exists()) return;
-
-    // load index.json once for metadata lookups
-    m_indexPath = dir.filePath("index.json");
-    m_indexJson = QJsonObject();
-    QFile idxfile(m_indexPath);
-    if (idxfile.open(QIODevice::ReadOnly)) {
-        QJsonDocument doc = QJsonDocument::fromJson(idxfile.readAll());
-        if (doc.isObject()) m_indexJson = doc.object();
-        idxfile.close();
+    if (!dir.exists()) {
+        clearGrid();
+        return;
     }
 
-    // Reset selected resolutions when loading a new cache; caller (FiltersPanel) will be updated
-    m_selectedResolutions.clear();
+    // Existing labels are reused when reloading the same cache dir
+    if (dir.absolutePath() != m_cacheDir) {
+        clearGrid();
+        m_cacheDir = dir.absolutePath();
+        m_resolutionsVersion = ~quint64(0);
+        // Reset selected resolutions when loading a new cache; caller (FiltersPanel) will be updated
+        m_selectedResolutions.clear();
+    }
+
+    // take the in-memory index once for metadata lookups
+    IndexStore *store = IndexStore::forCacheDir(dir.absolutePath());
+    m_indexPath = store->indexPath();
+    m_table = store->table();
 
     // Build the list of files to consider. Prefer entries from index.json for
     // fast metadata lookups (avoids opening/decoding many images). If index.json
     // is empty, fall back to scanning the directory.
     QVector<QFileInfo> fileList;
-    if (!m_indexJson.isEmpty()) {
-        // Iterate index keys and only include files that exist on disk
-        const QJsonObject::Iterator itEnd = m_indexJson.end();
+    // With a metadata backend attached the whole filter is a single indexed
+    // query; the per-file loop below then only looks for missing metadata.
+    const bool prefiltered = store->hasBackend() && m_table->rowCount() > 0;
+    if (prefiltered) {
+        for (const QString &key : store->query(currentFilter())) {
+            QFileInfo fi(dir.filePath(key));
+            if (fi.exists() && fi.isFile()) fileList.append(fi);
+        }
+    }
+    if (m_table->rowCount() > 0) {
+        // Iterate index rows and only include files that exist on disk
         QVector<QFileInfo> missingMeta;
-        for (QJsonObject::Iterator it = m_indexJson.begin(); it != itEnd; ++it) {
-            QString key = it.key();
-            QString path = dir.filePath(key);
+        for (int r = 0; r < m_table->rowCount(); ++r) {
+            bool hasMeta = m_table->hasSize(r);
+            if (prefiltered && hasMeta) continue;
+            QString path = dir.filePath(m_table->key(r));
             QFileInfo fi(path);
             if (!fi.exists() || !fi.isFile()) continue;
-            QJsonObject entry = it.value().toObject();
-            if (entry.contains("width") && entry.contains("height")) {
+            if (hasMeta) {
                 fileList.append(fi);
             } else {
                 // Defer files missing metadata to a background task and skip them for now
@@ -203,38 +306,14 @@ void ThumbnailViewer::loadFromCache(const QString &cacheDir)
                     EnsureMetaRunnable(const QString &filePath, const QString &key, const QString &dirPath)
                         : filePath(filePath), key(key), dirPath(dirPath) {}
                     void run() override {
-                        QImageReader r(filePath);
-                        QSize sz = r.size();
-                        QImage img;
-                        if (sz.isEmpty()) {
-                            img = QImage(filePath);
-                            if (!img.isNull()) sz = img.size();
-                        }
-                        QString thumbName;
-                        if (!img.isNull()) {
-                            QByteArray hash = QFileInfo(filePath).baseName().toUtf8();
-                            thumbName = QString::fromUtf8(hash) + "-thumb.jpg";
-                            QString thumbPath = QDir(dirPath).filePath(thumbName);
-                            QImage thumb = img.scaled(300, 300, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-                            thumb.save(thumbPath, "JPEG", 85);
-                        }
-                        QString indexPath = QDir(dirPath).filePath("index.json");
-                        QJsonObject rootObj;
-                        QFile idxf(indexPath);
-                        if (idxf.open(QIODevice::ReadOnly)) {
-                            QJsonDocument doc = QJsonDocument::fromJson(idxf.readAll());
-                            if (doc.isObject()) rootObj = doc.object();
-                            idxf.close();
-                        }
-                        QJsonObject entry = rootObj.value(key).toObject();
-                        if (!sz.isEmpty()) { entry["width"] = sz.width(); entry["height"] = sz.height(); }
-                        if (!thumbName.isEmpty()) entry["thumbnail"] = thumbName;
-                        rootObj[key] = entry;
-                        QSaveFile sf(indexPath);
-                        if (sf.open(QIODevice::WriteOnly)) {
-                            sf.write(QJsonDocument(rootObj).toJson(QJsonDocument::Indented));
-                            sf.commit();
-                        }
+                        QSize sz;
+                        QByteArray hash = QFileInfo(filePath).baseName().toUtf8();
+                        QString thumbName = ThumbnailGenerator::thumbnailName(hash);
+                        QString thumbPath = QDir(dirPath).filePath(thumbName);
+                        if (!ThumbnailGenerator::generate(filePath, thumbPath, &sz)) thumbName.clear();
+                        IndexStore *store = IndexStore::forCacheDir(dirPath);
+                        store->setSize(key, sz);
+                        store->setThumbnail(key, thumbName);
                     }
                 private:
                     QString filePath;
@@ -245,9 +324,12 @@ void ThumbnailViewer::loadFromCache(const QString &cacheDir)
             }
         }
         // Sort by modification time (newest first) to show recent items first
-        std::sort(fileList.begin(), fileList.end(), [](const QFileInfo &a, const QFileInfo &b){
-            return a.lastModified() > b.lastModified();
-        });
+        // (the backend query already returns newest downloads first)
+        if (!prefiltered) {
+            std::sort(fileList.begin(), fileList.end(), [](const QFileInfo &a, const QFileInfo &b){
+                return a.lastModified() > b.lastModified();
+            });
+        }
     } else {
         QStringList nameFilters;
         // common image extensions
@@ -256,41 +338,124 @@ void ThumbnailViewer::loadFromCache(const QString &cacheDir)
         for (const QFileInfo &fi : files) fileList.append(fi);
     }
 
-    const int columns = computeColumns();
-    int row = 0, col = 0;
+    QStringList paths;
     for (const QFileInfo &fi : fileList) {
         scanned++;
-        // Use acceptsImage which will consult m_indexJson (fast) where possible.
-        if (!acceptsImage(fi.absoluteFilePath())) continue;
+        // Use acceptsImage which will consult m_table (fast) where possible.
+        if (!prefiltered && !acceptsImage(fi.absoluteFilePath())) continue;
         accepted++;
-        addThumbnail(fi.absoluteFilePath(), row, col);
-        // advance grid position only when we actually added a thumbnail
-        col++;
-        if (col >= columns) { col = 0; row++; }
+        paths << fi.absoluteFilePath();
     }
+    const int created = syncLabels(paths);
+    qCDebug(lcPerf) << "ThumbnailViewer::loadFromCache: scanned=" << scanned << "accepted=" << accepted << "created=" << created << "thumbs=" << m_labels.size() << "ms=" << timer.elapsed();
+}
 
+int ThumbnailViewer::syncLabels(const QStringList &paths)
+{
+    // keep labels that are still wanted (no re-decode), create the rest
+    QHash<QString, ClickableLabel*> stale = m_labelByName;
+    QVector<ClickableLabel*> ordered;
+    ordered.reserve(paths.size());
+    int created = 0;
+    for (const QString &path : paths) {
+        ClickableLabel *l = stale.take(QFileInfo(path).fileName());
+        if (!l) {
+            l = createThumbnail(path);
+            created++;
+        }
+        ordered.append(l);
+    }
+    for (auto it = stale.constBegin(); it != stale.constEnd(); ++it) {
+        m_grid->removeWidget(it.value());
+        m_labelByName.remove(it.key());
+        it.value()->deleteLater();
+    }
+    m_labels = ordered;
     // After populating, ensure the widgets are laid out according to current viewport width
     relayoutGrid();
-    qDebug() << "ThumbnailViewer::loadFromCache: scanned=" << scanned << "accepted=" << accepted << "thumbs=" << m_labels.size() << "ms=" << timer.elapsed();
+    return created;
+}
+
+qint64 ThumbnailViewer::orderKey(const QString &filePath, bool byDownload) const
+{
+    if (byDownload && m_table) {
+        const int row = m_table->find(QFileInfo(filePath).fileName());
+        if (row >= 0 && m_table->downloadedAtMs(row) >= 0) return m_table->downloadedAtMs(row);
+    }
+    return QFileInfo(filePath).lastModified().toMSecsSinceEpoch();
+}
+
+int ThumbnailViewer::insertSorted(ClickableLabel *label, bool byDownload)
+{
+    const qint64 key = orderKey(label->property("filePath").toString(), byDownload);
+    // after every label at least as new, so equal keys keep their arrival order
+    const auto pos = std::partition_point(m_labels.begin(), m_labels.end(), [&](ClickableLabel *l) {
+        return orderKey(l->property("filePath").toString(), byDownload) >= key;
+    });
+    const int index = int(pos - m_labels.begin());
+    m_labels.insert(index, label);
+    return index;
+}
+
+void ThumbnailViewer::applyDelta(const CacheDelta &delta)
+{
+    if (m_cacheDir.isEmpty()) return;
+    QElapsedTimer timer; timer.start();
+    IndexStore *store = IndexStore::forCacheDir(m_cacheDir);
+    m_table = store->table();
+    const bool byDownload = store->hasBackend();
+    const QDir dir(m_cacheDir);
+    bool changed = false;
+    ThumbnailPack *pack = ThumbnailPack::forCacheDir(m_cacheDir);
+    for (const QString &name : delta.removed) {
+        pack->remove(QFileInfo(name).baseName());
+        if (m_labelByName.contains(name)) {
+            removeThumbnail(name);
+            changed = true;
+        }
+    }
+    // new images go to their place in the newest-first grid; metadata changes
+    // may bring an image into or out of the current filter, or move it
+    int added = 0;
+    const QStringList candidates = delta.added + delta.modified;
+    for (const QString &name : candidates) {
+        const QString path = dir.filePath(name);
+        ClickableLabel *shown = m_labelByName.value(name, nullptr);
+        const bool wanted = acceptsImage(path);
+        if (wanted && !shown) {
+            insertSorted(createThumbnail(path), byDownload);
+            added++;
+            changed = true;
+        } else if (!wanted && shown) {
+            removeThumbnail(name);
+            changed = true;
+        } else if (wanted) {
+            // e.g. downloaded_at stamped after the file appeared
+            const int before = m_labels.indexOf(shown);
+            m_labels.removeAt(before);
+            if (insertSorted(shown, byDownload) != before) changed = true;
+        }
+    }
+    if (changed) relayoutGrid();
+    qCDebug(lcPerf) << "ThumbnailViewer::applyDelta: added=" << added << "thumbs=" << m_labels.size() << "ms=" << timer.elapsed();
 }
 
 QList<QSize> ThumbnailViewer::availableResolutions() const
 {
     QSet<QSize> set;
-    if (m_indexJson.isEmpty()) return {};
-    for (auto it = m_indexJson.constBegin(); it != m_indexJson.constEnd(); ++it) {
-        QJsonObject entry = it.value().toObject();
-        if (entry.contains("width") && entry.contains("height")) {
-            int w = entry.value("width").toInt(0);
-            int h = entry.value("height").toInt(0);
-            if (w > 0 && h > 0) set.insert(QSize(w,h));
-        }
+    if (!m_table) return {};
+    // unchanged snapshot -> same answer
+    if (m_resolutionsVersion == m_table->version()) return m_resolutions;
+    for (int r = 0; r < m_table->rowCount(); ++r) {
+        if (m_table->hasSize(r)) set.insert(m_table->imageSize(r));
     }
     QList<QSize> out = set.values();
     std::sort(out.begin(), out.end(), [](const QSize &a, const QSize &b){
         if (a.width() != b.width()) return a.width() < b.width();
         return a.height() < b.height();
     });
+    m_resolutions = out;
+    m_resolutionsVersion = m_table->version();
     return out;
 }
 
@@ -303,7 +468,8 @@ void ThumbnailViewer::setSelectedResolutions(const QList<QSize> &resolutions)
 
 void ThumbnailViewer::refresh()
 {
-    // no-op; callers should call loadFromCache(cacheDir) when desired
+    // re-apply the current filters to the loaded cache dir, reusing existing thumbnails
+    if (!m_cacheDir.isEmpty()) loadFromCache(m_cacheDir);
 }
 
 void ThumbnailViewer::addThumbnailFromPath(const QString &filePath)
@@ -362,33 +528,31 @@ void ThumbnailViewer::relayoutGrid()
 
 bool ThumbnailViewer::hasThumbnailForFile(const QString &filePath) const
 {
-    QString targetName = QFileInfo(filePath).fileName();
-    for (ClickableLabel *l : m_labels) {
-        QVariant p = l->property("filePath");
-        if (!p.isValid()) continue;
-        QString existing = p.toString();
-        if (QFileInfo(existing).fileName() == targetName) return true;
-    }
-    return false;
+    return m_labelByName.contains(QFileInfo(filePath).fileName());
 }
 
 void ThumbnailViewer::onThumbnailLoaded(const QString &filePath, const QImage &img)
 {
-    // find the label for this filePath and set the pixmap
-    for (ClickableLabel *l : m_labels) {
-        QVariant p = l->property("filePath");
-        if (!p.isValid()) continue;
-        QString existing = p.toString();
-        if (existing == filePath) {
-            QPixmap pm = QPixmap::fromImage(img);
-            // keep the label's fixed size (m_thumbSize) so the grid cell size is stable
-            QSize target = QSize(m_thumbSize, m_thumbSize);
-            QPixmap pmScaled = pm.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            l->setPixmap(pmScaled);
-            l->setText("");
-            break;
-        }
+    if (m_pendingLoads > 0 && --m_pendingLoads == 0 && m_gridTimer.isValid()) {
+        // time to full grid: from loadFromCache until the last tile is in
+        qCDebug(lcPerf) << "ThumbnailViewer: grid complete ms=" << m_gridTimer.elapsed() << "tiles=" << m_labels.size()
+                        << "packed=" << m_packedLoads << "decoded=" << m_decodedLoads;
+        m_gridTimer.invalidate();
     }
+    if (img.isNull()) return;
+    // find the label for this filePath and set the pixmap (it may have been removed meanwhile)
+    ClickableLabel *l = m_labelByName.value(QFileInfo(filePath).fileName(), nullptr);
+    if (!l || l->property("filePath").toString() != filePath) return;
+    l->setPixmap(cellPixmap(QPixmap::fromImage(img)));
+    l->setText("");
+}
+
+QPixmap ThumbnailViewer::cellPixmap(QPixmap pm) const
+{
+    // the level tile as is, at the pixel ratio that fits it to the cell: the
+    // paint scales it, no resampled copy per tile
+    pm.setDevicePixelRatio(qreal(qMax(pm.width(), pm.height())) / m_thumbSize);
+    return pm;
 }
 
 void ThumbnailViewer::setFilterAspectRatioEnabled(bool enabled)
@@ -417,9 +581,7 @@ void ThumbnailViewer::setAllowedSubreddits(const QStringList &allowed)
 {
     m_allowedSubreddits.clear();
     for (const QString &s : allowed) {
-        QString n = s.trimmed();
-        if (n.startsWith("r/", Qt::CaseInsensitive)) n = n.mid(2);
-        n = n.toLower();
+        QString n = ImageFilter::normalizeSubreddit(s);
         if (!n.isEmpty()) m_allowedSubreddits.append(n);
     }
 }
@@ -446,70 +608,57 @@ void ThumbnailViewer::resizeEvent(QResizeEvent *event)
     relayoutGrid();
 }
 
+ImageFilter ThumbnailViewer::currentFilter() const
+{
+    ImageFilter f;
+    f.mode = static_cast<ImageFilter::Mode>(m_filterMode);
+    f.targetAspect = m_targetAspect;
+    QScreen *screen = QGuiApplication::primaryScreen();
+    f.screenSize = screen ? screen->size() : QSize(1920,1080);
+    f.selectedResolutions = m_selectedResolutions;
+    f.allowedSubreddits = m_allowedSubreddits;
+    f.favoritesOnly = favoritesOnly();
+    return f;
+}
+
+ImageFilter ThumbnailViewer::downloadFilter() const
+{
+    ImageFilter f = currentFilter();
+    if (f.mode == ImageFilter::Exact && !f.selectedResolutions.isEmpty()) {
+        for (const QSize &s : availableResolutions()) {
+            if (!f.selectedResolutions.contains(s)) f.excludedResolutions.append(s);
+        }
+    }
+    return f;
+}
+
 bool ThumbnailViewer::acceptsImage(const QString &filePath) const
 {
     // cheap quick-check: extension + existence
     QFileInfo fi(filePath);
     if (!fi.exists() || !fi.isFile()) return false;
 
-    // enforce allowed-subreddits first (so subreddit filtering applies regardless of aspect filter)
+    const ImageFilter filter = currentFilter();
     QString fname = fi.fileName();
-    if (!m_indexJson.isEmpty() && m_indexJson.contains(fname)) {
-        QJsonObject entry = m_indexJson.value(fname).toObject();
-        if (!m_allowedSubreddits.isEmpty()) {
-            QString sr = entry.value("subreddit").toString().trimmed();
-            if (sr.startsWith("r/", Qt::CaseInsensitive)) sr = sr.mid(2);
-            sr = sr.toLower();
-            if (sr.isEmpty() || !m_allowedSubreddits.contains(sr)) {
-                qDebug() << "ThumbnailViewer: rejecting" << fname << "because subreddit" << sr << "not allowed";
-                return false;
-            }
-        }
-        // Respect per-image 'banned' flag in index.json: don't show banned photos
-        if (entry.value("banned").toBool(false)) {
-            qDebug() << "ThumbnailViewer: rejecting" << fname << "because banned flag is set";
-            return false;
-        }
-    } else {
-        // If we don't have metadata and an allowlist is configured, reject
-        if (!m_allowedSubreddits.isEmpty()) {
-            qDebug() << "ThumbnailViewer: rejecting" << fname << "because missing subreddit metadata while allowlist active";
-            return false;
-        }
-    }
-
-    // If favorites-only filter is enabled, reject non-favorited images
-    if (favoritesOnly()) {
-        if (!m_indexJson.isEmpty() && m_indexJson.contains(fname)) {
-            QJsonObject entry = m_indexJson.value(fname).toObject();
-            bool fav = entry.value("favorite").toBool(false);
-            if (!fav) {
-                qDebug() << "ThumbnailViewer: rejecting" << fname << "because not favorited";
-                return false;
-            }
-        } else {
-            // No metadata -> can't know favorite status -> reject
-            qDebug() << "ThumbnailViewer: rejecting" << fname << "because missing metadata for favorites filter";
+    const int row = m_table ? m_table->find(fname) : -1;
+    if (row >= 0) {
+        // subreddit allowlist, banned flag and favorites-only in one check
+        if (!filter.acceptsMetadata(m_table->subreddit(row), m_table->favorite(row), m_table->banned(row))) {
+            qDebug() << "ThumbnailViewer: rejecting" << fname << "by subreddit/banned/favorite filter";
             return false;
         }
+    } else if (!m_allowedSubreddits.isEmpty() || filter.favoritesOnly) {
+        // No metadata -> can't know subreddit or favorite status -> reject
+        qDebug() << "ThumbnailViewer: rejecting" << fname << "because metadata is missing while a subreddit/favorites filter is active";
+        return false;
     }
 
-    // If aspect filtering is disabled, accept (we have already enforced subreddit allowlist above)
+    // If aspect filtering is disabled, accept (metadata filters were enforced above)
     if (m_filterMode == FilterAll) return true;
 
-    // consult in-memory index.json for size if available to avoid decoding image
-    int w = 0, h = 0;
-    if (!m_indexJson.isEmpty() && m_indexJson.contains(fname)) {
-        QJsonObject entry = m_indexJson.value(fname).toObject();
-        if (entry.contains("width") && entry.contains("height")) {
-            w = entry.value("width").toInt(0);
-            h = entry.value("height").toInt(0);
-        }
-    }
-    QSize sz;
-    if (w > 0 && h > 0) {
-        sz = QSize(w,h);
-    } else {
+    // consult the in-memory table for size if available to avoid decoding image
+    QSize sz = row >= 0 ? m_table->imageSize(row) : QSize();
+    if (sz.isEmpty()) {
         QImageReader r(filePath);
         sz = r.size();
         if (sz.isEmpty()) {
@@ -518,45 +667,7 @@ bool ThumbnailViewer::acceptsImage(const QString &filePath) const
             sz = img.size();
         }
     }
-    if (sz.isEmpty()) return false;
-    double ar = double(sz.width()) / double(sz.height());
-
-    // (If we reached here we either have metadata or no allowlist; proceed to aspect checks.)
-
-    if (m_filterMode == FilterExact) {
-        // If selected resolutions are specified, only accept images that match one of them
-        if (!m_selectedResolutions.isEmpty()) {
-            for (const QSize &s : m_selectedResolutions) {
-                if (s.width() == sz.width() && s.height() == sz.height()) return true;
-            }
-            return false;
-        }
-        // Fallback: previous behavior (aspect-based exact match) if no resolutions selected
-        return qAbs(ar - m_targetAspect) <= 0.03;
-    }
-    // Rough: match orientation only (horizontal vs vertical)
-    bool primaryHorizontal = m_targetAspect >= 1.0;
-    bool imgHorizontal = sz.width() >= sz.height();
-    if (primaryHorizontal != imgHorizontal) return false;
-
-    // Now ensure that when center-cropped to the target aspect ratio the resulting
-    // dimensions are at least as large as the current primary screen dimensions.
-    QScreen *screen = QGuiApplication::primaryScreen();
-    QSize scrSize = screen ? screen->size() : QSize(1920,1080);
-    int screenW = scrSize.width();
-    int screenH = scrSize.height();
-
-    int cropW, cropH;
-    if (ar > m_targetAspect) {
-        // image is wider than target -> crop width
-        cropH = sz.height();
-        cropW = int(double(cropH) * m_targetAspect + 0.5);
-    } else {
-        // image is taller (or equal) -> crop height
-        cropW = sz.width();
-        cropH = int(double(cropW) / m_targetAspect + 0.5);
-    }
-    return (cropW >= screenW) && (cropH >= screenH);
+    return filter.acceptsSize(sz);
 }
 
 #include "thumbnailviewer.moc"
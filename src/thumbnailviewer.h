@@ -5,10 +5,17 @@
 #include <QGridLayout>
 #include <QScrollArea>
 #include <QVector>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QPixmap>
 #include <QString>
-#include <QJsonObject>
+#include <memory>
+#include "imagefilter.h"
 
 class ClickableLabel;
+class QSlider;
+class MetadataTable;
+struct CacheDelta;
 
 class ThumbnailViewer : public QWidget {
     Q_OBJECT
@@ -21,8 +28,11 @@ public:
         FilterRough = 2
     };
 
-    // Load thumbnails from cache directory (e.g. ~/.cache/wallpaper)
+    // Load thumbnails from cache directory (e.g. ~/.cache/wallpaper). Reloading
+    // the same directory re-applies the filters and keeps existing thumbnails.
     void loadFromCache(const QString &cacheDir);
+    // Update the grid in place from a CacheWatcher delta
+    void applyDelta(const CacheDelta &delta);
     // Return the unique resolutions present in the current index.json (width x height)
     QList<QSize> availableResolutions() const;
     // Set the list of resolutions that should be shown when in Exact (resolution) filter mode
@@ -30,6 +40,11 @@ public:
     
     // Public relayout API so external callers can request a recompute of columns
     void relayoutGrid();
+
+    // Thumbnail cell size in logical pixels (the zoom slider)
+    int thumbSize() const;
+    static constexpr int kMinThumbSize = 96;
+    static constexpr int kMaxThumbSize = 384;
 public slots:
     // Add a single thumbnail from a file path (used for incremental updates)
     void addThumbnailFromPath(const QString &filePath);
@@ -45,9 +60,11 @@ signals:
     // Context menu actions requested on a thumbnail
     void favoriteRequested(const QString &imagePath);
     void permabanRequested(const QString &imagePath);
+    void thumbSizeChanged(int size);
 
 public slots:
     void refresh();
+    void setThumbSize(int size);
 
     // Return true if a thumbnail for the given file path (or filename) already exists in the view
     bool hasThumbnailForFile(const QString &filePath) const;
@@ -65,22 +82,53 @@ public slots:
 
     // Return true if the thumbnail viewer would accept (render/select) this image given current filters
     bool acceptsImage(const QString &filePath) const;
+    // Current filter state as a value that metadata backends can evaluate
+    ImageFilter currentFilter() const;
+    // currentFilter() plus what scans need to reject images before download
+    ImageFilter downloadFilter() const;
 
 private slots:
     void onThumbnailLoaded(const QString &filePath, const QImage &img);
 private:
     void clearGrid();
     void addThumbnail(const QString &filePath, int row, int col);
+    // create a label and start its async load (not yet placed in the grid)
+    ClickableLabel *createThumbnail(const QString &filePath);
+    // Load the label's image at the current size from the thumbnail pyramid;
+    // allowOriginal decodes the image itself if it has no thumbnails yet
+    void startLoad(const QString &filePath, bool allowOriginal);
+    void removeThumbnail(const QString &fileName);
+    // A level tile sized to the current cell through its device pixel ratio
+    QPixmap cellPixmap(QPixmap pm) const;
+    // make the grid show exactly `paths` in order; returns the number of new labels
+    int syncLabels(const QStringList &paths);
+    // Newest-first sort key loadFromCache orders by: the download time when a
+    // backend query ordered the grid, else the file's mtime
+    qint64 orderKey(const QString &filePath, bool byDownload) const;
+    // Place a label in m_labels at its sorted position; returns the index
+    int insertSorted(ClickableLabel *label, bool byDownload);
 
     QScrollArea *m_scroll;
     QWidget *m_container;
     QGridLayout *m_grid;
     QVector<ClickableLabel*> m_labels;
-    int m_thumbSize = 200; // pixels
+    // labels by file name, for dedupe and in-place updates
+    QHash<QString, ClickableLabel*> m_labelByName;
+    QString m_cacheDir;
+    int m_thumbSize = 200; // logical pixels
+    QSlider *m_zoom = nullptr;
+    // tile loads in flight, and how the ones since loadFromCache were served
+    int m_pendingLoads = 0;
+    int m_packedLoads = 0;
+    int m_decodedLoads = 0;
+    QElapsedTimer m_gridTimer;
     AspectFilterMode m_filterMode = FilterAll;
     double m_targetAspect = 16.0/9.0;
-    // cached index.json for the current cache dir (loaded by loadFromCache)
-    QJsonObject m_indexJson;
+    // shared columnar view of index.json for the current cache dir (loaded by loadFromCache)
+    std::shared_ptr<const MetadataTable> m_table;
+    // availableResolutions() result for the snapshot it was computed from
+    mutable QList<QSize> m_resolutions;
+    mutable quint64 m_resolutionsVersion = ~quint64(0);
     QString m_indexPath;
     QStringList m_allowedSubreddits;
     QList<QSize> m_selectedResolutions;
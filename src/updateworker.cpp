@@ -1,42 +1,557 @@
 #include "updateworker.h"
 #include "redditfetcher.h"
 #include "cachemanager.h"
+#include "urlindex.h"
+#include "networkservice.h"
+#include "imageingest.h"
+#include "listingcache.h"
+#include "listingcursors.h"
+#include "ratelimiter.h"
+#include "perflog.h"
 
-#include <QThread>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSet>
+#include <QTimer>
+#include <QUrl>
 #include <QDebug>
+#include <algorithm>
 
-UpdateWorker::UpdateWorker(RedditFetcher *fetcher, CacheManager *cache, const QStringList &subreddits, int perSubLimit, QObject *parent)
-    : QObject(parent), m_fetcher(fetcher), m_cache(cache), m_subreddits(subreddits), m_perSubLimit(perSubLimit)
+UpdateWorker::UpdateWorker(CacheManager *cache, const QStringList &subreddits, int perSubLimit, QObject *parent)
+    : QObject(parent), m_cache(cache), m_subreddits(subreddits), m_perSubLimit(perSubLimit)
 {
 }
 
+void UpdateWorker::setConcurrency(int total, int perHost)
+{
+    m_maxConcurrent = qMax(1, total);
+    m_maxPerHost = qBound(1, perHost, m_maxConcurrent);
+}
+
 void UpdateWorker::start()
 {
-    if (!m_fetcher || !m_cache) {
-        emit error("Missing fetcher or cache manager");
+    if (!m_cache) {
+        emit error("Missing cache manager");
         emit finished();
         return;
     }
 
-    qDebug() << "UpdateWorker: starting update for" << m_subreddits.size() << "subreddits";
+    qDebug() << "UpdateWorker: starting update for" << m_subreddits.size() << "subreddits"
+             << "concurrency=" << m_maxConcurrent << "perHost=" << m_maxPerHost;
+    m_timer.start();
+    m_cache->purgeStalePartials();
+    // the worker thread's long-lived manager, so connections survive across scans
+    m_nam = NetworkService::manager();
+
+    QStringList subs;
     for (const QString &sub : m_subreddits) {
-        // Fetch up to m_perSubLimit most recent posts for this subreddit
-        std::vector<std::string> urls = m_fetcher->fetchRecentImageUrls(sub, m_perSubLimit);
-        qDebug() << "UpdateWorker: subreddit" << sub << "returned" << (int)urls.size() << "urls";
-            // emit started with total count
-            emit started(sub, (int)urls.size());
-        for (const std::string &surl : urls) {
-            QString url = QString::fromStdString(surl);
-            QString local = m_cache->downloadAndCache(url);
-            if (!local.isEmpty()) {
-                emit imageCached(local, sub, url);
+        if (m_subs.contains(sub)) continue;
+        SubState state;
+        state.cursor = ListingCursors::instance()->cursor(sub);
+        m_subs.insert(sub, state);
+        subs.append(sub);
+    }
+    // all listings in parallel, several subreddits per request where possible;
+    // a backfill continues below each subreddit's oldest processed post
+    const int batch = (m_batchListings && m_mode != Backfill) ? kMaxBatchSubreddits : 1;
+    for (int i = 0; i < subs.size(); i += batch) {
+        const QStringList members = subs.mid(i, batch);
+        const QString first = m_mode == Backfill ? m_subs.value(members.first()).cursor.oldest : QString();
+        startGroup(members, first);
+    }
+    maybeFinish();
+}
+
+void UpdateWorker::setBatchListings(bool batch)
+{
+    m_batchListings = batch;
+}
+
+void UpdateWorker::startGroup(const QStringList &members, const QString &after)
+{
+    // "a+b+c" is itself a valid listing path
+    const QString name = members.join('+');
+    GroupState &group = m_groups[name];
+    group.members = members;
+    for (const QString &sub : members) {
+        SubState &state = m_subs[sub];
+        state.groups.append(name);
+        state.taken = 0;
+        state.walked = false;
+        group.pendingMembers++;
+    }
+    requestListing(name, after);
+}
+
+void UpdateWorker::setListingMode(ListingMode mode, int pages)
+{
+    m_mode = mode;
+    m_backfillPages = qMax(1, pages);
+}
+
+void UpdateWorker::setPrefilter(const ImageFilter &filter, bool skipNsfw)
+{
+    m_prefilter = filter;
+    m_skipNsfw = skipNsfw;
+}
+
+bool UpdateWorker::wanted(const RedditFetcher::Post &post) const
+{
+    if (post.gallery || post.video) return false;
+    if (m_skipNsfw && post.over18) return false;
+    // reddit measured the source image itself only for image posts
+    if (post.postHint == "image" && !m_prefilter.couldAcceptSize(post.previewSize)) return false;
+    return true;
+}
+
+void UpdateWorker::requestListing(const QString &group, const QString &after)
+{
+    m_pendingListings++;
+    sendListing(group, after);
+}
+
+void UpdateWorker::sendListing(const QString &group, const QString &after)
+{
+    bool anyActive = false;
+    for (const QString &sub : m_groups.value(group).members) anyActive = anyActive || !m_subs.value(sub).cancelled;
+    if (m_cancelled || !anyActive) {
+        m_pendingListings--;
+        maybeFinish();
+        return;
+    }
+    if (m_paused) {
+        m_deferredListings.append({ group, after });
+        return;
+    }
+    // combined listings use full pages; a single subreddit pages in perSubLimit steps
+    const int limit = m_groups.value(group).members.size() > 1 ? RedditFetcher::kMaxPageSize : m_perSubLimit;
+    const QNetworkRequest req = RedditFetcher::listingRequest(group, limit, after);
+    const qint64 wait = RateLimiter::instance()->acquire(req.url().host());
+    if (wait > 0) {
+        QTimer::singleShot(wait, this, [this, group, after]() { sendListing(group, after); });
+        return;
+    }
+    m_listingRequests++;
+    QNetworkReply *reply = m_nam->get(req);
+    m_replies.insert(reply);
+    connect(reply, &QNetworkReply::finished, this, [this, group, reply, after]() {
+        onListingFinished(group, reply, after);
+    });
+}
+
+void UpdateWorker::onListingFinished(const QString &groupName, QNetworkReply *reply, const QString &after)
+{
+    reply->deleteLater();
+    m_replies.remove(reply);
+    GroupState &group = m_groups[groupName];
+    if (m_cancelled) {
+        m_pendingListings--;
+        maybeFinish();
+        return;
+    }
+    // throttled: the limiter has paused the host, ask again once it allows
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if ((status == 429 || status == 503) && group.retries < kMaxRetries) {
+        group.retries++;
+        sendListing(groupName, after);
+        return;
+    }
+    m_pendingListings--;
+    group.pages++;
+
+    // only the head page goes through the listing cache
+    ListingCache::Result listing;
+    if (after.isEmpty()) {
+        listing = ListingCache::instance()->resolve(reply);
+    } else if (reply->error() == QNetworkReply::NoError) {
+        listing.outcome = ListingCache::Fresh;
+        listing.body = reply->readAll();
+    }
+    m_listingOutcomes[listing.outcome]++;
+    if (listing.outcome == ListingCache::Failed) {
+        emit error(QString("Listing for %1 failed: %2").arg(groupName, reply->errorString()));
+        // what earlier pages produced is still queued, but the cursors stay put
+        for (const QString &sub : group.members) m_subs[sub].cursorValid = false;
+        finishGroup(groupName, false);
+        return;
+    }
+    if (after.isEmpty()) group.listingUrl = reply->request().url().toString();
+    if (listing.outcome == ListingCache::NotModified && listing.complete && m_mode == Incremental) {
+        // nothing new since a scan that cached everything: skip the pipeline
+        qCDebug(lcPerf) << "UpdateWorker: listing" << groupName << "not modified";
+        for (const QString &sub : group.members) {
+            m_subs[sub].cursorValid = false;
+            m_subs[sub].walked = true;
+        }
+        finishGroup(groupName, false);
+        return;
+    }
+    if (listing.outcome == ListingCache::Stale) {
+        qWarning() << "UpdateWorker: using stored listing for" << groupName << "-" << reply->errorString();
+        // the stored page may predate the cursor; don't move it on that basis
+        for (const QString &sub : group.members) m_subs[sub].cursorValid = false;
+    }
+
+    // split a combined page back out by each post's subreddit
+    QHash<QString, QString> memberByName;
+    for (const QString &sub : group.members) memberByName.insert(ImageFilter::normalizeSubreddit(sub), sub);
+    const RedditFetcher::Page page = RedditFetcher::parsePage(listing.body);
+    int taken = 0;
+    for (const RedditFetcher::Post &post : page.posts) {
+        const QString sub = group.members.size() == 1 ? group.members.first()
+                                                       : memberByName.value(post.subreddit.toLower());
+        if (sub.isEmpty()) continue;
+        SubState &state = m_subs[sub];
+        if (state.walked || state.cancelled) continue;
+        const bool older = !state.cursor.isNull()
+            && !RedditFetcher::isNewerThan(post, state.cursor.newest, state.cursor.newestUtc);
+        if (older) state.reachedCursor = true;
+        // incremental walks stop at the cursor, fixed-size ones after perSubLimit posts
+        if (m_mode == Incremental && !state.cursor.isNull()) {
+            if (older) {
+                state.walked = true;
+                continue;
             }
-            // gentle throttle to avoid hammering services
-            QThread::msleep(150);
+        } else if (m_mode != Backfill && state.taken >= m_perSubLimit) {
+            state.walked = true;
+            continue;
         }
-            // emit finished for this subreddit
-            emit finishedSubreddit(sub);
+        state.taken++;
+        taken++;
+        if (state.seen.newest.isEmpty() || post.createdUtc > state.seen.newestUtc) {
+            state.seen.newest = post.name;
+            state.seen.newestUtc = post.createdUtc;
+        }
+        if (state.seen.oldest.isEmpty() || post.createdUtc < state.seen.oldestUtc) {
+            state.seen.oldest = post.name;
+            state.seen.oldestUtc = post.createdUtc;
+        }
+        if (post.url.isEmpty()) continue;
+        if (!wanted(post)) {
+            m_skipped++;
+            continue;
+        }
+        state.urls.append(post.url);
+    }
+    bool pending = false;
+    for (const QString &sub : group.members) {
+        SubState &state = m_subs[sub];
+        // a fixed-size walk is also done once it has its posts
+        if (!state.walked && m_mode != Backfill && !(m_mode == Incremental && !state.cursor.isNull())
+            && state.taken >= m_perSubLimit) state.walked = true;
+        pending = pending || (!state.walked && !state.cancelled);
     }
+    qCDebug(lcPerf) << "UpdateWorker: listing" << groupName << "page" << group.pages << "new posts" << taken
+                    << "of" << (int)page.posts.size() << "listing=" << ListingCache::outcomeName(listing.outcome);
 
+    // keep paging while a member still wants posts, within the page budget;
+    // a lone first scan without a cursor only takes the newest page
+    bool more = pending && !page.after.isEmpty() && listing.outcome != ListingCache::Stale;
+    if (m_mode == Backfill) more = more && group.pages < m_backfillPages;
+    else if (group.members.size() == 1 && m_subs.value(group.members.first()).cursor.isNull()) more = false;
+    else more = more && group.pages < kMaxIncrementalPages;
+    if (more) {
+        requestListing(groupName, page.after);
+        return;
+    }
+    finishGroup(groupName, listing.outcome != ListingCache::Stale);
+}
+
+void UpdateWorker::finishGroup(const QString &groupName, bool retrySolo)
+{
+    const GroupState group = m_groups.value(groupName);
+    for (const QString &sub : group.members) {
+        SubState &state = m_subs[sub];
+        if (state.cancelled) continue;
+        if (!state.walked && group.members.size() > 1 && retrySolo) {
+            // crowded out of the combined listing by busier subreddits: walk it alone
+            startGroup(QStringList() << sub, QString());
+            continue;
+        }
+        if (!state.walked && !state.reachedCursor && state.cursorValid && !state.cursor.isNull() && m_mode != Backfill) {
+            // a walk that didn't get back to the cursor would leave a gap
+            if (m_mode == Newest) state.cursorValid = false;
+            else qWarning() << "UpdateWorker: more than" << kMaxIncrementalPages << "pages of new posts in" << sub;
+        }
+        queueListing(sub);
+    }
+}
+
+void UpdateWorker::queueListing(const QString &subreddit)
+{
+    SubState &state = m_subs[subreddit];
+    // collapse duplicate/crossposted URLs within the listing
+    QSet<QString> seen;
+    QList<Job> jobs;
+    for (const QString &url : std::as_const(state.urls)) {
+        const QString norm = UrlIndex::normalize(url);
+        if (seen.contains(norm)) continue;
+        seen.insert(norm);
+        jobs.append({ subreddit, url, QUrl(url).host().toLower(), norm });
+    }
+    state.urls.clear();
+
+    state.listed = true;
+    state.total = jobs.size();
+    emit started(subreddit, state.total);
+
+    for (const Job &job : jobs) {
+        // already cached: no request at all
+        const QString local = m_cache->cachedPath(job.url);
+        if (!local.isEmpty()) {
+            m_alreadyCached++;
+            emit imageCached(local, subreddit, job.url);
+            completeJob(subreddit);
+            continue;
+        }
+        // refused by the size guards on an earlier scan
+        if (UrlIndex::instance()->isRejected(job.url)) {
+            m_skipped++;
+            completeJob(subreddit);
+            continue;
+        }
+        // crossposted into another scanned subreddit: ride on that download
+        auto waiting = m_waiters.find(job.norm);
+        if (waiting != m_waiters.end()) {
+            waiting->append(subreddit);
+            continue;
+        }
+        m_waiters.insert(job.norm, QStringList() << subreddit);
+        m_queue.enqueue(job);
+    }
+    if (state.total == 0) finishSubreddit(subreddit);
+    pump();
+    maybeFinish();
+}
+
+void UpdateWorker::schedulePump(qint64 delayMs)
+{
+    if (m_pumpScheduled) return;
+    m_pumpScheduled = true;
+    QTimer::singleShot(delayMs, this, [this]() {
+        m_pumpScheduled = false;
+        pump();
+    });
+}
+
+void UpdateWorker::pump()
+{
+    if (m_paused || m_cancelled) return;
+    // backpressure: let thumbnailing/indexing catch up before more bytes land
+    if (!m_queue.isEmpty() && CacheManager::pendingIndexTasks() >= kMaxPendingIndexTasks) {
+        m_stalls++;
+        schedulePump(kBackpressurePollMs);
+        return;
+    }
+    // FIFO, but skip over jobs whose host is saturated or rate limited
+    QHash<QString, qint64> limited;
+    qint64 nextWait = 0;
+    for (int i = 0; i < m_queue.size() && m_inFlight < m_maxConcurrent; ) {
+        Job job = m_queue.at(i);
+        if (m_inFlightPerHost.value(job.host) >= m_maxPerHost || limited.contains(job.host)) {
+            ++i;
+            continue;
+        }
+        const qint64 wait = RateLimiter::instance()->acquire(job.host);
+        if (wait > 0) {
+            limited.insert(job.host, wait);
+            nextWait = nextWait > 0 ? qMin(nextWait, wait) : wait;
+            ++i;
+            continue;
+        }
+        m_queue.removeAt(i);
+        m_inFlight++;
+        m_inFlightPerHost[job.host]++;
+        job.startedMs = m_timer.elapsed();
+        qDebug() << "Downloading:" << job.url;
+        // stream the body to disk as it arrives; the read buffer caps memory per download
+        std::shared_ptr<ImageIngest> ingest(m_cache->beginIngest(job.url));
+        if (!ingest) {
+            m_inFlight--;
+            if (--m_inFlightPerHost[job.host] <= 0) m_inFlightPerHost.remove(job.host);
+            finishJob(job, QString());
+            continue;
+        }
+        // resumes a part file left by an earlier, interrupted run
+        QNetworkReply *reply = m_nam->get(CacheManager::downloadRequest(job.url, *ingest));
+        m_replies.insert(reply);
+        reply->setReadBufferSize(CacheManager::kIngestChunkBytes);
+        connect(reply, &QNetworkReply::metaDataChanged, this, [ingest, reply]() {
+            if (!CacheManager::acceptResponse(reply, *ingest)) reply->abort();
+        });
+        connect(reply, &QNetworkReply::readyRead, this, [ingest, reply]() {
+            if (!CacheManager::acceptChunk(reply, *ingest)) reply->abort();
+        });
+        connect(reply, &QNetworkReply::finished, this, [this, job, reply, ingest]() {
+            onDownloadFinished(job, reply, ingest.get());
+        });
+    }
+    // come back when the earliest limited host has a token again
+    if (nextWait > 0) schedulePump(nextWait);
+}
+
+void UpdateWorker::onDownloadFinished(const Job &job, QNetworkReply *reply, ImageIngest *ingest)
+{
+    reply->deleteLater();
+    m_replies.remove(reply);
+    m_inFlight--;
+    if (--m_inFlightPerHost[job.host] <= 0) m_inFlightPerHost.remove(job.host);
+
+    QString local;
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (m_cancelled) {
+        // aborted by cancel(): keep the part for the next scan
+        CacheManager::keepPartial(reply, *ingest);
+        maybeFinish();
+        return;
+    }
+    if ((status == 429 || status == 503) && job.attempts < kMaxRetries) {
+        // requeue at the front; pump() waits out the pause the limiter took from this reply
+        CacheManager::keepPartial(reply, *ingest);
+        Job retry = job;
+        retry.attempts++;
+        m_queue.prepend(retry);
+        pump();
+        return;
+    }
+    if (reply->error() != QNetworkReply::NoError) {
+        qWarning() << "Network error:" << reply->error() << reply->errorString();
+        qWarning() << "URL was:" << job.url;
+        // keep what arrived so the next run can continue with a Range request
+        m_bytes += ingest->bytesWritten() - ingest->resumeOffset();
+        CacheManager::keepPartial(reply, *ingest);
+    } else {
+        const bool accepted = CacheManager::acceptChunk(reply, *ingest);
+        m_bytes += ingest->bytesWritten() - ingest->resumeOffset();
+        if (accepted) local = m_cache->finishIngest(job.url, *ingest);
+        if (!local.isEmpty()) {
+            m_downloaded++;
+            m_latenciesMs.push_back(m_timer.elapsed() - job.startedMs);
+        }
+    }
+    finishJob(job, local);
+    pump();
+    maybeFinish();
+}
+
+void UpdateWorker::finishJob(const Job &job, const QString &localPath)
+{
+    // every subreddit that listed this URL shares the one download
+    const QStringList subs = m_waiters.take(job.norm);
+    for (const QString &sub : subs) {
+        if (!localPath.isEmpty()) emit imageCached(localPath, sub, job.url);
+        // a URL refused by the size guards is settled, not failed
+        else if (!UrlIndex::instance()->isRejected(job.url)) m_subs[sub].failed++;
+        completeJob(sub);
+    }
+}
+
+void UpdateWorker::completeJob(const QString &subreddit)
+{
+    SubState &state = m_subs[subreddit];
+    if (state.cancelled) return;
+    state.completed++;
+    emit progress(subreddit, state.completed, state.total);
+    if (state.completed == state.total) finishSubreddit(subreddit);
+}
+
+void UpdateWorker::finishSubreddit(const QString &subreddit)
+{
+    SubState &state = m_subs[subreddit];
+    state.done = true;
+    // lets the next scan skip this listing outright if it comes back unchanged
+    for (const QString &name : std::as_const(state.groups)) {
+        GroupState &group = m_groups[name];
+        group.failed = group.failed || state.failed > 0 || state.cancelled;
+        if (--group.pendingMembers == 0 && !group.listingUrl.isEmpty())
+            ListingCache::instance()->setComplete(group.listingUrl, !group.failed);
+    }
+    // move the cursor only once everything up to it is cached, so failed
+    // posts are listed again next time
+    if (state.cursorValid && state.failed == 0) {
+        ListingCursors::instance()->extend(subreddit, state.seen);
+        if (m_mode == Incremental && !state.cancelled)
+            emit scanned(subreddit, state.cursor.isNull() ? -1 : state.total);
+    }
+    emit finishedSubreddit(subreddit);
+}
+
+void UpdateWorker::cancel()
+{
+    if (m_finished || m_cancelled) return;
+    qDebug() << "UpdateWorker: cancelling";
+    for (auto it = m_subs.cbegin(); it != m_subs.cend(); ++it) {
+        if (!it->done && !it->cancelled) cancelSubreddit(it.key());
+    }
+    m_cancelled = true;
+    m_queue.clear();
+    m_waiters.clear();
+    m_pendingListings -= m_deferredListings.size();
+    m_deferredListings.clear();
+    // abort() delivers finished() synchronously; handlers see m_cancelled
+    const QSet<QNetworkReply*> running = m_replies;
+    for (QNetworkReply *reply : running) reply->abort();
+    maybeFinish();
+}
+
+void UpdateWorker::cancelSubreddit(const QString &subreddit)
+{
+    auto it = m_subs.find(subreddit);
+    if (it == m_subs.end() || it->done || it->cancelled) return;
+    it->cancelled = true;
+    it->done = true;
+    // its queued jobs go unless another subreddit is waiting on the same URL
+    for (int i = m_queue.size() - 1; i >= 0; --i) {
+        const Job &job = m_queue.at(i);
+        auto waiting = m_waiters.find(job.norm);
+        if (waiting == m_waiters.end()) continue;
+        waiting->removeAll(subreddit);
+        if (waiting->isEmpty()) {
+            m_waiters.erase(waiting);
+            m_queue.removeAt(i);
+        }
+    }
+    // in-flight downloads run to the end; completeJob() ignores this subreddit
+    emit finishedSubreddit(subreddit);
+    maybeFinish();
+}
+
+void UpdateWorker::setPaused(bool paused)
+{
+    if (m_paused == paused || m_finished) return;
+    m_paused = paused;
+    qDebug() << "UpdateWorker:" << (paused ? "paused" : "resumed");
+    emit pausedChanged(paused);
+    if (paused) return;
+    const QList<PendingListing> deferred = m_deferredListings;
+    m_deferredListings.clear();
+    for (const PendingListing &p : deferred) sendListing(p.group, p.after);
+    pump();
+}
+
+void UpdateWorker::maybeFinish()
+{
+    if (m_finished || m_pendingListings > 0 || m_inFlight > 0 || !m_queue.isEmpty()) return;
+    m_finished = true;
+    const double secs = qMax<qint64>(1, m_timer.elapsed()) / 1000.0;
+    qCDebug(lcPerf) << "UpdateWorker: done downloaded=" << m_downloaded << "cached=" << m_alreadyCached
+                    << "listing requests=" << m_listingRequests << "skipped=" << m_skipped << "stalls=" << m_stalls << "cancelled=" << m_cancelled
+                    << "bytes=" << m_bytes << "seconds=" << secs
+                    << "images/s=" << m_downloaded / secs << "KiB/s=" << m_bytes / 1024.0 / secs;
+    // per-image latency: request issued -> image stored
+    std::sort(m_latenciesMs.begin(), m_latenciesMs.end());
+    auto percentile = [this](double p) -> qint64 {
+        if (m_latenciesMs.empty()) return 0;
+        return m_latenciesMs[qMin(m_latenciesMs.size() - 1, size_t(p * m_latenciesMs.size()))];
+    };
+    qCDebug(lcPerf) << "UpdateWorker: latency ms p50=" << percentile(0.50) << "p99=" << percentile(0.99)
+                    << "max=" << (m_latenciesMs.empty() ? 0 : m_latenciesMs.back());
+    qCDebug(lcPerf) << "UpdateWorker: listings fresh=" << m_listingOutcomes[ListingCache::Fresh]
+                    << "not-modified=" << m_listingOutcomes[ListingCache::NotModified]
+                    << "stale=" << m_listingOutcomes[ListingCache::Stale]
+                    << "failed=" << m_listingOutcomes[ListingCache::Failed];
+    qCDebug(lcPerf).noquote() << "UpdateWorker: network" << NetworkService::statsSummary();
+    qCDebug(lcPerf).noquote() << "UpdateWorker: rate limits" << RateLimiter::instance()->summary();
     emit finished();
 }
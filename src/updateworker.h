@@ -2,17 +2,72 @@
 
 #include <QObject>
 #include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QQueue>
+#include <QElapsedTimer>
+#include <vector>
+
+#include "imagefilter.h"
+#include "listingcursors.h"
+#include "redditfetcher.h"
 
-class RedditFetcher;
 class CacheManager;
+class QNetworkAccessManager;
+class QNetworkReply;
+class ImageIngest;
 
+// Fetches the listings of all subreddits in parallel, then downloads the
+// images through a queue bounded both in total and per host. Runs on its
+// own thread's event loop; no nested loops or sleeps. Control slots
+// (cancel, pause) are meant to be invoked queued from the GUI thread.
+// New downloads also wait while too many saved images are still waiting for
+// their thumbnail/index task, so the network can't outrun the disk.
 class UpdateWorker : public QObject {
     Q_OBJECT
 public:
-    UpdateWorker(RedditFetcher *fetcher, CacheManager *cache, const QStringList &subreddits, int perSubLimit = 10, QObject *parent = nullptr);
+    UpdateWorker(CacheManager *cache, const QStringList &subreddits, int perSubLimit = 10, QObject *parent = nullptr);
+
+    // Download concurrency limits (call before start)
+    void setConcurrency(int total, int perHost);
+
+    enum ListingMode {
+        Incremental, // page back to the newest post of the last complete scan
+        Newest,      // just the newest perSubLimit posts
+        Backfill     // `pages` pages older than anything scanned so far
+    };
+    // How listings are walked (call before start); default Incremental
+    void setListingMode(ListingMode mode, int pages = kDefaultBackfillPages);
+    // Skip posts that could never pass `filter` (judged from the listing's
+    // preview size), galleries, videos and, optionally, NSFW posts; default
+    // filter accepts everything. Call before start.
+    void setPrefilter(const ImageFilter &filter, bool skipNsfw);
+    // Fetch up to kMaxBatchSubreddits subreddits per combined /r/a+b/new.json
+    // request (default on; backfills always go one by one)
+    void setBatchListings(bool batch);
+
+    static constexpr int kDefaultConcurrency = 6;
+    static constexpr int kDefaultPerHost = 2;
+    // page limit for an incremental scan that doesn't reach its cursor
+    static constexpr int kMaxIncrementalPages = 10;
+    static constexpr int kDefaultBackfillPages = 5;
+    static constexpr int kMaxBatchSubreddits = 10;
+    // retries of a request answered with 429/503
+    static constexpr int kMaxRetries = 2;
+    // backpressure: saved images whose indexing may be outstanding
+    static constexpr int kMaxPendingIndexTasks = 32;
+    static constexpr int kBackpressurePollMs = 100;
 
 public slots:
     void start();
+    // Stop everything: queued jobs are dropped, transfers are aborted (their
+    // part files kept for resume where possible); finished() follows
+    void cancel();
+    // Drop one subreddit's remaining work; downloads shared with other
+    // subreddits continue for them
+    void cancelSubreddit(const QString &subreddit);
+    // Paused workers start no new requests; transfers already running finish
+    void setPaused(bool paused);
 
 signals:
     void imageCached(const QString &localPath, const QString &subreddit, const QString &sourceUrl);
@@ -20,12 +75,111 @@ signals:
     void started(const QString &subreddit, int total);
     void progress(const QString &subreddit, int completed, int total);
     void finishedSubreddit(const QString &subreddit);
+    // An incremental scan moved the subreddit's cursor. newImages counts the
+    // wanted images listed since the previous cursor (-1 without one).
+    void scanned(const QString &subreddit, int newImages);
     void finished();
+    void pausedChanged(bool paused);
     void error(const QString &msg);
 
 private:
-    RedditFetcher *m_fetcher;
+    struct Job {
+        QString subreddit;
+        QString url;
+        QString host;
+        QString norm;   // UrlIndex::normalize(url)
+        int attempts = 0;
+        qint64 startedMs = 0;  // request issued, on m_timer
+    };
+    struct SubState {
+        int total = 0;
+        int completed = 0;
+        int failed = 0;
+        bool listed = false;
+        // listing walk
+        QStringList groups;             // listings this subreddit was fetched through
+        ListingCursors::Cursor cursor;  // position at the start of the run
+        ListingCursors::Cursor seen;    // range of posts processed in this run
+        QStringList urls;
+        int taken = 0;                  // posts taken in the current walk
+        bool walked = false;            // the walk has all the posts it wants
+        bool reachedCursor = false;
+        bool cursorValid = true;        // false if `seen` must not move the cursor
+        bool done = false;              // finishedSubreddit was emitted
+        bool cancelled = false;
+    };
+    // One listing walk: a single subreddit or a combined "a+b+c" listing
+    struct GroupState {
+        QStringList members;
+        QString listingUrl;             // head page, for the listing cache
+        int pages = 0;
+        int retries = 0;
+        int pendingMembers = 0;         // members not finished yet
+        bool failed = false;
+    };
+    struct PendingListing {
+        QString group;
+        QString after;
+    };
+    // whether a listed post is worth downloading (see setPrefilter)
+    bool wanted(const RedditFetcher::Post &post) const;
+    void startGroup(const QStringList &members, const QString &after);
+    void requestListing(const QString &group, const QString &after);
+    // issue the request once the rate limiter allows
+    void sendListing(const QString &group, const QString &after);
+    void onListingFinished(const QString &groupName, QNetworkReply *reply, const QString &after);
+    // queue the members' posts; members a combined walk couldn't satisfy
+    // get a walk of their own when retrySolo is set
+    void finishGroup(const QString &groupName, bool retrySolo);
+    // turn the collected listing URLs into download jobs
+    void queueListing(const QString &subreddit);
+    void onDownloadFinished(const Job &job, QNetworkReply *reply, ImageIngest *ingest);
+    // start queued downloads while the limits allow
+    void pump();
+    void schedulePump(qint64 delayMs);
+    // complete a download for every subreddit waiting on its URL
+    void finishJob(const Job &job, const QString &localPath);
+    void completeJob(const QString &subreddit);
+    void finishSubreddit(const QString &subreddit);
+    void maybeFinish();
+
     CacheManager *m_cache;
     QStringList m_subreddits;
     int m_perSubLimit = 10;
+    int m_maxConcurrent = kDefaultConcurrency;
+    int m_maxPerHost = kDefaultPerHost;
+    ListingMode m_mode = Incremental;
+    int m_backfillPages = kDefaultBackfillPages;
+    ImageFilter m_prefilter;
+    bool m_skipNsfw = false;
+    bool m_batchListings = true;
+
+    QNetworkAccessManager *m_nam = nullptr;
+    QHash<QString, SubState> m_subs;
+    QHash<QString, GroupState> m_groups;
+    int m_pendingListings = 0;
+    QQueue<Job> m_queue;
+    QHash<QString, int> m_inFlightPerHost;
+    // normalized URL -> subreddits waiting on its queued/in-flight download
+    QHash<QString, QStringList> m_waiters;
+    int m_inFlight = 0;
+    bool m_pumpScheduled = false;
+    bool m_finished = false;
+    bool m_cancelled = false;
+    bool m_paused = false;
+    // listing requests held back while paused
+    QList<PendingListing> m_deferredListings;
+    // every reply still running, for cancel()
+    QSet<QNetworkReply*> m_replies;
+
+    // run statistics
+    QElapsedTimer m_timer;
+    int m_downloaded = 0;
+    int m_alreadyCached = 0;
+    int m_skipped = 0;      // listed but rejected before download
+    int m_stalls = 0;       // pump() rounds held back by backpressure
+    int m_listingRequests = 0;
+    int m_listingOutcomes[4] = {};  // indexed by ListingCache::Outcome
+    qint64 m_bytes = 0;
+    std::vector<qint64> m_latenciesMs;  // per stored image
 };
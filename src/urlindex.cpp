@@ -0,0 +1,190 @@
+#include "urlindex.h"
+#include "perflog.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUrl>
+#include <QDebug>
+
+UrlIndex *UrlIndex::instance()
+{
+    static UrlIndex *index = [] {
+        auto *idx = new UrlIndex(defaultPath());
+        if (QCoreApplication::instance()) {
+            QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, [idx]() {
+                idx->save();
+            });
+        }
+        return idx;
+    }();
+    return index;
+}
+
+QString UrlIndex::defaultPath()
+{
+    QString configDir = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/wallaroo";
+    return configDir + "/url_map.json";
+}
+
+UrlIndex::UrlIndex(const QString &path)
+    : m_path(path)
+{
+    load();
+}
+
+QString UrlIndex::normalize(const QString &url)
+{
+    QString s = url.trimmed();
+    // listing JSON escapes '&' inside URLs
+    s.replace("&amp;", "&");
+    QUrl u(s);
+    if (!u.isValid() || u.host().isEmpty()) return s;
+    u.setQuery(QString());
+    u.setFragment(QString());
+    if (u.scheme().compare("http", Qt::CaseInsensitive) == 0) u.setScheme("https");
+    QString host = u.host().toLower();
+    if (host.startsWith("www.")) host = host.mid(4);
+    // reddit serves the same media id from both hosts
+    if (host == "preview.redd.it") host = "i.redd.it";
+    u.setHost(host);
+    u.setPort(-1);
+    QString path = u.path();
+    while (path.size() > 1 && path.endsWith('/')) path.chop(1);
+    u.setPath(path);
+    return u.toString();
+}
+
+void UrlIndex::load()
+{
+    QFile f(m_path);
+    if (!f.open(QIODevice::ReadOnly)) return;
+    QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
+    f.close();
+    if (!doc.isObject()) {
+        qWarning() << "UrlIndex: ignoring unreadable" << m_path;
+        return;
+    }
+    const QJsonObject root = doc.object();
+    int collapsed = 0;
+    for (auto it = root.constBegin(); it != root.constEnd(); ++it) {
+        const QString key = normalize(it.key());
+        Entry &e = m_entries[key];
+        QJsonArray subs;
+        if (it.value().isArray()) {
+            subs = it.value().toArray(); // legacy: subreddits only
+        } else {
+            const QJsonObject obj = it.value().toObject();
+            if (e.file.isEmpty()) e.file = obj.value("file").toString();
+            if (e.rejected.isEmpty()) e.rejected = obj.value("rejected").toString();
+            subs = obj.value("subreddits").toArray();
+        }
+        for (const QJsonValue &v : subs) {
+            const QString sub = v.toString();
+            if (!sub.isEmpty() && !e.subreddits.contains(sub)) e.subreddits.append(sub);
+        }
+        if (key != it.key()) collapsed++;
+    }
+    // older files used a looser normalization; rewrite them in canonical form
+    if (collapsed > 0 || root.size() != m_entries.size()) m_unsaved = 1;
+    qCDebug(lcPerf) << "UrlIndex: loaded" << m_entries.size() << "urls from" << m_path << "renormalized=" << collapsed;
+}
+
+QString UrlIndex::fileFor(const QString &url) const
+{
+    const QString key = normalize(url);
+    QMutexLocker lock(&m_mutex);
+    auto it = m_entries.constFind(key);
+    return it == m_entries.constEnd() ? QString() : it->file;
+}
+
+void UrlIndex::setFile(const QString &url, const QString &fileName)
+{
+    if (fileName.isEmpty()) return;
+    const QString key = normalize(url);
+    QMutexLocker lock(&m_mutex);
+    Entry &e = m_entries[key];
+    if (e.file == fileName) return;
+    e.file = fileName;
+    noteChangeLocked();
+}
+
+void UrlIndex::addSubreddit(const QString &url, const QString &subreddit)
+{
+    if (subreddit.isEmpty()) return;
+    const QString key = normalize(url);
+    QMutexLocker lock(&m_mutex);
+    Entry &e = m_entries[key];
+    if (e.subreddits.contains(subreddit)) return;
+    e.subreddits.append(subreddit);
+    noteChangeLocked();
+}
+
+QStringList UrlIndex::subredditsFor(const QString &url) const
+{
+    const QString key = normalize(url);
+    QMutexLocker lock(&m_mutex);
+    return m_entries.value(key).subreddits;
+}
+
+void UrlIndex::setRejected(const QString &url, const QString &reason)
+{
+    const QString key = normalize(url);
+    QMutexLocker lock(&m_mutex);
+    Entry &e = m_entries[key];
+    if (e.rejected == reason) return;
+    e.rejected = reason;
+    noteChangeLocked();
+}
+
+bool UrlIndex::isRejected(const QString &url) const
+{
+    const QString key = normalize(url);
+    QMutexLocker lock(&m_mutex);
+    auto it = m_entries.constFind(key);
+    return it != m_entries.constEnd() && !it->rejected.isEmpty();
+}
+
+void UrlIndex::noteChangeLocked()
+{
+    if (++m_unsaved >= kSaveEvery) saveLocked();
+}
+
+bool UrlIndex::save()
+{
+    QMutexLocker lock(&m_mutex);
+    return saveLocked();
+}
+
+bool UrlIndex::saveLocked()
+{
+    if (m_unsaved == 0) return true;
+    QJsonObject root;
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        QJsonObject obj;
+        if (!it->file.isEmpty()) obj.insert("file", it->file);
+        if (!it->rejected.isEmpty()) obj.insert("rejected", it->rejected);
+        obj.insert("subreddits", QJsonArray::fromStringList(it->subreddits));
+        root.insert(it.key(), obj);
+    }
+    QDir().mkpath(QFileInfo(m_path).absolutePath());
+    QSaveFile sf(m_path);
+    if (!sf.open(QIODevice::WriteOnly)) {
+        qWarning() << "UrlIndex: failed to write" << m_path;
+        return false;
+    }
+    sf.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+    if (!sf.commit()) {
+        qWarning() << "UrlIndex: failed to commit" << m_path;
+        return false;
+    }
+    m_unsaved = 0;
+    return true;
+}
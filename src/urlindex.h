@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+// Persistent map from normalized source URL to the cached file it produced
+// (url_map.json in the config dir). Consulted before any image download so
+// re-scanning a subreddit only transfers the listing.
+//
+// File format: { "<normalized url>": { "file": "<sha256>.<ext>", "subreddits": [...],
+//                                     "rejected": "<reason>" } }
+// The older form { "<url>": [subreddits] } is still read.
+class UrlIndex {
+public:
+    // Process-wide index stored at defaultPath()
+    static UrlIndex *instance();
+    static QString defaultPath();
+
+    // Canonical form used as the key: https, lower-case host without "www.",
+    // no query/fragment, HTML entities from listing JSON decoded, and
+    // preview.redd.it folded onto i.redd.it
+    static QString normalize(const QString &url);
+
+    // Cached file name for a URL, or an empty string if unknown
+    QString fileFor(const QString &url) const;
+    void setFile(const QString &url, const QString &fileName);
+    void addSubreddit(const QString &url, const QString &subreddit);
+    QStringList subredditsFor(const QString &url) const;
+    // URLs refused by a download guard (too large); not fetched again
+    void setRejected(const QString &url, const QString &reason);
+    bool isRejected(const QString &url) const;
+
+    // Write url_map.json if anything changed (also done automatically every
+    // kSaveEvery changes and on quit)
+    bool save();
+
+    static constexpr int kSaveEvery = 64;
+
+private:
+    explicit UrlIndex(const QString &path);
+    void load();
+    void noteChangeLocked();
+    bool saveLocked();
+
+    struct Entry {
+        QString file;
+        QStringList subreddits;
+        QString rejected;
+    };
+    QString m_path;
+    mutable QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    int m_unsaved = 0;
+};
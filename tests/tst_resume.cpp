@@ -0,0 +1,177 @@
+// Resumable downloads, end to end: UpdateWorker scans against the fixture
+// server with every image body cut short, then scans again with the faults
+// off. The second scan must continue the part files with Range/If-Range (or
+// start over when it can't) and store files whose hash is the server's.
+
+#include "cachemanager.h"
+#include "fixtureserver.h"
+#include "redditfetcher.h"
+#include "updateworker.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QtTest>
+
+class TestResume : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void resumesDroppedTransfer();
+    void restartsWhenRangesIgnored();
+    void restartsWhenValidatorChanged();
+
+private:
+    static constexpr int kImages = 3;
+    // One Newest scan of `subreddit`; returns the paths of the stored images
+    QStringList scan(const QString &subreddit);
+    // Part files left in the cache dir
+    int partFiles() const;
+    QString imagePath(const QString &subreddit, int n) const;
+    static QByteArray sha256(const QByteArray &data);
+    // every stored file is one of the subreddit's images, byte for byte
+    void verifyStored(const QStringList &stored, const QString &subreddit);
+
+    QTemporaryDir m_home;
+    FixtureServer m_server;
+    // cut every image body after this many bytes
+    static constexpr qint64 kDropAfter = 20000;
+};
+
+void TestResume::initTestCase()
+{
+    // the cache, config and listing cache all live under HOME
+    QVERIFY(m_home.isValid());
+    qputenv("HOME", m_home.path().toLocal8Bit());
+    qunsetenv("XDG_CONFIG_HOME");
+    qunsetenv("XDG_CACHE_HOME");
+    // each test has its own subreddit, so URLs never collide between tests
+    m_server.addSyntheticSubreddits({ "resume", "noranges", "changed" }, kImages, QSize(1280, 720));
+    QVERIFY(m_server.listen());
+    RedditFetcher::setBaseUrl(m_server.baseUrl());
+    QVERIFY(m_server.file(imagePath("resume", 0)).size() > kDropAfter * 2);
+}
+
+void TestResume::cleanupTestCase()
+{
+    // thumbnail tasks queued by finishIngest
+    QThreadPool::globalInstance()->waitForDone();
+}
+
+QStringList TestResume::scan(const QString &subreddit)
+{
+    CacheManager cache;
+    UpdateWorker worker(&cache, { subreddit }, kImages);
+    worker.setListingMode(UpdateWorker::Newest);
+    QStringList stored;
+    connect(&worker, &UpdateWorker::imageCached, this, [&stored](const QString &localPath) { stored << localPath; });
+    QSignalSpy finished(&worker, &UpdateWorker::finished);
+    worker.start();
+    if (finished.isEmpty()) finished.wait(30000);
+    return stored;
+}
+
+int TestResume::partFiles() const
+{
+    const QDir cacheDir(CacheManager().cacheDirPath());
+    return cacheDir.entryList({ ".ingest-*.part" }, QDir::Files | QDir::Hidden).size();
+}
+
+QString TestResume::imagePath(const QString &subreddit, int n) const
+{
+    return QString("/img/%1/%2.jpg").arg(subreddit).arg(n);
+}
+
+QByteArray TestResume::sha256(const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+}
+
+void TestResume::verifyStored(const QStringList &stored, const QString &subreddit)
+{
+    QSet<QByteArray> expected;
+    for (int n = 0; n < kImages; ++n) expected.insert(sha256(m_server.file(imagePath(subreddit, n))));
+    QCOMPARE(stored.size(), kImages);
+    for (const QString &path : stored) {
+        QFile f(path);
+        QVERIFY(f.open(QIODevice::ReadOnly));
+        const QByteArray hash = sha256(f.readAll());
+        QVERIFY2(expected.contains(hash), qPrintable(path));
+        // cached files are named by their content hash
+        QCOMPARE(QFileInfo(path).baseName().toLatin1(), hash);
+    }
+}
+
+void TestResume::resumesDroppedTransfer()
+{
+    FixtureServer::Faults drop;
+    drop.dropEvery = 1;
+    drop.dropAfterBytes = kDropAfter;
+    m_server.setFaults(drop);
+    const int partsBefore = partFiles();
+    QVERIFY(scan("resume").isEmpty());
+    QCOMPARE(partFiles(), partsBefore + kImages);
+
+    m_server.setFaults(FixtureServer::Faults());
+    const qint64 ranged = m_server.stats().partial;
+    const qint64 sentBefore = m_server.stats().bodyBytes;
+    const QStringList stored = scan("resume");
+    verifyStored(stored, "resume");
+    // continued with 206s, not fetched again from the start
+    QCOMPARE(m_server.stats().partial - ranged, qint64(kImages));
+    qint64 whole = 0;
+    for (int n = 0; n < kImages; ++n) whole += m_server.file(imagePath("resume", n)).size();
+    // less than the whole bodies again (the listing is a few KiB)
+    QVERIFY(m_server.stats().bodyBytes - sentBefore < whole);
+    QCOMPARE(partFiles(), partsBefore);
+}
+
+void TestResume::restartsWhenRangesIgnored()
+{
+    FixtureServer::Faults drop;
+    drop.dropEvery = 1;
+    drop.dropAfterBytes = kDropAfter;
+    m_server.setFaults(drop);
+    const int partsBefore = partFiles();
+    QVERIFY(scan("noranges").isEmpty());
+    QCOMPARE(partFiles(), partsBefore + kImages);
+
+    // the Range header is ignored: 200 with the whole body, the part restarts
+    FixtureServer::Faults noRanges;
+    noRanges.ranges = false;
+    m_server.setFaults(noRanges);
+    const qint64 ranged = m_server.stats().partial;
+    verifyStored(scan("noranges"), "noranges");
+    QCOMPARE(m_server.stats().partial, ranged);
+    QCOMPARE(partFiles(), partsBefore);
+}
+
+void TestResume::restartsWhenValidatorChanged()
+{
+    FixtureServer::Faults drop;
+    drop.dropEvery = 1;
+    drop.dropAfterBytes = kDropAfter;
+    m_server.setFaults(drop);
+    const int partsBefore = partFiles();
+    QVERIFY(scan("changed").isEmpty());
+    QCOMPARE(partFiles(), partsBefore + kImages);
+
+    // new content under the same URLs: If-Range no longer matches the ETag
+    for (int n = 0; n < kImages; ++n) {
+        const QString path = imagePath("changed", n);
+        m_server.addFile(path, m_server.file(path) + " replaced", "image/jpeg");
+    }
+    m_server.setFaults(FixtureServer::Faults());
+    const qint64 ranged = m_server.stats().partial;
+    verifyStored(scan("changed"), "changed");
+    QCOMPARE(m_server.stats().partial, ranged);
+    QCOMPARE(partFiles(), partsBefore);
+}
+
+QTEST_GUILESS_MAIN(TestResume)
+#include "tst_resume.moc"